@@ -0,0 +1,477 @@
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+#include <assimp/scene.h>
+
+#include "VulkanRenderer.h"
+#include "FrameWriter.h"
+
+// the loading, upload and recording paths one at a time, each over a range of sizes. every case runs
+// until it has taken at least --min-time seconds and reports the time per iteration. by default on a
+// software device, so the numbers can be compared on machines without a gpu.
+
+// handed to every benchmark, the loop runs iterations times and setup that should not count goes
+// between pause() and resume()
+class BenchState
+{
+public:
+  BenchState(int64_t newRange, uint64_t newIterations) : range(newRange), iterations(newIterations) {}
+
+  int64_t getRange(){return range;}
+  uint64_t getIterations(){return iterations;}
+  void pause(){pauseStart = std::chrono::steady_clock::now();}
+  void resume(){pausedSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - pauseStart).count();}
+  double getPausedSeconds(){return pausedSeconds;}
+
+  // per iteration, for the throughput column
+  void setBytesProcessed(uint64_t bytes){bytesProcessed = bytes;}
+  uint64_t getBytesProcessed(){return bytesProcessed;}
+
+private:
+  int64_t range;
+  uint64_t iterations;
+  uint64_t bytesProcessed{0};
+  std::chrono::steady_clock::time_point pauseStart;
+  double pausedSeconds{0.0};
+};
+
+struct Benchmark {
+  std::string name;
+  std::function<void(BenchState*)> run;
+  std::vector<int64_t> ranges;
+};
+
+VulkanRenderer vulkanRenderer;
+
+// reaches the loaders and the command recording behind VulkanRenderer's public interface
+class RendererBench
+{
+public:
+  static std::string getDeviceName()
+  {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(vulkanRenderer.mainDevice.physicalDevice, &properties);
+    return properties.deviceName;
+  }
+
+  static Mesh loadMesh(aiMesh *mesh, const aiScene *scene)
+  {
+    return MeshModel::LoadMesh(vulkanRenderer.mainDevice.physicalDevice, vulkanRenderer.mainDevice.logicalDevice,
+                               vulkanRenderer.graphicsQueue, vulkanRenderer.graphicsCommandPool, mesh, scene, {0});
+  }
+
+  static stbi_uc *loadTextureFile(const std::string &fileName, int *width, int *height)
+  {
+    VkDeviceSize imageSize;
+    return vulkanRenderer.loadTextureFile(fileName, width, height, &imageSize);
+  }
+
+  static void uploadBuffer(const std::vector<uint8_t> &data, VkBuffer *buffer, VkDeviceMemory *bufferMemory)
+  {
+    VkPhysicalDevice physicalDevice = vulkanRenderer.mainDevice.physicalDevice;
+    VkDevice device = vulkanRenderer.mainDevice.logicalDevice;
+
+    // the same staging path as the vertex and index buffers
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    createBuffer(physicalDevice, device, data.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Staging,
+                 &stagingBuffer, &stagingBufferMemory);
+
+    void *mapped;
+    vkMapMemory(device, stagingBufferMemory, 0, data.size(), 0, &mapped);
+    memcpy(mapped, data.data(), data.size());
+    vkUnmapMemory(device, stagingBufferMemory);
+
+    createBuffer(physicalDevice, device, data.size(), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Mesh, buffer, bufferMemory);
+    copyBuffer(device, vulkanRenderer.graphicsQueue, vulkanRenderer.graphicsCommandPool, stagingBuffer, *buffer, data.size());
+
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    MemoryTracker::free(device, stagingBufferMemory);
+  }
+
+  static void destroyBuffer(VkBuffer buffer, VkDeviceMemory bufferMemory)
+  {
+    vkDestroyBuffer(vulkanRenderer.mainDevice.logicalDevice, buffer, nullptr);
+    MemoryTracker::free(vulkanRenderer.mainDevice.logicalDevice, bufferMemory);
+  }
+
+  static void createTextureImage(const std::vector<uint8_t> &pixels, uint32_t size)
+  {
+    vulkanRenderer.createTextureImage(pixels.data(), size, size);
+  }
+
+  // createTextureImage appends to the renderer's texture list, this takes the last one off again
+  static void destroyLastTextureImage()
+  {
+    vkDestroyImage(vulkanRenderer.mainDevice.logicalDevice, vulkanRenderer.textureImages.back(), nullptr);
+    MemoryTracker::free(vulkanRenderer.mainDevice.logicalDevice, vulkanRenderer.textureImageMemory.back());
+    vulkanRenderer.textureImages.pop_back();
+    vulkanRenderer.textureImageMemory.pop_back();
+  }
+
+  // what draw does before the transforms are flushed
+  static void updateTransforms()
+  {
+    for(auto &model: vulkanRenderer.models)
+    {
+      model.updateTransforms(&vulkanRenderer.transformBuffer);
+    }
+  }
+
+  static void recordCommands()
+  {
+    vulkanRenderer.recordCommands(0);
+  }
+
+  // the readback pass hands out a slot per recording, nothing is submitted so they come straight back
+  static void releaseReadbacks()
+  {
+    for(const auto &frame: vulkanRenderer.frameReadback.collect(vulkanRenderer.frameCounter + 1))
+    {
+      vulkanRenderer.frameReadback.release(frame.slot);
+    }
+  }
+};
+
+// a grid of vertices with two triangles per cell, as assimp hands it over after triangulation
+void fillMesh(aiMesh *mesh, uint32_t vertexCount)
+{
+  uint32_t columns = std::max(2u, static_cast<uint32_t>(std::sqrt(float(vertexCount))));
+  uint32_t rows = std::max(2u, vertexCount/columns);
+
+  mesh->mNumVertices = columns*rows;
+  mesh->mVertices = new aiVector3D[mesh->mNumVertices];
+  mesh->mTextureCoords[0] = new aiVector3D[mesh->mNumVertices];
+  mesh->mNumUVComponents[0] = 2;
+  for(uint32_t y=0; y<rows; y++)
+  {
+    for(uint32_t x=0; x<columns; x++)
+    {
+      float u = float(x)/(columns - 1);
+      float v = float(y)/(rows - 1);
+      mesh->mVertices[y*columns + x] = aiVector3D(u, 0.05f*std::sin(12.0f*u)*std::cos(9.0f*v), v);
+      mesh->mTextureCoords[0][y*columns + x] = aiVector3D(u, v, 0.0f);
+    }
+  }
+
+  mesh->mNumFaces = 2*(columns - 1)*(rows - 1);
+  mesh->mFaces = new aiFace[mesh->mNumFaces];
+  uint32_t face = 0;
+  for(uint32_t y=0; y + 1<rows; y++)
+  {
+    for(uint32_t x=0; x + 1<columns; x++)
+    {
+      uint32_t i0 = y*columns + x;
+      uint32_t i1 = i0 + columns;
+      uint32_t corners[2][3] = {{i0, i1, i0 + 1}, {i0 + 1, i1, i1 + 1}};
+      for(auto &corner: corners)
+      {
+        mesh->mFaces[face].mNumIndices = 3;
+        mesh->mFaces[face].mIndices = new unsigned int[3]{corner[0], corner[1], corner[2]};
+        face++;
+      }
+    }
+  }
+}
+
+std::vector<uint8_t> noisePixels(uint32_t size)
+{
+  std::vector<uint8_t> pixels(size_t(size)*size*4);
+  uint32_t state = 12345;
+  for(auto &pixel: pixels)
+  {
+    state = state*1664525u + 1013904223u;
+    pixel = static_cast<uint8_t>(state >> 24);
+  }
+  return pixels;
+}
+
+std::string textureFileName(uint32_t size)
+{
+  char fileName[32];
+  snprintf(fileName, sizeof(fileName), "microbench_%06u.png", size);
+  return fileName;
+}
+
+void benchLoadMesh(BenchState *state)
+{
+  aiScene scene;
+  scene.mNumMaterials = 1;
+  scene.mMaterials = new aiMaterial*[1]{new aiMaterial()};
+
+  aiMesh mesh;
+  fillMesh(&mesh, static_cast<uint32_t>(state->getRange()));
+  state->setBytesProcessed(uint64_t(mesh.mNumVertices)*sizeof(Vertex) + uint64_t(mesh.mNumFaces)*3*sizeof(uint32_t));
+
+  for(uint64_t i=0; i<state->getIterations(); i++)
+  {
+    Mesh loaded = RendererBench::loadMesh(&mesh, &scene);
+
+    state->pause();
+    loaded.destroyBuffers();
+    state->resume();
+  }
+}
+
+void benchDecodeTexture(BenchState *state)
+{
+  std::string fileName = textureFileName(static_cast<uint32_t>(state->getRange()));
+  state->setBytesProcessed(uint64_t(state->getRange())*state->getRange()*4);
+
+  for(uint64_t i=0; i<state->getIterations(); i++)
+  {
+    int width, height;
+    stbi_uc *pixels = RendererBench::loadTextureFile(fileName, &width, &height);
+    stbi_image_free(pixels);
+  }
+}
+
+void benchBufferUpload(BenchState *state)
+{
+  std::vector<uint8_t> data(static_cast<size_t>(state->getRange()), 0x5a);
+  state->setBytesProcessed(data.size());
+
+  for(uint64_t i=0; i<state->getIterations(); i++)
+  {
+    VkBuffer buffer;
+    VkDeviceMemory bufferMemory;
+    RendererBench::uploadBuffer(data, &buffer, &bufferMemory);
+
+    state->pause();
+    RendererBench::destroyBuffer(buffer, bufferMemory);
+    state->resume();
+  }
+}
+
+void benchCreateTextureImage(BenchState *state)
+{
+  uint32_t size = static_cast<uint32_t>(state->getRange());
+  std::vector<uint8_t> pixels = noisePixels(size);
+  state->setBytesProcessed(pixels.size());
+
+  for(uint64_t i=0; i<state->getIterations(); i++)
+  {
+    RendererBench::createTextureImage(pixels, size);
+
+    state->pause();
+    RendererBench::destroyLastTextureImage();
+    state->resume();
+  }
+}
+
+// models only ever get added, the ranges run in ascending order
+std::vector<ObjectHandle> gridModels;
+
+void addGridModels(size_t count)
+{
+  while(gridModels.size() < count)
+  {
+    std::vector<MeshData> meshes(1);
+    aiMesh grid;
+    fillMesh(&grid, 64);
+    for(uint32_t v=0; v<grid.mNumVertices; v++)
+    {
+      float x = float(gridModels.size() % 64) - 32.0f;
+      float z = float(gridModels.size() / 64)*-1.0f;
+      Vertex vertex;
+      vertex.pos = {grid.mVertices[v].x + x, grid.mVertices[v].y, grid.mVertices[v].z + z};
+      vertex.col = {1.0f, 1.0f, 1.0f};
+      vertex.tex = {grid.mTextureCoords[0][v].x, grid.mTextureCoords[0][v].y};
+      meshes[0].vertices.push_back(vertex);
+    }
+    for(uint32_t f=0; f<grid.mNumFaces; f++)
+    {
+      meshes[0].indices.insert(meshes[0].indices.end(), grid.mFaces[f].mIndices, grid.mFaces[f].mIndices + 3);
+    }
+    meshes[0].texId = 0;
+    gridModels.push_back(vulkanRenderer.createMeshModel(&meshes));
+  }
+}
+
+void benchRecordCommands(BenchState *state)
+{
+  addGridModels(static_cast<size_t>(state->getRange()));
+
+  for(uint64_t i=0; i<state->getIterations(); i++)
+  {
+    RendererBench::recordCommands();
+
+    state->pause();
+    RendererBench::releaseReadbacks();
+    state->resume();
+  }
+}
+
+void benchUpdateModel(BenchState *state)
+{
+  uint32_t count = static_cast<uint32_t>(state->getRange());
+  addGridModels(count);
+
+  for(uint64_t i=0; i<state->getIterations(); i++)
+  {
+    for(uint32_t model=0; model<count; model++)
+    {
+      glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(float(model), 0.0f, float(i)));
+      vulkanRenderer.updateModel(gridModels[model], glm::rotate(transform, float(model + i), glm::vec3(0.0f, 1.0f, 0.0f)));
+    }
+    RendererBench::updateTransforms();
+  }
+}
+
+void benchUpdateModels(BenchState *state)
+{
+  uint32_t count = static_cast<uint32_t>(state->getRange());
+  addGridModels(count);
+
+  std::vector<glm::vec3> positions(count);
+  std::vector<glm::quat> rotations(count);
+  std::vector<glm::vec3> scales(count, glm::vec3(1.0f));
+  for(uint64_t i=0; i<state->getIterations(); i++)
+  {
+    for(uint32_t model=0; model<count; model++)
+    {
+      positions[model] = glm::vec3(float(model), 0.0f, float(i));
+      rotations[model] = glm::angleAxis(float(model + i), glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+
+    vulkanRenderer.updateModels(gridModels.data(), count, positions.data(), rotations.data(), scales.data());
+    RendererBench::updateTransforms();
+  }
+}
+
+// png files of each size for the decode benchmark, from the frame writer's encoder
+std::vector<std::string> writeTextureFiles(const std::vector<int64_t> &sizes)
+{
+  std::vector<std::string> files;
+  FrameWriter writer;
+  writer.start(FrameWriter::Sink::Png, "textures/microbench_", nullptr);
+  std::vector<std::vector<uint8_t>> images;
+  for(int64_t size: sizes)
+  {
+    images.push_back(noisePixels(static_cast<uint32_t>(size)));
+
+    FrameReadback::Frame frame{};
+    frame.frameIndex = static_cast<uint64_t>(size);
+    frame.width = static_cast<uint32_t>(size);
+    frame.height = static_cast<uint32_t>(size);
+    frame.rowPitch = frame.width*4;
+    frame.pixels = images.back().data();
+    writer.push(frame);
+    files.push_back("textures/" + textureFileName(static_cast<uint32_t>(size)));
+  }
+  writer.stop();
+  return files;
+}
+
+void runBenchmark(const Benchmark &benchmark, int64_t range, double minSeconds)
+{
+  // grow the iteration count until a run takes long enough to time
+  uint64_t iterations = 1;
+  while(true)
+  {
+    BenchState state(range, iterations);
+    auto start = std::chrono::steady_clock::now();
+    benchmark.run(&state);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+                   - state.getPausedSeconds();
+
+    if(seconds >= minSeconds || iterations >= (1ull << 30))
+    {
+      double nsPerIteration = seconds*1e9/iterations;
+      printf("%-28s %12.0f ns %10llu", (benchmark.name + "/" + std::to_string(range)).c_str(), nsPerIteration,
+             static_cast<unsigned long long>(iterations));
+      if(state.getBytesProcessed() > 0)
+      {
+        printf(" %10.1f MB/s", state.getBytesProcessed()*iterations/seconds/1048576.0);
+      }
+      printf("\n");
+      return;
+    }
+
+    // aim a little past the minimum so the next run is usually the last
+    double scale = seconds > 0.0 ? 1.4*minSeconds/seconds : 100.0;
+    iterations = std::max(iterations + 1, static_cast<uint64_t>(iterations*std::min(scale, 100.0)));
+  }
+}
+
+int main(int argc, char **argv)
+{
+  std::string filter;
+  double minSeconds = 0.5;
+  bool preferCpu = true;
+  for(int i=1; i<argc; i++)
+  {
+    if(strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+    {
+      // substring of the benchmark name
+      filter = argv[++i];
+    }
+    else if(strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+    {
+      minSeconds = atof(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--gpu") == 0)
+    {
+      preferCpu = false;
+    }
+  }
+
+  std::vector<Benchmark> benchmarks = {
+    {"LoadMesh", benchLoadMesh, {1024, 8192, 65536}},
+    {"DecodeTexture", benchDecodeTexture, {256, 1024, 2048}},
+    {"BufferUpload", benchBufferUpload, {4096, 262144, 16777216}},
+    {"CreateTextureImage", benchCreateTextureImage, {256, 1024, 2048}},
+    {"RecordCommands", benchRecordCommands, {16, 256, 2048}},
+    {"UpdateModel", benchUpdateModel, {16, 256, 2048}},
+    {"UpdateModels", benchUpdateModels, {16, 256, 2048}},
+  };
+
+  vulkanRenderer.setPreferCpuDevice(preferCpu);
+  if(vulkanRenderer.initHeadless(256, 256) == EXIT_FAILURE)
+  {
+    return EXIT_FAILURE;
+  }
+
+  int exitCode = 0;
+  std::vector<std::string> textureFiles;
+  try {
+    printf("device %s\n", RendererBench::getDeviceName().c_str());
+    printf("%-28s %15s %10s %13s\n", "benchmark", "time", "iterations", "throughput");
+
+    for(const auto &benchmark: benchmarks)
+    {
+      if(benchmark.name.find(filter) == std::string::npos) continue;
+
+      if(benchmark.name == "DecodeTexture")
+      {
+        textureFiles = writeTextureFiles(benchmark.ranges);
+      }
+      for(int64_t range: benchmark.ranges)
+      {
+        runBenchmark(benchmark, range, minSeconds);
+      }
+    }
+  }
+  catch (const std::runtime_error &e) {
+    printf("ERROR: %s\n", e.what());
+    exitCode = EXIT_FAILURE;
+  }
+
+  for(const auto &file: textureFiles)
+  {
+    remove(file.c_str());
+  }
+  vulkanRenderer.cleanup();
+  return exitCode;
+}
@@ -0,0 +1,391 @@
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "VulkanRenderer.h"
+#include "CpuProfiler.h"
+#include "MemoryTracker.h"
+
+// renders a procedurally generated scene headless for a fixed number of frames and reports frame times,
+// draw calls, upload throughput and load times as json. the same options and seed give the same scene
+// and the same frames, so two builds can be compared run against run.
+
+struct BenchConfig {
+  uint32_t models{64};
+  uint32_t meshesPerModel{4};
+  uint32_t textures{8};
+  uint32_t trianglesPerMesh{2000};
+  uint32_t frames{500};
+  uint32_t warmupFrames{20};
+  uint32_t width{1280};
+  uint32_t height{720};
+  uint32_t latencyFrames{DEFAULT_LATENCY_FRAMES};
+  uint32_t seed{1};
+  std::string output{"vkbench.json"};
+};
+
+struct LoadStats {
+  float textureUploadMs;
+  float meshLoadMs;
+  uint64_t textureBytes;
+  uint64_t meshBytes;
+  uint64_t triangles;
+};
+
+const float PI = 3.14159265358979f;
+
+VulkanRenderer vulkanRenderer;
+
+std::vector<uint8_t> generateTexture(std::mt19937 *rng, uint32_t size)
+{
+  std::uniform_int_distribution<int> channel(40, 255);
+  uint8_t a[3] = {uint8_t(channel(*rng)), uint8_t(channel(*rng)), uint8_t(channel(*rng))};
+  uint8_t b[3] = {uint8_t(channel(*rng)), uint8_t(channel(*rng)), uint8_t(channel(*rng))};
+  uint32_t checker = 1u << std::uniform_int_distribution<int>(2, 5)(*rng);
+
+  std::vector<uint8_t> pixels(size_t(size)*size*4);
+  for(uint32_t y=0; y<size; y++)
+  {
+    for(uint32_t x=0; x<size; x++)
+    {
+      const uint8_t *colour = ((x/checker + y/checker) & 1) ? a : b;
+      uint8_t *pixel = &pixels[(size_t(y)*size + x)*4];
+      pixel[0] = colour[0];
+      pixel[1] = colour[1];
+      pixel[2] = colour[2];
+      pixel[3] = 255;
+    }
+  }
+  return pixels;
+}
+
+// a sphere with a wobbly radius, about the requested number of triangles
+MeshData generateMesh(std::mt19937 *rng, uint32_t triangles, int texId)
+{
+  uint32_t rings = std::max(2u, static_cast<uint32_t>(std::sqrt(triangles/4.0f)));
+  uint32_t segments = std::max(3u, triangles/(2*rings));
+
+  std::uniform_real_distribution<float> offset(-0.8f, 0.8f);
+  std::uniform_int_distribution<int> frequency(2, 7);
+  glm::vec3 centre(offset(*rng), offset(*rng), offset(*rng));
+  float scale = 0.4f + 0.2f*std::uniform_real_distribution<float>(0.0f, 1.0f)(*rng);
+  float ringFrequency = float(frequency(*rng));
+  float segmentFrequency = float(frequency(*rng));
+
+  MeshData mesh;
+  mesh.texId = texId;
+  mesh.vertices.reserve((rings + 1)*(segments + 1));
+  for(uint32_t r=0; r<=rings; r++)
+  {
+    float theta = PI*r/rings;
+    for(uint32_t s=0; s<=segments; s++)
+    {
+      float phi = 2.0f*PI*s/segments;
+      float radius = scale*(1.0f + 0.15f*std::sin(ringFrequency*theta)*std::cos(segmentFrequency*phi));
+      glm::vec3 direction(std::sin(theta)*std::cos(phi), std::cos(theta), std::sin(theta)*std::sin(phi));
+
+      Vertex vertex;
+      vertex.pos = centre + radius*direction;
+      vertex.col = {1.0f, 1.0f, 1.0f};
+      vertex.tex = {float(s)/segments, float(r)/rings};
+      mesh.vertices.push_back(vertex);
+    }
+  }
+
+  mesh.indices.reserve(6*rings*segments);
+  for(uint32_t r=0; r<rings; r++)
+  {
+    for(uint32_t s=0; s<segments; s++)
+    {
+      uint32_t i0 = r*(segments + 1) + s;
+      uint32_t i1 = i0 + segments + 1;
+      mesh.indices.insert(mesh.indices.end(), {i0, i1, i0 + 1, i0 + 1, i1, i1 + 1});
+    }
+  }
+  return mesh;
+}
+
+LoadStats buildScene(const BenchConfig &config, std::vector<ObjectHandle> *models)
+{
+  LoadStats stats{};
+  std::mt19937 rng(config.seed);
+
+  // texture 0 is plain white, the sampler pool holds MAX_OBJECTS
+  uint32_t textureCount = std::min<uint32_t>(config.textures, MAX_OBJECTS - 1);
+  if(textureCount < config.textures)
+  {
+    printf("only %u textures fit the sampler pool\n", textureCount);
+  }
+
+  // generated up front so the timing only covers the upload
+  std::vector<std::vector<uint8_t>> texturePixels(textureCount);
+  for(auto &pixels: texturePixels)
+  {
+    pixels = generateTexture(&rng, 256);
+    stats.textureBytes += pixels.size();
+  }
+
+  std::vector<int> textures = {0};
+  auto textureStart = std::chrono::steady_clock::now();
+  for(const auto &pixels: texturePixels)
+  {
+    textures.push_back(vulkanRenderer.createTexture(pixels, 256, 256));
+  }
+  stats.textureUploadMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - textureStart).count();
+  texturePixels.clear();
+
+  // lod generation is part of creating a mesh model, so the mesh timing covers lod generation and upload
+  std::vector<std::vector<MeshData>> modelMeshes(config.models);
+  std::uniform_int_distribution<size_t> textureIndex(0, textures.size() - 1);
+  for(auto &meshes: modelMeshes)
+  {
+    for(uint32_t i=0; i<config.meshesPerModel; i++)
+    {
+      meshes.push_back(generateMesh(&rng, config.trianglesPerMesh, textures[textureIndex(rng)]));
+      stats.meshBytes += meshes.back().vertices.size()*sizeof(Vertex) + meshes.back().indices.size()*sizeof(uint32_t);
+      stats.triangles += meshes.back().indices.size()/3;
+    }
+  }
+
+  auto meshStart = std::chrono::steady_clock::now();
+  for(auto &meshes: modelMeshes)
+  {
+    models->push_back(vulkanRenderer.createMeshModel(&meshes));
+  }
+  stats.meshLoadMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - meshStart).count();
+
+  return stats;
+}
+
+// models on a square grid facing the camera, each spinning at its own rate, updated in one batch
+void updateScene(const std::vector<ObjectHandle> &models, uint32_t frame)
+{
+  static std::vector<glm::vec3> positions;
+  static std::vector<glm::quat> rotations;
+  static std::vector<glm::vec3> scales;
+  positions.resize(models.size());
+  rotations.resize(models.size());
+  scales.assign(models.size(), glm::vec3(1.0f));
+
+  uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(float(models.size()))));
+  for(size_t i=0; i<models.size(); i++)
+  {
+    float x = (float(i % columns) - 0.5f*(columns - 1))*3.0f;
+    float z = (float(i / columns) - 0.5f*(columns - 1))*3.0f;
+    float angle = glm::radians(float(frame)*(0.5f + 0.1f*(i % 7)));
+
+    positions[i] = glm::vec3(x, 0.0f, z);
+    rotations[i] = glm::angleAxis(angle, glm::vec3(0.0f, 1.0f, 0.0f));
+  }
+  vulkanRenderer.updateModels(models.data(), static_cast<uint32_t>(models.size()), positions.data(), rotations.data(),
+                              scales.data());
+}
+
+void setCamera(size_t modelCount)
+{
+  float extent = 1.5f*std::ceil(std::sqrt(float(modelCount)))*3.0f;
+  // through setProjection so the post near and far planes match the scene
+  vulkanRenderer.setProjection(45.0f, 0.1f, 4.0f*extent);
+  vulkanRenderer.setView(glm::lookAt(glm::vec3(0.0f, extent, extent), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+}
+
+float percentile(const std::vector<float> &sorted, float fraction)
+{
+  if(sorted.empty()) return 0.0f;
+  size_t index = static_cast<size_t>(std::ceil(fraction*sorted.size()));
+  return sorted[std::min(sorted.size(), std::max<size_t>(index, 1)) - 1];
+}
+
+void writeReport(FILE *file, const BenchConfig &config, const LoadStats &load, const std::vector<float> &frameTimes,
+                 float seconds, uint32_t drawCalls, uint64_t triangles)
+{
+  std::vector<float> sorted = frameTimes;
+  std::sort(sorted.begin(), sorted.end());
+  float sum = 0.0f;
+  for(float time: sorted)
+  {
+    sum += time;
+  }
+
+  const VulkanRenderer::StartupMetrics &startup = vulkanRenderer.getStartupMetrics();
+  double textureMb = load.textureBytes/1048576.0;
+  double textureSeconds = load.textureUploadMs*1e-3;
+
+  fprintf(file, "{\n");
+  fprintf(file, "  \"config\": {\"models\": %u, \"meshesPerModel\": %u, \"textures\": %u, \"trianglesPerMesh\": %u, "
+                "\"frames\": %u, \"width\": %u, \"height\": %u, \"latencyFrames\": %u, \"seed\": %u},\n",
+          config.models, config.meshesPerModel, config.textures, config.trianglesPerMesh, config.frames,
+          config.width, config.height, config.latencyFrames, config.seed);
+  fprintf(file, "  \"load\": {\"initMs\": %.3f, \"pipelineMs\": %.3f, \"textureUploadMs\": %.3f, \"textureBytes\": %llu, "
+                "\"textureUploadMBps\": %.1f, \"meshLoadMs\": %.3f, \"meshBytes\": %llu, \"sceneTriangles\": %llu},\n",
+          startup.initMs, startup.pipelineMs, load.textureUploadMs, static_cast<unsigned long long>(load.textureBytes),
+          textureSeconds > 0.0 ? textureMb/textureSeconds : 0.0, load.meshLoadMs,
+          static_cast<unsigned long long>(load.meshBytes), static_cast<unsigned long long>(load.triangles));
+  fprintf(file, "  \"frames\": {\"count\": %zu, \"fps\": %.2f, \"meanMs\": %.3f, \"p50Ms\": %.3f, \"p90Ms\": %.3f, "
+                "\"p99Ms\": %.3f, \"maxMs\": %.3f, \"drawCalls\": %u, \"triangles\": %llu},\n",
+          sorted.size(), seconds > 0.0f ? sorted.size()/seconds : 0.0f, sorted.empty() ? 0.0f : sum/sorted.size(),
+          percentile(sorted, 0.5f), percentile(sorted, 0.9f), percentile(sorted, 0.99f),
+          sorted.empty() ? 0.0f : sorted.back(), drawCalls, static_cast<unsigned long long>(triangles));
+
+  // the last frame, every frame records the same commands
+  const RenderStats::Counters &counters = vulkanRenderer.getRenderStats();
+  const RenderStats::PipelineStatistics &statistics = vulkanRenderer.getPipelineStatistics();
+  fprintf(file, "  \"counters\": {\"instances\": %u, \"dispatches\": %u, \"pipelineBinds\": %u, "
+                "\"descriptorBinds\": %u, \"pushConstants\": %u, \"vertexInvocations\": %llu, "
+                "\"fragmentInvocations\": %llu},\n",
+          counters.instances, counters.dispatches, counters.pipelineBinds, counters.descriptorBinds,
+          counters.pushConstants, static_cast<unsigned long long>(statistics.vertexInvocations),
+          static_cast<unsigned long long>(statistics.fragmentInvocations));
+  fprintf(file, "  \"memory\": {\"currentBytes\": %llu, \"peakBytes\": %llu",
+          static_cast<unsigned long long>(MemoryTracker::getCurrent()),
+          static_cast<unsigned long long>(MemoryTracker::getPeak()));
+  for(size_t i=0; i<static_cast<size_t>(MemoryCategory::Count); i++)
+  {
+    MemoryCategory category = static_cast<MemoryCategory>(i);
+    fprintf(file, ", \"%sPeakBytes\": %llu", MemoryTracker::getCategoryName(category),
+            static_cast<unsigned long long>(MemoryTracker::getStats(category).peak));
+  }
+  fprintf(file, "},\n");
+
+  fprintf(file, "  \"gpu\": [");
+  std::vector<GpuProfiler::ZoneStats> zones = vulkanRenderer.getGpuTimings();
+  for(size_t i=0; i<zones.size(); i++)
+  {
+    fprintf(file, "%s\n    {\"zone\": \"%s\", \"minMs\": %.3f, \"averageMs\": %.3f, \"p99Ms\": %.3f}", i == 0 ? "" : ",",
+            zones[i].name.c_str(), zones[i].minMs, zones[i].averageMs, zones[i].p99Ms);
+  }
+  fprintf(file, "%s]\n}\n", zones.empty() ? "" : "\n  ");
+}
+
+int main(int argc, char **argv)
+{
+  PROFILE_THREAD("main");
+
+  BenchConfig config;
+  for(int i=1; i<argc; i++)
+  {
+    if(strcmp(argv[i], "--models") == 0 && i + 1 < argc)
+    {
+      config.models = static_cast<uint32_t>(atoi(argv[++i]));
+    }
+    else if(strcmp(argv[i], "--meshes") == 0 && i + 1 < argc)
+    {
+      config.meshesPerModel = static_cast<uint32_t>(atoi(argv[++i]));
+    }
+    else if(strcmp(argv[i], "--textures") == 0 && i + 1 < argc)
+    {
+      config.textures = static_cast<uint32_t>(atoi(argv[++i]));
+    }
+    else if(strcmp(argv[i], "--triangles") == 0 && i + 1 < argc)
+    {
+      config.trianglesPerMesh = static_cast<uint32_t>(atoi(argv[++i]));
+    }
+    else if(strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+    {
+      config.frames = static_cast<uint32_t>(atoi(argv[++i]));
+    }
+    else if(strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+    {
+      config.warmupFrames = static_cast<uint32_t>(atoi(argv[++i]));
+    }
+    else if(strcmp(argv[i], "--width") == 0 && i + 1 < argc)
+    {
+      config.width = static_cast<uint32_t>(atoi(argv[++i]));
+    }
+    else if(strcmp(argv[i], "--height") == 0 && i + 1 < argc)
+    {
+      config.height = static_cast<uint32_t>(atoi(argv[++i]));
+    }
+    else if(strcmp(argv[i], "--latency") == 0 && i + 1 < argc)
+    {
+      config.latencyFrames = static_cast<uint32_t>(atoi(argv[++i]));
+    }
+    else if(strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+    {
+      config.seed = static_cast<uint32_t>(atoi(argv[++i]));
+    }
+    else if(strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+    {
+      config.output = argv[++i];
+    }
+  }
+
+  if(config.models > MAX_INSTANCES)
+  {
+    printf("at most %d models\n", MAX_INSTANCES);
+    return EXIT_FAILURE;
+  }
+
+  vulkanRenderer.setPipelineStatistics(true);
+  if(vulkanRenderer.initHeadless(config.width, config.height) == EXIT_FAILURE)
+  {
+    return EXIT_FAILURE;
+  }
+  vulkanRenderer.setLatencyMode(config.latencyFrames);
+  // frames are rendered and read back but not kept
+  vulkanRenderer.setFrameCallback([](const FrameReadback::Frame &frame){ vulkanRenderer.releaseFrame(frame); });
+
+  int exitCode = 0;
+  try {
+    std::vector<ObjectHandle> models;
+    LoadStats load = buildScene(config, &models);
+    setCamera(models.size());
+
+    // pipelines still compiling and first use allocations stay out of the measured frames
+    for(uint32_t i=0; i<config.warmupFrames; i++)
+    {
+      updateScene(models, i);
+      vulkanRenderer.draw();
+    }
+    vulkanRenderer.finishFrames();
+
+    // frame time is the interval between frame starts, the latency mode keeps the gpu from running ahead
+    std::vector<float> frameTimes;
+    frameTimes.reserve(config.frames);
+    auto start = std::chrono::steady_clock::now();
+    auto frameStart = start;
+    for(uint32_t i=0; i<config.frames; i++)
+    {
+      updateScene(models, config.warmupFrames + i);
+      vulkanRenderer.draw();
+
+      auto frameEnd = std::chrono::steady_clock::now();
+      frameTimes.push_back(std::chrono::duration<float, std::milli>(frameEnd - frameStart).count());
+      frameStart = frameEnd;
+    }
+    vulkanRenderer.finishFrames();
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+    const VulkanRenderer::FrameMetrics &metrics = vulkanRenderer.getFrameMetrics();
+    FILE *file = fopen(config.output.c_str(), "wb");
+    if(!file)
+    {
+      printf("ERROR: Failed to write %s!\n", config.output.c_str());
+      exitCode = EXIT_FAILURE;
+    }
+    else
+    {
+      writeReport(file, config, load, frameTimes, seconds, metrics.drawCalls, metrics.triangles);
+      fclose(file);
+      printf("%u frames in %.3fs, report written to %s\n", config.frames, seconds, config.output.c_str());
+    }
+  }
+  catch (const std::runtime_error &e) {
+    printf("ERROR: %s\n", e.what());
+    exitCode = EXIT_FAILURE;
+  }
+
+  vulkanRenderer.cleanup();
+  return exitCode;
+}
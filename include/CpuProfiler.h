@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// scoped cpu zones, e.g. PROFILE_ZONE("draw") at the top of a block. every thread writes the zones it
+// closes into its own ring buffer, so recording takes no lock and only the last RING_SIZE zones of a
+// thread are kept. names have to be string literals, only the pointer is stored.
+// without VKDEMO_PROFILE the macros are empty and nothing is recorded.
+#ifdef VKDEMO_PROFILE
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) CpuProfiler::Zone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_THREAD(name) CpuProfiler::setThreadName(name)
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_THREAD(name)
+#endif
+
+class CpuProfiler
+{
+public:
+  class Zone
+  {
+  public:
+    explicit Zone(const char *newName);
+    ~Zone();
+
+    Zone(const Zone &) = delete;
+    Zone &operator=(const Zone &) = delete;
+
+  private:
+    const char *name;
+    uint64_t startNs;
+  };
+
+  static bool isEnabled();
+  static void setThreadName(const char *name);
+
+  // chrome://tracing and perfetto json, one track per thread. may run while other threads record,
+  // zones they overwrite in the meantime are left out
+  static bool writeChromeTrace(const std::string &fileName);
+
+private:
+  static constexpr uint32_t RING_SIZE = 16384;
+
+  struct Event {
+    const char *name;
+    uint64_t startNs;
+    uint64_t endNs;
+  };
+
+  struct ThreadBuffer {
+    uint32_t threadId;
+    const char *threadName{nullptr};
+    // zones written so far, the ring holds the last RING_SIZE of them
+    std::atomic<uint64_t> written{0};
+    Event events[RING_SIZE];
+  };
+
+  // buffers outlive their threads so a trace written at exit still has the worker zones
+  static std::mutex buffersMutex;
+  static std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+  static uint64_t now();
+  static ThreadBuffer *threadBuffer();
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include "Utilities.h"
+
+// one persistently mapped buffer split into a region per frame in flight. the head of each region
+// holds the per frame constants that survive between frames, transient data is bump allocated behind it
+// and released all at once when the frame comes around again.
+class FrameAllocator
+{
+public:
+  struct Allocation {
+    VkDeviceSize offset;
+    void *data;
+  };
+
+  FrameAllocator() = default;
+
+  void create(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkBufferUsageFlags usage,
+              VkDeviceSize newPersistentSize, VkDeviceSize newTransientSize, uint32_t frameCount);
+  void destroy();
+
+  void beginFrame(uint32_t frame);
+  Allocation allocate(VkDeviceSize size);
+  Allocation persistent(uint32_t frame);
+  void flush(const Allocation &allocation, VkDeviceSize size);
+
+  VkBuffer getBuffer(){return buffer;}
+  VkDeviceSize getAlignment(){return alignment;}
+
+private:
+  VkPhysicalDevice physicalDevice;
+  VkDevice device;
+
+  VkBuffer buffer;
+  VkDeviceMemory memory;
+  VkDeviceSize allocationSize;
+  char *mapped;
+  bool coherent{false};
+
+  VkDeviceSize alignment{1};
+  VkDeviceSize persistentSize{0};
+  VkDeviceSize regionSize{0};
+
+  uint32_t currentFrame{0};
+  VkDeviceSize head{0};
+
+  VkDeviceSize alignUp(VkDeviceSize value){return (value + alignment - 1)/alignment*alignment;}
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <mutex>
+#include "Utilities.h"
+
+// host visible copies of rendered frames. a copy is recorded into the frame's command buffer, once the
+// timeline has passed that frame the slot is collected and handed out without copying. the consumer
+// gives the slot back with release(), which may happen from any thread.
+class FrameReadback
+{
+public:
+  struct Frame {
+    uint64_t frameIndex;
+    uint32_t slot;
+    uint32_t width;
+    uint32_t height;
+    uint32_t rowPitch;
+    const void *pixels;
+  };
+
+  static const uint32_t NO_SLOT = UINT32_MAX;
+
+  FrameReadback() = default;
+
+  void create(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkExtent2D newExtent, uint32_t slotCount);
+  void destroy();
+
+  // a free slot or NO_SLOT, never blocks. oldestInFlight is the first frame whose copy is still pending,
+  // 0 when there is none and the consumer holds every slot
+  uint32_t acquireSlot(uint64_t *oldestInFlight);
+  void recordCopy(VkCommandBuffer commandBuffer, VkImage image, uint32_t slot, uint64_t frameIndex);
+  std::vector<Frame> collect(uint64_t completedFrame);
+  void release(uint32_t slot);
+
+  uint32_t getSlotCount(){return static_cast<uint32_t>(slots.size());}
+
+private:
+  enum class SlotState { Free, InFlight, Handed };
+
+  struct Slot {
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    void *mapped;
+    uint64_t frameIndex;
+    SlotState state;
+  };
+
+  VkPhysicalDevice physicalDevice;
+  VkDevice device;
+
+  VkExtent2D extent;
+  VkDeviceSize imageSize{0};
+  bool coherent{false};
+
+  std::vector<Slot> slots;
+  std::mutex slotMutex;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <cstdio>
+
+#include "FrameReadback.h"
+
+// streams read back frames to disk or another process on its own thread, so output speed only
+// limits the frame loop once every readback slot is queued here. frames are written straight from
+// the mapped readback memory and handed back through onWritten.
+class FrameWriter
+{
+public:
+  enum class Sink { Raw, Png, Pipe };
+
+  FrameWriter() = default;
+
+  // raw appends all frames to the file at target, png writes target000000.png and so on,
+  // pipe starts target as a shell command and feeds it rgba frames on stdin
+  void start(Sink newSink, const std::string &newTarget, std::function<void(const FrameReadback::Frame&)> newOnWritten);
+  void push(const FrameReadback::Frame &frame);
+  void stop();
+
+  uint64_t getFramesWritten(){return framesWritten;}
+
+private:
+  Sink sink;
+  std::string target;
+  std::function<void(const FrameReadback::Frame&)> onWritten;
+
+  FILE *output{nullptr};
+  std::vector<uint8_t> encodeBuffer;
+
+  std::thread thread;
+  std::mutex queueMutex;
+  std::condition_variable queueChanged;
+  std::deque<FrameReadback::Frame> queue;
+  bool stopping{false};
+
+  std::atomic<uint64_t> framesWritten{0};
+  bool failed{false};
+
+  void run();
+  void write(const FrameReadback::Frame &frame);
+  void writePng(const FrameReadback::Frame &frame);
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// timestamp queries around named zones, one query range per frame in flight. a frame's results are read
+// once the timeline says it completed, so reading never waits. zones are aggregated by name over the last
+// STATS_WINDOW frames and the most recent ones can be written as a chrome://tracing file.
+// without timestamp support on the queue every call does nothing.
+class GpuProfiler
+{
+public:
+  struct ZoneStats {
+    std::string name;
+    float minMs;
+    float averageMs;
+    float p99Ms;
+    uint32_t samples;
+  };
+
+  GpuProfiler() = default;
+
+  void create(VkPhysicalDevice physicalDevice, VkDevice newDevice, uint32_t queueFamily, uint32_t frameCount);
+  void destroy();
+  bool isEnabled(){return queryPool != VK_NULL_HANDLE;}
+
+  // outside a render pass, opens the "frame" zone
+  void beginFrame(VkCommandBuffer commandBuffer, uint32_t frame, uint64_t frameIndex);
+  void endFrame(VkCommandBuffer commandBuffer);
+  // may nest and may be inside a render pass
+  void beginZone(VkCommandBuffer commandBuffer, const std::string &name);
+  void endZone(VkCommandBuffer commandBuffer);
+
+  // once the frame's commands have completed
+  void collect(uint32_t frame);
+
+  std::vector<ZoneStats> getStats();
+  bool writeChromeTrace(const std::string &fileName);
+
+private:
+  static constexpr uint32_t MAX_ZONES = 64;
+  static constexpr size_t STATS_WINDOW = 256;
+  static constexpr size_t MAX_TRACE_EVENTS = 65536;
+
+  struct Zone {
+    uint32_t name;
+    uint32_t depth;
+  };
+
+  struct FrameZones {
+    uint64_t frameIndex{0};
+    bool recorded{false};
+    std::vector<Zone> zones;
+  };
+
+  struct ZoneHistory {
+    std::string name;
+    std::deque<float> samples;
+  };
+
+  struct TraceEvent {
+    uint32_t name;
+    uint64_t frameIndex;
+    double startUs;
+    double durationUs;
+  };
+
+  VkDevice device;
+  VkQueryPool queryPool{VK_NULL_HANDLE};
+  float timestampPeriod{1.0f};
+  uint64_t timestampMask{0};
+
+  std::vector<FrameZones> frames;
+  uint32_t recordingFrame{0};
+  // zones open in the frame being recorded, or MAX_ZONES for those that did not fit
+  std::vector<uint32_t> openZones;
+
+  std::unordered_map<std::string, uint32_t> nameIndices;
+  std::vector<ZoneHistory> histories;
+
+  std::deque<TraceEvent> traceEvents;
+  uint64_t traceBase{0};
+  bool traceBaseSet{false};
+
+  uint32_t nameIndex(const std::string &name);
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <array>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+enum class MemoryCategory { Mesh, Texture, Attachment, Uniform, Staging, Count };
+
+// every vkAllocateMemory of the renderer goes through allocate(), tagged with what the memory is for.
+// keeps current and peak bytes per category and, with VK_EXT_memory_budget, what the driver reports
+// per heap. crossing the budget prints a warning once, a strict budget fails the allocation instead,
+// the same way running out of device memory would. lazily allocated attachments count at their full size.
+class MemoryTracker
+{
+public:
+  struct CategoryStats {
+    VkDeviceSize current;
+    VkDeviceSize peak;
+    uint32_t allocations;
+  };
+
+  struct HeapStats {
+    bool deviceLocal;
+    VkDeviceSize size;
+    VkDeviceSize tracked;
+    // from VK_EXT_memory_budget, usage includes other processes. both 0 without the extension
+    VkDeviceSize budget;
+    VkDeviceSize usage;
+  };
+
+  // after the logical device, budgetSupported when VK_EXT_memory_budget is enabled on it
+  static void create(VkPhysicalDevice newPhysicalDevice, bool newBudgetSupported);
+  // 0 for none
+  static void setBudget(VkDeviceSize bytes, bool strict);
+
+  static VkResult allocate(VkDevice device, const VkMemoryAllocateInfo *allocInfo, MemoryCategory category,
+                           VkDeviceMemory *memory);
+  static void free(VkDevice device, VkDeviceMemory memory);
+
+  static CategoryStats getStats(MemoryCategory category);
+  static VkDeviceSize getCurrent();
+  static VkDeviceSize getPeak();
+  static std::vector<HeapStats> getHeapStats();
+  static const char *getCategoryName(MemoryCategory category);
+
+private:
+  struct Allocation {
+    VkDeviceSize size;
+    MemoryCategory category;
+    uint32_t heap;
+  };
+
+  static std::mutex trackerMutex;
+  static VkPhysicalDevice physicalDevice;
+  static bool budgetSupported;
+  static VkPhysicalDeviceMemoryProperties memoryProperties;
+
+  static std::unordered_map<VkDeviceMemory, Allocation> allocations;
+  static std::array<CategoryStats, static_cast<size_t>(MemoryCategory::Count)> categories;
+  static std::vector<VkDeviceSize> heapTracked;
+  static VkDeviceSize current;
+  static VkDeviceSize peak;
+
+  static VkDeviceSize budget;
+  static bool strictBudget;
+  static bool overBudget;
+  static std::vector<bool> heapOverBudget;
+
+  static void queryBudget(VkPhysicalDeviceMemoryBudgetPropertiesEXT *budgetProperties);
+};
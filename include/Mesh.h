@@ -5,11 +5,19 @@
 
 #include <vector>
 #include "Utilities.h"
+#include "MeshSimplifier.h"
 
 struct Model {
   glm::mat4 model;
 };
 
+// geometry handed to the renderer directly instead of through a model file
+struct MeshData {
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+  int texId;
+};
+
 
 
 class Mesh
@@ -18,11 +26,23 @@ public:
   Mesh() = default;
   Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, 
        std::vector<Vertex> *vertices, std::vector<uint32_t> *indices, int newTexId);
+  Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, 
+       std::vector<Vertex> *vertices, std::vector<uint32_t> *indices, std::vector<MeshLod> newLods, int newTexId);
 
   int getVertexCount(){return vertexCount;}
   int getIndexCount(){return indexCount;}
   int getTexId(){return texId;}
 
+  BlendMode getBlendMode(){return blendMode;}
+  void setBlendMode(BlendMode newBlendMode){blendMode = newBlendMode;}
+
+  size_t getLodCount(){return lods.size();}
+  const MeshLod& getLod(size_t index){return lods[index];}
+  uint32_t selectLod(float pixelsPerUnit, float maxPixelError, float hysteresis);
+
+  glm::vec3 getBoundsCenter(){return boundsCenter;}
+  float getBoundsRadius(){return boundsRadius;}
+
   VkBuffer getVertexBuffer(){return vertexBuffer;}
   VkBuffer getIndexBuffer(){return indexBuffer;}
 
@@ -37,6 +57,13 @@ public:
 private:
   Model model;
   int texId;
+  BlendMode blendMode{BlendMode::Opaque};
+
+  std::vector<MeshLod> lods;
+  uint32_t currentLod{0};
+
+  glm::vec3 boundsCenter;
+  float boundsRadius;
 
   int vertexCount;
   VkBuffer vertexBuffer;
@@ -51,5 +78,6 @@ private:
 
   void createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex> *vertices);
   void createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t> *indices);
+  void computeBounds(std::vector<Vertex> *vertices);
 };
 
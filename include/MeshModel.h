@@ -3,25 +3,44 @@
 #include <vector>
 #include "glm/glm.hpp"
 #include "Mesh.h"
+#include "SceneGraph.h"
+#include "TransformBuffer.h"
 #include <assimp/scene.h>
 
+// meshes hang off the nodes of the model's scene graph, every node has its own transform slot at
+// instanceId + node, so moving a node only uploads the world transforms of its subtree
+
 class MeshModel
 {
 public:
   MeshModel() = default;
+  // all meshes on a single node
   MeshModel(std::vector<Mesh> newMeshList);
+  MeshModel(std::vector<Mesh> newMeshList, SceneGraph newSceneGraph, std::vector<uint32_t> newMeshNodes);
 
   size_t getMeshCount();
   Mesh* getMesh(size_t index);
+  uint32_t getMeshNode(size_t index){return meshNodes[index];}
+  // a single node without a transform of its own, the model matrix is all there is
+  bool isFlat(){return sceneGraph.getNodeCount() == 1 && sceneGraph.getLocal(0) == glm::mat4(1.0f);}
 
   glm::mat4 getModel();
   void setModel(glm::mat4 newModel);
+  SceneGraph *getSceneGraph(){return &sceneGraph;}
+  size_t getNodeCount(){return sceneGraph.getNodeCount();}
+  // recomputes the dirty subtrees and hands their world transforms to the buffer
+  void updateTransforms(TransformBuffer *transformBuffer);
+
+  uint32_t getInstanceId(){return instanceId;}
+  void setInstanceId(uint32_t newInstanceId){instanceId = newInstanceId;}
 
   static std::vector<std::string> LoadMaterials(const aiScene* scene);
 
+  // adds the node and its children to sceneGraph, meshNodes gets the node of every returned mesh
   static std::vector<Mesh> LoadNode(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, 
                                     VkQueue transferQueue, VkCommandPool transferCommandPool,
-                                      aiNode *node, const aiScene *scene, std::vector<int> matToTex);
+                                      aiNode *node, const aiScene *scene, std::vector<int> matToTex,
+                                      int32_t parent, SceneGraph *sceneGraph, std::vector<uint32_t> *meshNodes);
 
   static Mesh LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, 
                                     VkQueue transferQueue, VkCommandPool transferCommandPool,
@@ -32,6 +51,9 @@ public:
 
 private:
   std::vector<Mesh> meshList;
-  glm::mat4 model;
+  std::vector<uint32_t> meshNodes;
+  SceneGraph sceneGraph;
+  std::vector<uint32_t> changedNodes;
+  uint32_t instanceId{0};
 
 };
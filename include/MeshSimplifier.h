@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "Utilities.h"
+
+struct MeshLod {
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  float error;          // object space deviation from the full resolution mesh
+};
+
+class MeshSimplifier
+{
+public:
+  // quadric error metric edge collapse, vertices are reused so every lod indexes the original vertex buffer
+  static std::vector<uint32_t> simplify(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices,
+                                        size_t targetIndexCount, float *resultError);
+
+  // appends the simplified levels to indices and returns the ranges of all levels, lod 0 first
+  static std::vector<MeshLod> generateLods(const std::vector<Vertex> &vertices, std::vector<uint32_t> *indices);
+
+private:
+  struct Quadric {
+    double a[10];
+    double weight;
+  };
+
+  static void addPlane(Quadric *q, glm::vec3 normal, float d, double weight);
+  static void addQuadric(Quadric *q, const Quadric &other);
+  static double evaluate(const Quadric &q, glm::vec3 pos);
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// refers to an object of an ObjectPool. the generation tells a handle to a removed object apart from one
+// to whatever took its slot later, so stale handles are simply not found
+struct ObjectHandle {
+  uint32_t index{UINT32_MAX};
+  uint32_t generation{0};
+
+  bool operator==(const ObjectHandle &other) const {return index == other.index && generation == other.generation;}
+  bool operator!=(const ObjectHandle &other) const {return !(*this == other);}
+};
+
+// objects packed densely for iteration, found through a slot table for stable handles. removing swaps the last
+// object into the hole, so add and remove are O(1) and the order of the dense array is not kept
+template<typename T>
+class ObjectPool
+{
+public:
+  ObjectHandle add(const T &object)
+  {
+    uint32_t slot;
+    if(freeSlots.empty())
+    {
+      slot = static_cast<uint32_t>(slots.size());
+      slots.push_back({0, 0});
+    }
+    else
+    {
+      slot = freeSlots.back();
+      freeSlots.pop_back();
+    }
+
+    slots[slot].dense = static_cast<uint32_t>(objects.size());
+    objects.push_back(object);
+    denseSlots.push_back(slot);
+    return {slot, slots[slot].generation};
+  }
+
+  // false for a handle that is stale or was never valid
+  bool remove(ObjectHandle handle)
+  {
+    if(!contains(handle)) return false;
+
+    uint32_t dense = slots[handle.index].dense;
+    uint32_t last = static_cast<uint32_t>(objects.size()) - 1;
+    if(dense != last)
+    {
+      objects[dense] = std::move(objects[last]);
+      denseSlots[dense] = denseSlots[last];
+      slots[denseSlots[dense]].dense = dense;
+    }
+    objects.pop_back();
+    denseSlots.pop_back();
+
+    slots[handle.index].generation++;
+    freeSlots.push_back(handle.index);
+    return true;
+  }
+
+  bool contains(ObjectHandle handle) const
+  {
+    // freeing a slot bumps its generation, handles handed out before no longer match
+    return handle.index < slots.size() && slots[handle.index].generation == handle.generation;
+  }
+
+  // nullptr for a stale handle, valid until the next add or remove
+  T *get(ObjectHandle handle)
+  {
+    return contains(handle) ? &objects[slots[handle.index].dense] : nullptr;
+  }
+
+  // dense iteration, in no particular order
+  size_t size() const {return objects.size();}
+  bool empty() const {return objects.empty();}
+  T &operator[](size_t dense){return objects[dense];}
+  typename std::vector<T>::iterator begin(){return objects.begin();}
+  typename std::vector<T>::iterator end(){return objects.end();}
+
+  void clear()
+  {
+    for(uint32_t slot: denseSlots)
+    {
+      slots[slot].generation++;
+      freeSlots.push_back(slot);
+    }
+    objects.clear();
+    denseSlots.clear();
+  }
+
+private:
+  struct Slot {
+    uint32_t dense;
+    uint32_t generation;
+  };
+
+  std::vector<T> objects;
+  std::vector<uint32_t> denseSlots;
+  std::vector<Slot> slots;
+  std::vector<uint32_t> freeSlots;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+
+// VkPipelineCache persisted to disk. the blob is prefixed with our own header so a file written by another
+// device, driver or a crashed save is detected and dropped instead of being handed to the driver.
+class PipelineCache
+{
+public:
+  PipelineCache() = default;
+
+  void create(VkPhysicalDevice physicalDevice, VkDevice newDevice, const std::string &newPath);
+  void save();
+  void destroy();
+
+  VkPipelineCache getCache(){return cache;}
+  bool isLoadedFromDisk(){return loadedFromDisk;}
+  size_t getLoadedSize(){return loadedSize;}
+
+private:
+  struct FileHeader {
+    uint32_t magic;
+    uint32_t headerVersion;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+    uint64_t checksum;
+  };
+
+  VkDevice device;
+  VkPipelineCache cache{VK_NULL_HANDLE};
+  std::string path;
+
+  FileHeader expectedHeader{};
+  bool loadedFromDisk{false};
+  size_t loadedSize{0};
+
+  std::vector<char> load();
+  static uint64_t checksum(const char *data, size_t size);
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <array>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <condition_variable>
+#include "Utilities.h"
+#include "ShaderLibrary.h"
+
+enum class VertexLayout { None, Mesh };
+
+// everything a pipeline permutation depends on. specialization constants get ids 0..count-1 per stage
+struct PipelineKey {
+  std::string vertexShader;
+  std::string fragmentShader;
+  VertexLayout vertexLayout{VertexLayout::Mesh};
+  BlendMode blendMode{BlendMode::Opaque};
+  bool depthTest{true};
+  bool depthWrite{true};
+  VkCompareOp depthCompare{VK_COMPARE_OP_LESS};
+  VkCullModeFlags cullMode{VK_CULL_MODE_BACK_BIT};
+  VkSampleCountFlagBits samples{VK_SAMPLE_COUNT_1_BIT};
+  VkRenderPass renderPass{VK_NULL_HANDLE};
+  uint32_t subpass{0};
+  VkPipelineLayout layout{VK_NULL_HANDLE};
+
+  std::array<uint32_t, 4> vertexConstants{};
+  uint32_t vertexConstantCount{0};
+  std::array<uint32_t, 4> fragmentConstants{};
+  uint32_t fragmentConstantCount{0};
+
+  uint64_t hash() const;
+  bool operator==(const PipelineKey &other) const;
+};
+
+// pipelines by key. missing permutations are compiled by worker threads, the frame thread only ever looks
+// them up and draws with a fallback until they are ready.
+class PipelineLibrary
+{
+public:
+  PipelineLibrary() = default;
+
+  void create(VkDevice newDevice, VkPipelineCache newCache, ShaderLibrary *newShaders, uint32_t workerCount);
+  void destroy();
+
+  // blocking, for pipelines that have to exist before the first frame
+  VkPipeline compile(const PipelineKey &key);
+  // returns VK_NULL_HANDLE and queues the permutation when it is not ready yet
+  VkPipeline find(const PipelineKey &key);
+  void request(const PipelineKey &key);
+
+  // waits for the workers and destroys every pipeline, e.g. when the render pass changes
+  void clear();
+  // destroys every permutation built from the shader, the gpu must be done with them
+  void invalidate(const std::string &shaderName);
+  size_t getPendingCount();
+
+private:
+  enum class EntryState { Queued, Ready, Failed };
+
+  struct Entry {
+    PipelineKey key;
+    EntryState state;
+    VkPipeline pipeline;
+  };
+
+  VkDevice device;
+  VkPipelineCache cache;
+  ShaderLibrary *shaders;
+
+  std::mutex entryMutex;
+  std::condition_variable queueChanged;
+  std::condition_variable entryCompiled;
+  std::unordered_map<uint64_t, Entry> entries;
+  std::deque<uint64_t> queue;
+  size_t compiling{0};
+  bool stopping{false};
+
+  std::vector<std::thread> workers;
+
+  void workerLoop();
+  VkPipeline build(const PipelineKey &key);
+  VkShaderModule loadShader(const std::string &name);
+};
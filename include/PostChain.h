@@ -0,0 +1,84 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+
+#include "Utilities.h"
+#include "ShaderLibrary.h"
+#include "RenderGraph.h"
+#include "RenderStats.h"
+
+enum class PostPass { Tonemap, Fxaa, Sharpen, ColorGrade };
+
+// compute post processing after the render pass. the passes are fused into as few stages as possible,
+// each stage is one dispatch of post.comp: pointwise passes applied while loading a shared memory tile,
+// at most one neighbourhood pass on the tile, pointwise passes again before the store.
+// every stage is a render graph pass writing its own image, the graph aliases them into a ping-pong,
+// the last one is blitted to the target.
+class PostChain
+{
+public:
+  struct Parameters {
+    float exposure{1.0f};
+    float sharpness{0.5f};
+    float saturation{1.0f};
+    float contrast{1.0f};
+  };
+
+  PostChain() = default;
+
+  void create(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkPipelineCache newCache, ShaderLibrary *newShaders,
+              const std::vector<PostPass> &passes);
+  void destroy();
+  // after post.comp was reloaded, the gpu must be done with the old pipelines
+  void createPipelines();
+
+  bool isEmpty(){return stages.empty();}
+  // of the source and the intermediate images, half float so the tonemapper gets to see more than [0,1]
+  VkFormat getFormat(){return VK_FORMAT_R16G16B16A16_SFLOAT;}
+
+  // the stages read source and write target through a blit, after compile() the descriptors need updating
+  void addPasses(RenderGraph *graph, RenderGraph::Resource source, RenderGraph::Resource target, VkExtent2D newExtent);
+  void updateDescriptorSets(RenderGraph *graph);
+  // before the graph records the frame, the stages count their commands into stats
+  void beginFrame(const Parameters &parameters, RenderStats *stats);
+
+private:
+  struct Stage {
+    uint32_t prologue{0};
+    uint32_t kernel{0};
+    uint32_t epilogue{0};
+    std::string name;
+    VkPipeline pipeline{VK_NULL_HANDLE};
+    VkDescriptorSet descriptorSet;
+    RenderGraph::Resource input;
+    RenderGraph::Resource output;
+  };
+
+  struct PushConstants {
+    int32_t width;
+    int32_t height;
+    Parameters parameters;
+  };
+
+  VkPhysicalDevice physicalDevice;
+  VkDevice device;
+  VkPipelineCache cache;
+  ShaderLibrary *shaders;
+
+  std::vector<Stage> stages;
+  VkExtent2D extent{0, 0};
+  PushConstants pushConstants;
+  RenderStats *frameStats{nullptr};
+
+  VkDescriptorSetLayout setLayout;
+  VkPipelineLayout pipelineLayout;
+  VkDescriptorPool descriptorPool;
+
+  void planStages(const std::vector<PostPass> &passes);
+  void recordStage(VkCommandBuffer commandBuffer, size_t stage);
+  void recordBlit(VkCommandBuffer commandBuffer, VkImage source, VkImage target);
+};
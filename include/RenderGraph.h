@@ -0,0 +1,135 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "Utilities.h"
+#include "GpuProfiler.h"
+
+// how a pass uses an image. together with read or write this decides the layout, stages and access
+// of the barrier in front of the pass, transfer reads are TRANSFER_SRC and transfer writes TRANSFER_DST
+enum class ImageUsage { ColorAttachment, DepthAttachment, Sampled, Storage, Transfer, Present };
+
+// the frame as a list of passes that declare which images they read and write. compile() culls passes
+// nothing depends on, places transient images whose lifetimes do not overlap in the same memory and plans
+// every barrier, execute() records them in front of each pass. passes run in the order they were added.
+// all frames in flight share the transient images, the first use in a frame waits on the last use of the
+// same memory in the frame before.
+class RenderGraph
+{
+public:
+  typedef uint32_t Resource;
+  typedef uint32_t Pass;
+  typedef std::function<void(VkCommandBuffer)> RecordFunction;
+
+  struct MemoryStats {
+    VkDeviceSize requested;
+    VkDeviceSize allocated;
+    uint32_t images;
+    uint32_t allocations;
+  };
+
+  RenderGraph() = default;
+
+  void create(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice);
+  void destroy();
+  // drops every pass and resource, e.g. to declare the graph again after a resize
+  void reset();
+
+  Resource createImage(const std::string &name, VkFormat format, VkExtent2D extent);
+  // owned elsewhere and bound before every execute, the first use discards the contents
+  Resource importImage(const std::string &name, VkFormat format);
+  void bindImage(Resource resource, VkImage image);
+
+  // a pass without record function only moves its images into the declared layout, e.g. for present
+  Pass addPass(const std::string &name, RecordFunction record);
+  void read(Pass pass, Resource resource, ImageUsage usage);
+  void write(Pass pass, Resource resource, ImageUsage usage);
+
+  void compile();
+  // with a profiler every pass that is recorded is timed as a zone named after it
+  void execute(VkCommandBuffer commandBuffer, GpuProfiler *profiler = nullptr);
+
+  VkImage getImage(Resource resource){return resources[resource].image;}
+  VkImageView getImageView(Resource resource){return resources[resource].view;}
+  // where a submit has to wait for an acquired image that is first used by the graph
+  VkPipelineStageFlags getFirstStage(Resource resource);
+  bool isCulled(Pass pass){return passes[pass].culled;}
+  const MemoryStats &getMemoryStats(){return memoryStats;}
+
+private:
+  struct Declaration {
+    Resource resource;
+    ImageUsage usage;
+    bool write;
+  };
+
+  struct Use {
+    Pass pass;
+    ImageUsage usage;
+    bool write;
+  };
+
+  struct Access {
+    VkPipelineStageFlags stage;
+    VkAccessFlags access;
+    VkImageLayout layout;
+  };
+
+  struct ImageResource {
+    std::string name;
+    VkFormat format;
+    VkExtent2D extent;
+    bool imported;
+    VkImageAspectFlags aspect;
+
+    VkImage image{VK_NULL_HANDLE};
+    VkImageView view{VK_NULL_HANDLE};
+    VkMemoryRequirements memoryRequirements;
+    int block{-1};
+
+    // uses by passes that survived culling, in execution order
+    std::vector<Use> uses;
+  };
+
+  struct Barrier {
+    Resource resource;
+    Access src;
+    Access dst;
+  };
+
+  struct PassNode {
+    std::string name;
+    RecordFunction record;
+    std::vector<Declaration> declarations;
+    bool culled{false};
+    std::vector<Barrier> barriers;
+  };
+
+  struct MemoryBlock {
+    VkDeviceMemory memory{VK_NULL_HANDLE};
+    VkDeviceSize size{0};
+    uint32_t memoryTypeBits{~0u};
+    // ordered by first use
+    std::vector<Resource> resources;
+  };
+
+  VkPhysicalDevice physicalDevice;
+  VkDevice device;
+
+  std::vector<ImageResource> resources;
+  std::vector<PassNode> passes;
+  std::vector<MemoryBlock> blocks;
+  MemoryStats memoryStats{};
+
+  void cullPasses();
+  void allocateImages();
+  void planBarriers();
+  void releaseImages();
+  void declare(Pass pass, Resource resource, ImageUsage usage, bool write);
+  Access useAccess(ImageUsage usage, bool write);
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+// what a frame submitted: counted on the cpu while recording, so the counters of a frame are known as soon
+// as it is recorded. optionally one pipeline statistics query around the whole frame gives what the gpu
+// actually ran, read like the timestamps once the timeline says the frame completed.
+class RenderStats
+{
+public:
+  struct Counters {
+    uint32_t drawCalls;
+    uint32_t instances;
+    uint64_t triangles;
+    uint32_t dispatches;
+    uint32_t pipelineBinds;
+    uint32_t descriptorBinds;
+    uint32_t pushConstants;
+  };
+
+  struct PipelineStatistics {
+    uint64_t frameIndex;
+    uint64_t inputPrimitives;
+    uint64_t vertexInvocations;
+    uint64_t clippedPrimitives;
+    uint64_t fragmentInvocations;
+    uint64_t computeInvocations;
+  };
+
+  RenderStats() = default;
+
+  // queries only when the device has pipelineStatisticsQuery enabled
+  void create(VkDevice newDevice, uint32_t frameCount, bool queries);
+  void destroy();
+  bool hasPipelineStatistics(){return queryPool != VK_NULL_HANDLE;}
+
+  // outside a render pass, around everything the frame records
+  void beginFrame(VkCommandBuffer commandBuffer, uint32_t frame, uint64_t frameIndex);
+  void endFrame(VkCommandBuffer commandBuffer);
+
+  void countDraw(uint32_t instanceCount, uint64_t triangles)
+  {
+    recording.drawCalls++;
+    recording.instances += instanceCount;
+    recording.triangles += triangles*instanceCount;
+  }
+  void countDispatch(){recording.dispatches++;}
+  void countPipelineBind(){recording.pipelineBinds++;}
+  void countDescriptorBind(){recording.descriptorBinds++;}
+  void countPushConstants(){recording.pushConstants++;}
+
+  // once the frame's commands have completed
+  void collect(uint32_t frame);
+
+  // of the last recorded frame
+  const Counters &getCounters(){return counters;}
+  // of the last completed frame, all 0 without queries
+  const PipelineStatistics &getPipelineStatistics(){return pipelineStatistics;}
+
+private:
+  struct FrameQuery {
+    uint64_t frameIndex{0};
+    bool recorded{false};
+  };
+
+  VkDevice device;
+  VkQueryPool queryPool{VK_NULL_HANDLE};
+  std::vector<FrameQuery> frames;
+  uint32_t recordingFrame{0};
+
+  Counters recording{};
+  Counters counters{};
+  PipelineStatistics pipelineStatistics{};
+};
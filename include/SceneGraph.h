@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// the node hierarchy of a model in flat arrays (SoA), in depth first order: a parent always comes before
+// its children and the subtree of node i is the range [i, subtreeEnd[i]). changing a local transform only
+// marks the node, update() then recomputes the world transforms of the marked subtrees in one forward pass
+// and reports which nodes changed. the root transform is the parent of all top level nodes.
+class SceneGraph
+{
+public:
+  static const int32_t NO_PARENT = -1;
+
+  SceneGraph() = default;
+
+  // the parent has to be NO_PARENT or a node whose subtree is still the last one, as in a depth first walk
+  uint32_t addNode(int32_t parent, const glm::mat4 &local, const std::string &name = "");
+  size_t getNodeCount(){return parents.size();}
+  // the first node of that name, -1 if there is none
+  int32_t findNode(const std::string &name);
+
+  void setRoot(const glm::mat4 &transform);
+  // for a single node graph whose world transform was already written elsewhere, e.g. composed straight
+  // into the transform buffer: root and world follow without marking the node, so update() leaves it alone
+  void setFlatRoot(const glm::mat4 &transform);
+  const glm::mat4 &getRoot(){return root;}
+  void setLocal(uint32_t node, const glm::mat4 &local);
+  const glm::mat4 &getLocal(uint32_t node){return locals[node];}
+  const glm::mat4 &getWorld(uint32_t node){return worlds[node];}
+  int32_t getParent(uint32_t node){return parents[node];}
+
+  // appends the nodes whose world transform was recomputed, false when nothing was dirty
+  bool update(std::vector<uint32_t> *changedNodes);
+
+private:
+  std::vector<int32_t> parents;
+  std::vector<uint32_t> subtreeEnds;
+  std::vector<glm::mat4> locals;
+  std::vector<glm::mat4> worlds;
+  std::vector<uint8_t> dirty;
+  std::vector<std::string> names;
+
+  glm::mat4 root{1.0f};
+  // the first dirty node, getNodeCount() when there is none
+  uint32_t firstDirty{0};
+};
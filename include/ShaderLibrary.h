@@ -0,0 +1,55 @@
+#pragma once
+
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <unordered_map>
+#include <condition_variable>
+
+#include "SpirvReflection.h"
+
+// SPIR-V by name, e.g. "shaders/vert.spv". built with shaderc the GLSL source is compiled at runtime and the
+// result cached on disk by source hash, otherwise the prebuilt module is loaded. a watcher thread reloads
+// modules whose file changed and reports them so the renderer can rebuild the affected pipelines.
+class ShaderLibrary
+{
+public:
+  ShaderLibrary() = default;
+
+  void create(const std::string &newCacheDirectory);
+  void destroy();
+
+  // defines only reach the runtime compiler, compile.sh has to pass the same ones
+  void add(const std::string &name, const std::string &sourceFile, const std::vector<std::string> &defines = {});
+  std::vector<uint32_t> getCode(const std::string &name);
+  SpirvReflection getReflection(const std::string &name);
+
+  void startWatching(uint32_t intervalMs);
+  // names of the modules reloaded since the last call
+  std::vector<std::string> takeChanged();
+
+private:
+  struct Shader {
+    std::string sourceFile;
+    std::vector<std::string> defines;
+    std::vector<uint32_t> code;
+    SpirvReflection reflection;
+    std::filesystem::file_time_type watchedTime;
+  };
+
+  std::string cacheDirectory;
+
+  std::mutex shaderMutex;
+  std::unordered_map<std::string, Shader> shaders;
+  std::vector<std::string> changed;
+
+  std::thread watcher;
+  std::condition_variable stopSignal;
+  bool stopping{false};
+
+  void watchLoop(uint32_t intervalMs);
+  std::string watchedFile(const std::string &name, const Shader &shader);
+  bool compile(const std::string &sourceFile, const std::vector<std::string> &defines, std::vector<uint32_t> *code);
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <unordered_map>
+
+// just enough of a SPIR-V parser to recover the resource interface of a module: descriptor bindings
+// per set and the push constant block. set layouts and pipeline layouts are built from this.
+class SpirvReflection
+{
+public:
+  struct Binding {
+    uint32_t set;
+    VkDescriptorSetLayoutBinding layoutBinding;
+  };
+
+  SpirvReflection() = default;
+
+  void parse(const std::vector<uint32_t> &code);
+
+  VkShaderStageFlagBits getStage() const {return stage;}
+  const std::vector<Binding> &getBindings() const {return bindings;}
+  uint32_t getPushConstantSize() const {return pushConstantSize;}
+
+  // same bindings and push constants, a reloaded module may be swapped in without touching any layout
+  bool sameInterface(const SpirvReflection &other) const;
+
+  // the bindings of one set over all stages, stage flags are merged
+  static std::vector<VkDescriptorSetLayoutBinding> mergeSet(const std::vector<SpirvReflection> &stages, uint32_t set);
+  static std::vector<VkPushConstantRange> mergePushConstants(const std::vector<SpirvReflection> &stages);
+
+private:
+  struct Decorations {
+    uint32_t set{0};
+    uint32_t binding{0};
+    bool block{false};
+    bool bufferBlock{false};
+    uint32_t arrayStride{0};
+  };
+
+  struct MemberLayout {
+    uint32_t offset{0};
+    uint32_t matrixStride{0};
+  };
+
+  VkShaderStageFlagBits stage{VK_SHADER_STAGE_ALL};
+  std::vector<Binding> bindings;
+  uint32_t pushConstantSize{0};
+
+  // type instructions by result id as {opcode, result id, operands...}
+  std::unordered_map<uint32_t, std::vector<uint32_t>> types;
+  std::unordered_map<uint32_t, uint32_t> constants;
+  std::unordered_map<uint32_t, Decorations> decorations;
+  std::unordered_map<uint32_t, std::vector<MemberLayout>> members;
+
+  VkDescriptorType descriptorType(uint32_t typeId, uint32_t storageClass);
+  uint32_t typeSize(uint32_t typeId, uint32_t matrixStride);
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "Utilities.h"
+
+// model matrices as four column arrays (SoA), column c of instance i lives at c*capacity + i.
+// one persistently mapped storage buffer per frame in flight, only dirty ranges are copied and flushed.
+// setTransforms composes translation, rotation and scale of consecutive instances with AVX2 or SSE,
+// a lane per instance, and stores the columns in place. other cpus take the scalar path.
+class TransformBuffer
+{
+public:
+  TransformBuffer() = default;
+
+  void create(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, uint32_t newCapacity, uint32_t frameCount);
+  void destroy();
+
+  void setTransform(uint32_t instance, const glm::mat4 &transform);
+  // instances first to first + count - 1, rotations are unit quaternions
+  void setTransforms(uint32_t first, uint32_t count, const glm::vec3 *positions, const glm::quat *rotations,
+                     const glm::vec3 *scales);
+  glm::mat4 getTransform(uint32_t instance);
+
+  // count consecutive instance slots, the first released range they fit in or past the ones in use.
+  // UINT32_MAX when there is no room
+  uint32_t allocate(uint32_t count);
+  void release(uint32_t first, uint32_t count);
+  void flush(uint32_t frame);
+
+  uint32_t getCapacity(){return capacity;}
+  VkBuffer getBuffer(uint32_t frame){return frames[frame].buffer;}
+  VkDeviceSize getBufferSize(){return sizeof(glm::vec4)*4*capacity;}
+
+private:
+  struct FrameSlot {
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    VkDeviceSize allocationSize;
+    glm::vec4 *mapped;
+    uint32_t dirtyBegin;
+    uint32_t dirtyEnd;
+  };
+
+  VkPhysicalDevice physicalDevice;
+  VkDevice device;
+
+  struct SlotRange {
+    uint32_t first;
+    uint32_t count;
+  };
+
+  uint32_t capacity{0};
+  uint32_t allocated{0};
+  std::vector<SlotRange> freeRanges;
+  bool coherent{false};
+  VkDeviceSize nonCoherentAtomSize{1};
+
+  std::vector<glm::vec4> columns;
+  std::vector<FrameSlot> frames;
+};
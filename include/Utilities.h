@@ -7,8 +7,24 @@
 #include <fstream>
 #include <glm/glm.hpp>
 
-const int MAX_FRAME_DRAWS = 2;
+#include "MemoryTracker.h"
+
+const int MAX_FRAME_DRAWS = 3;
+const int DEFAULT_LATENCY_FRAMES = 2;
+const int READBACK_SLOTS = 8;
 const int MAX_OBJECTS = 20;
+const int MAX_MESH_LODS = 4;
+const int MAX_INSTANCES = 4096;
+const int FRAME_TRANSIENT_SIZE = 64*1024;
+
+enum class BlendMode { Opaque, Alpha };
+
+// post processing effects, bits of the fullscreen pass constants and of its specialized variants
+enum PostEffect : uint32_t {
+  POST_EFFECT_DEPTH_TINT = 0x1,
+  POST_EFFECT_SPLIT_SCREEN = 0x2,
+  POST_EFFECT_ALL = 0x3
+};
 
 const std::vector<const char*> deviceExtensions = {
   VK_KHR_SWAPCHAIN_EXTENSION_NAME
@@ -63,6 +79,19 @@ static std::vector<char> readFile(const std::string &filename)
   return buffer;
 };
 
+// fnv-1a: start at HASH_SEED and feed it as many byte ranges as needed
+const uint64_t HASH_SEED = 0xcbf29ce484222325ull;
+
+static void hashBytes(uint64_t *hash, const void *data, size_t size)
+{
+  const uint8_t *bytes = static_cast<const uint8_t*>(data);
+  for(size_t i=0; i<size; i++)
+  {
+    *hash ^= bytes[i];
+    *hash *= 0x100000001b3ull;
+  }
+}
+
 
 static uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice, uint32_t allowedTypes, VkMemoryPropertyFlags properties)
 {
@@ -71,7 +100,7 @@ static uint32_t findMemoryTypeIndex(VkPhysicalDevice physicalDevice, uint32_t al
 
   for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
   {
-    if((allowedTypes & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties))
+    if((allowedTypes & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
     {
       return i;
     }
@@ -87,6 +116,7 @@ static void createBuffer
   VkDeviceSize bufferSize,
   VkBufferUsageFlags bufferUsage,
   VkMemoryPropertyFlags bufferProperties, 
+  MemoryCategory category,
   VkBuffer * buffer,
   VkDeviceMemory * bufferMemory
 )
@@ -111,7 +141,7 @@ static void createBuffer
   memAllocInfo.allocationSize = memRequirements.size;
   memAllocInfo.memoryTypeIndex = findMemoryTypeIndex(physicalDevice, memRequirements.memoryTypeBits, bufferProperties);
  
-  result = vkAllocateMemory(device, &memAllocInfo, nullptr, bufferMemory);
+  result = MemoryTracker::allocate(device, &memAllocInfo, category, bufferMemory);
   if(result != VK_SUCCESS)
   {
     throw std::runtime_error("Failed to allocate Memory");
@@ -191,6 +221,48 @@ static void copyImageBuffer(VkDevice device, VkQueue transferQueue, VkCommandPoo
   endAndSubmitCommandBuffer(device, transferCommandPool, transferQueue, transferCommandBuffer);
 }
 
+// the stages and access of commands that use an image in this layout
+static void layoutAccess(VkImageLayout layout, VkPipelineStageFlags *stage, VkAccessFlags *access)
+{
+  switch(layout)
+  {
+    case VK_IMAGE_LAYOUT_UNDEFINED:
+      *stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+      *access = 0;
+      break;
+    case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+      *stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+      *access = VK_ACCESS_TRANSFER_READ_BIT;
+      break;
+    case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+      *stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+      *access = VK_ACCESS_TRANSFER_WRITE_BIT;
+      break;
+    case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+      *stage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+      *access = VK_ACCESS_SHADER_READ_BIT;
+      break;
+    case VK_IMAGE_LAYOUT_GENERAL:
+      *stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+      *access = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+      break;
+    case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+      *stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+      *access = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+      break;
+    case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+      *stage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+      *access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+      break;
+    case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:
+      *stage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+      *access = 0;
+      break;
+    default:
+      throw std::runtime_error("Failed to find the access of an Image Layout!");
+  }
+}
+
 static void transitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool commandPool, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout)
 {
   VkCommandBuffer commandBuffer = beginCommandBuffer(device, commandPool);
@@ -210,21 +282,8 @@ static void transitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool
 
   VkPipelineStageFlags srcStage;
   VkPipelineStageFlags dstStage;
-
-
-  if(oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL){
-    imageMemoryBarrier.srcAccessMask = 0;
-    imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-  }
-  else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-  {
-    imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-  }
+  layoutAccess(oldLayout, &srcStage, &imageMemoryBarrier.srcAccessMask);
+  layoutAccess(newLayout, &dstStage, &imageMemoryBarrier.dstAccessMask);
 
   vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
   endAndSubmitCommandBuffer(device, commandPool, queue, commandBuffer);
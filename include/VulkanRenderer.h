@@ -5,14 +5,26 @@
 
 #include <stdexcept>
 #include <vector>
+#include <functional>
 
 #include "Mesh.h"
 #include "MeshModel.h"
+#include "ObjectPool.h"
+#include "TransformBuffer.h"
+#include "FrameAllocator.h"
+#include "FrameReadback.h"
+#include "PipelineCache.h"
+#include "PipelineLibrary.h"
+#include "ShaderLibrary.h"
+#include "PostChain.h"
+#include "RenderGraph.h"
+#include "RenderStats.h"
 #include "Utilities.h"
 #include "stb_image.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -22,34 +34,165 @@
 class VulkanRenderer
 {
 public:
+  struct FrameMetrics {
+    uint64_t frameIndex;
+    uint32_t latencyFrames;
+    float cpuWaitMs;
+    float acquireWaitMs;
+    float averageCpuWaitMs;
+    // recorded in the last frame after lod selection, the full set is in getRenderStats
+    uint32_t drawCalls;
+    uint64_t triangles;
+  };
+
+  struct StartupMetrics {
+    float initMs;
+    float pipelineMs;
+    bool pipelineCacheHit;
+    size_t pipelineCacheSize;
+    // render graph images, with and without aliasing
+    VkDeviceSize graphMemory;
+    VkDeviceSize graphMemoryUnaliased;
+  };
+
   VulkanRenderer();
 
+  void setPipelineCachePath(const std::string &path){pipelineCachePath = path;}
+  // before init, takes a software device such as lavapipe or swiftshader over a gpu when there is one
+  void setPreferCpuDevice(bool prefer){preferCpuDevice = prefer;}
+  // before init, device memory the renderer may allocate in bytes, 0 for no limit. crossing it warns,
+  // or fails the allocation when strict
+  void setMemoryBudget(VkDeviceSize bytes, bool strict = false){memoryBudget = bytes; strictMemoryBudget = strict;}
+  // before init, clamped to what the device supports for colour and depth
+  void setMsaaSamples(uint32_t samples){requestedMsaaSamples = samples;}
+  VkSampleCountFlagBits getMsaaSamples(){return msaaSamples;}
+  // before init, compute passes run in this order on the composited frame before it is shown
+  void setPostChain(const std::vector<PostPass> &passes){postPasses = passes;}
+  void setPostParameters(const PostChain::Parameters &parameters){postParameters = parameters;}
+  // gpu time of the frame, each render graph pass and the scene subpasses over the last completed frames
+  std::vector<GpuProfiler::ZoneStats> getGpuTimings(){return gpuProfiler.getStats();}
+  bool writeGpuTrace(const std::string &fileName){return gpuProfiler.writeChromeTrace(fileName);}
+  // before init, a pipeline statistics query around every frame when the device supports them
+  void setPipelineStatistics(bool enable){pipelineStatisticsRequested = enable;}
+  // counters of the last recorded frame, gpu statistics of the last completed one
+  const RenderStats::Counters &getRenderStats(){return renderStats.getCounters();}
+  const RenderStats::PipelineStatistics &getPipelineStatistics(){return renderStats.getPipelineStatistics();}
   int init(GLFWwindow * newWindow);
-  int createMeshModel(std::string modelFile);
-
-  void updateModel(int modelId, glm::mat4 newModel);
+  int initHeadless(uint32_t width, uint32_t height);
+  // handles stay valid until the model is removed, calls with a removed one do nothing
+  ObjectHandle createMeshModel(std::string modelFile);
+  // lods are generated like for loaded models, texIds come from createTexture, 0 is plain white
+  ObjectHandle createMeshModel(std::vector<MeshData> *meshes);
+  // stops drawing it at once, its buffers and transform slots are freed once no frame in flight uses them
+  void removeMeshModel(ObjectHandle model);
+  // tightly packed rgba8
+  int createTexture(const std::vector<uint8_t> &pixels, uint32_t width, uint32_t height);
+
+  void updateModel(ObjectHandle model, glm::mat4 newModel);
+  // many animated objects at once. single node models are composed with simd straight into the transform buffer,
+  // their scene graph root takes the composed matrix, so getModel stays valid and the batch wins over an
+  // updateModel earlier in the frame
+  void updateModels(const ObjectHandle *handles, uint32_t count, const glm::vec3 *positions,
+                    const glm::quat *rotations, const glm::vec3 *scales);
+  // nodes of a loaded model keep their names from the file, e.g. to move a control surface.
+  // the new local transform replaces the one from the file, getModelNodeTransform gives that rest pose
+  int findModelNode(ObjectHandle model, const std::string &name);
+  glm::mat4 getModelNodeTransform(ObjectHandle model, uint32_t node);
+  void updateModelNode(ObjectHandle model, uint32_t node, glm::mat4 newLocal);
+  void setViewProjection(glm::mat4 newView, glm::mat4 newProjection);
+  // keeps the projection of setProjection
+  void setView(glm::mat4 newView);
+  // perspective rebuilt for the current extent, also after a resize
+  void setProjection(float newFieldOfView, float newNearPlane, float newFarPlane);
+  // any of the PostEffect bits, the split position is a fraction of the width
+  void setPostEffects(uint32_t effects, float splitPosition = 0.5f);
+  void setLodPixelError(float maxPixelError, float hysteresis = 0.25f);
+  void setLatencyMode(uint32_t framesInFlight);
+  void notifyFramebufferResized(){framebufferResized = true;}
+  const FrameMetrics &getFrameMetrics(){return frameMetrics;}
+  const StartupMetrics &getStartupMetrics(){return startupMetrics;}
+
+  // headless only, called in order with every rendered frame once its readback has landed. a frame rendered
+  // while the consumer holds every slot is not read back, frameIndex shows the gap.
+  // the pixels stay valid until the frame is released, which may happen from another thread
+  void setFrameCallback(std::function<void(const FrameReadback::Frame&)> callback){frameCallback = callback;}
+  void releaseFrame(const FrameReadback::Frame &frame){frameReadback.release(frame.slot);}
+  void finishFrames();
   void draw();
   void cleanup();
 
   ~VulkanRenderer();
 
 private:
-  GLFWwindow * window;
-  int currentFrame{0};
-  std::vector<MeshModel> modelList;
+  // the microbenchmarks time the loaders and command recording directly
+  friend class RendererBench;
+
+  GLFWwindow * window{nullptr};
+  bool headless{false};
+  bool preferCpuDevice{false};
+  VkDeviceSize memoryBudget{0};
+  bool strictMemoryBudget{false};
+  bool anisotropySupported{false};
+  bool pipelineStatisticsRequested{false};
+  bool pipelineStatisticsSupported{false};
+  bool framebufferResized{false};
+  uint32_t currentFrame{0};
+
+  // frame pacing, every submit signals frameTimeline with its frame number
+  VkSemaphore frameTimeline;
+  uint64_t frameCounter{0};
+  uint32_t latencyFrames{DEFAULT_LATENCY_FRAMES};
+  FrameMetrics frameMetrics{};
+  // packed for recording, every model takes a transform slot per scene node
+  ObjectPool<MeshModel> models;
+  // removed but possibly still drawn by a frame up to this one
+  struct RetiredModel {
+    MeshModel model;
+    uint64_t frame;
+  };
+  std::vector<RetiredModel> retiredModels;
+
+  // lod selection
+  float lodPixelError{1.0f};
+  float lodHysteresis{0.25f};
 
   // scene objects
   
+  // set before the first setViewProjection compares against it
   struct UboViewProjection{
-    glm::mat4 projection; 
-    glm::mat4 view; 
+    glm::mat4 projection{1.0f}; 
+    glm::mat4 view{1.0f}; 
     
   } uboViewProjection;
 
+  // frame versions start at 0, so every slot uploads the first view projection
+  uint64_t vpVersion{1};
+  std::vector<uint64_t> vpFrameVersion;
+
+  float fieldOfView{45.0f};
+  float nearPlane{0.1f};
+  float farPlane{100.0f};
+
+  // pushed to the fullscreen pass every frame, matches PostConstants in second.frag
+  struct PostConstants {
+    glm::vec2 extent;
+    float nearPlane;
+    float farPlane;
+    float splitPosition;
+    uint32_t effects;
+  } postConstants{glm::vec2(0.0f), 0.0f, 0.0f, 0.5f, POST_EFFECT_ALL};
+
+  // with passes the render pass renders into the chain's source instead of the swapchain image
+  std::vector<PostPass> postPasses;
+  PostChain::Parameters postParameters;
+  PostChain postChain;
+  GpuProfiler gpuProfiler;
+  RenderStats renderStats;
+
 
   VkInstance instance;
   struct {
-    VkPhysicalDevice physicalDevice;
+    VkPhysicalDevice physicalDevice{VK_NULL_HANDLE};
     VkDevice logicalDevice;
   } mainDevice;
 
@@ -61,16 +204,66 @@ private:
   VkSwapchainKHR swapchain;
 
   std::vector<SwapChainImage> swapChainImages;
-  std::vector<VkFramebuffer> swapChainFrameBuffers;
-  std::vector<VkCommandBuffer> commandBuffers;
-
-  std::vector<VkImage> colorBufferImage;
-  std::vector<VkDeviceMemory> colorBufferImageMemory;
-  std::vector<VkImageView> colorBufferImageView;
 
-  std::vector<VkImage> depthBufferImage;
-  std::vector<VkDeviceMemory> depthBufferImageMemory;
-  std::vector<VkImageView> depthBufferImageView;
+  // headless replaces the swapchain by an image ring, one image per frame context.
+  // readback has more slots than frames in flight so frames can queue up for the writer
+  std::vector<VkDeviceMemory> offscreenImageMemory;
+  FrameReadback frameReadback;
+  std::function<void(const FrameReadback::Frame&)> frameCallback;
+  // taken by draw before recording
+  uint32_t readbackSlot{FrameReadback::NO_SLOT};
+
+  // everything a frame in flight records into, reused once the timeline reaches its value
+  struct FrameContext {
+    VkCommandPool commandPool;
+    VkCommandBuffer commandBuffer;
+    uint64_t timelineValue{0};
+    VkSemaphore imageAvailable;
+
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet inputDescriptorSet;
+    VkDescriptorSet transformDescriptorSet;
+  };
+  std::vector<FrameContext> frames;
+
+  // colour and depth never leave the render pass. they are transient, lazily allocated where the device
+  // supports it, and shared by all frames in flight, the render pass dependencies order the reuse
+  VkImage colorBufferImage;
+  VkDeviceMemory colorBufferImageMemory;
+  VkImageView colorBufferImageView;
+
+  VkImage depthBufferImage;
+  VkDeviceMemory depthBufferImageMemory;
+  VkImageView depthBufferImageView;
+
+  // with msaa colour is resolved into this at the end of subpass 1, depth stays multisampled
+  VkImage colorResolveImage;
+  VkDeviceMemory colorResolveImageMemory;
+  VkImageView colorResolveImageView;
+
+  uint32_t requestedMsaaSamples{1};
+  VkSampleCountFlagBits msaaSamples{VK_SAMPLE_COUNT_1_BIT};
+
+  // one framebuffer per swapchain image
+  std::vector<VkFramebuffer> frameBuffers;
+
+  // the frame as graph passes: the render pass, the post chain and present or readback. the target is the
+  // swapchain or headless image of the frame, the scene is what the render pass writes, without post chain the target
+  RenderGraph renderGraph;
+  RenderGraph::Resource targetResource;
+  RenderGraph::Resource sceneResource;
+  uint32_t recordingImage{0};
+
+  // per swapchain image, the timeline value of the frame that last rendered into it
+  std::vector<uint64_t> imagesInFlight;
+  std::vector<VkSemaphore> renderFinished;
+  // replaced on resize, destroyed with their semaphores once frames of the new swapchain have completed
+  struct RetiredSwapchain {
+    VkSwapchainKHR swapchain;
+    std::vector<VkSemaphore> semaphores;
+    uint64_t frame;
+  };
+  std::vector<RetiredSwapchain> retiredSwapchains;
 
   VkFormat depthFormat;
 
@@ -83,18 +276,13 @@ private:
   VkDescriptorSetLayout descriptorSetLayout;
   VkDescriptorSetLayout samplerSetLayout;
   VkDescriptorSetLayout inputSetLayout;
+  VkDescriptorSetLayout transformSetLayout;
 
-  VkPushConstantRange pushConstantRange;
-
-  std::vector<VkBuffer> vpUniformBuffer;
-  std::vector<VkDeviceMemory> vpUniformBufferMemory;
+  FrameAllocator frameAllocator;
+  TransformBuffer transformBuffer;
 
-  std::vector<VkBuffer> modelDUniformBuffer;
-  std::vector<VkDeviceMemory> modelDUniformBufferMemory;
-
-  std::vector<VkDescriptorSet> descriptorSets;
+  VkDescriptorSet descriptorSet;
   std::vector<VkDescriptorSet> samplerDescriptorSets;
-  std::vector<VkDescriptorSet> inputDescriptorSets;
 
   // assets 
   VkSampler textureSampler;
@@ -104,11 +292,20 @@ private:
 
 
   // pipeline
+  ShaderLibrary shaderLibrary;
+  PipelineCache pipelineCache;
+  PipelineLibrary pipelineLibrary;
+  std::array<PipelineKey, 2> meshPipelineKeys;
+  std::string pipelineCachePath{"pipeline_cache.bin"};
+  StartupMetrics startupMetrics{};
+
   VkPipelineLayout pipelineLayout;
   VkPipeline graphicsPipeline;
 
   VkPipelineLayout secondPipelineLayout;
   VkPipeline secondPipeline;
+  // compiled with every effect, the variant for the enabled effects replaces it once built
+  PipelineKey secondPipelineKey;
 
 
   VkRenderPass renderPass;
@@ -117,43 +314,58 @@ private:
   VkCommandPool graphicsCommandPool;
   VkDescriptorPool descriptorPool;
   VkDescriptorPool samplerDescriptorPool;
-  VkDescriptorPool inputDescriptorPool;
+
+  int initRenderer();
 
   // create functions
   void createInstance();
   void setupDebugMessenger();
   void createLogicalDevice();
   void createSurface();
-  void createSwapChain();
+  void createSwapChain(VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE);
+  void recreateSwapChain();
+  void destroyRetiredSwapchains(uint64_t completedFrame);
+  void createOffscreenImages();
   void createRenderPass();
   void createDescriptorSetLayout();
-  void createPushConstantRange();
-  void createUniformBuffers();
+  VkDescriptorSetLayout createReflectedSetLayout(const std::vector<SpirvReflection> &stages, uint32_t set);
+  void createPipelineLayouts();
   void createGraphicsPipeline();
   void createColorBufferImage();
   void createDepthBufferImage();
   void createFrameBuffers();
+  void buildRenderGraph();
+  void destroyAttachments();
   void createCommandPool();
   void createCommandBuffers();
   void createSynchronization();
+  void createRenderFinishedSemaphores();
   void createDescriptorPool();
   void createDescriptorSets();
   void createInputDescriptorSets();
+  void updateInputDescriptorSets();
+  void createTransformDescriptorSets();
 
+  ObjectHandle addMeshModel(MeshModel meshModel);
+  void destroyRetiredModels(uint64_t completedFrame);
   int createTextureImage(std::string fileName);
+  int createTextureImage(const stbi_uc *pixels, uint32_t width, uint32_t height);
   int createTexture(std::string fileName);
+  int createTextureView(int textureImageLoc);
   void createTextureSampler();
   int createTextureDescriptor(VkImageView textureImage);
 
 
-  void updateUniformBuffers(uint32_t imageIndex);
+  void updateUniformBuffers(uint32_t frame);
+  void updateProjection();
+  void reloadShaders();
+  void waitTimeline(uint64_t value);
+  void deliverReadbacks(uint64_t completedFrame);
+  uint32_t acquireReadbackSlot();
   // record functions
   void recordCommands(uint32_t imageIndex);
-
-  // sync objects
-  std::vector<VkSemaphore> imageAvailable;
-  std::vector<VkSemaphore> renderFinished;
-  std::vector<VkFence> drawFences;
+  void recordScene(VkCommandBuffer commandBuffer);
+  float lodPixelsPerUnit(Mesh *mesh, const glm::mat4 &modelMatrix);
 
   // get functions
   void getPhysicalDevice();
@@ -169,15 +381,19 @@ private:
   bool checkDeviceSuitable(VkPhysicalDevice device);
 
   VkImage createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling,
-                      VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, VkDeviceMemory *imageMemory);
+                      VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, MemoryCategory category,
+                      VkDeviceMemory *imageMemory,
+                      VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT);
 
   VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
-  VkShaderModule createShaderModule(const std::vector<char> &code);
 
   // choose functions
   VkSurfaceFormatKHR chooseBestSurfaceFormat(const std::vector<VkSurfaceFormatKHR> &formats);
   VkPresentModeKHR chooseBestPresentationModel(const std::vector<VkPresentModeKHR> &presentationModes);
   VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR &surfaceCapabilities);
+  VkSampleCountFlagBits chooseSampleCount(uint32_t requested);
+  // the fullscreen pass reads multisampled depth with a variant of second.frag
+  std::string postFragmentShader(){return msaaSamples == VK_SAMPLE_COUNT_1_BIT ? "shaders/second_frag.spv" : "shaders/second_ms_frag.spv";}
   VkFormat chooseSupportedFormat(const std::vector<VkFormat> &formats, VkImageTiling tiling, VkFormatFeatureFlags featureFlags);
 
   // loader functions
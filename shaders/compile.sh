@@ -7,4 +7,6 @@ dir=`dirname $0`
 
 /usr/bin/glslc $dir/second.vert -o $dir/second_vert.spv
 /usr/bin/glslc $dir/second.frag -o $dir/second_frag.spv
+/usr/bin/glslc -DMULTISAMPLED_DEPTH $dir/second.frag -o $dir/second_ms_frag.spv
 
+/usr/bin/glslc $dir/post.comp -o $dir/post_comp.spv
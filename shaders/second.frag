@@ -1,27 +1,50 @@
 #version 450
 
 layout(input_attachment_index=0, binding=0) uniform subpassInput inputColour;
+
+// with msaa only colour is resolved, the first depth sample is close enough for the tint
+#ifdef MULTISAMPLED_DEPTH
+layout(input_attachment_index=1, binding=1) uniform subpassInputMS inputDepth;
+float loadDepth() { return subpassLoad(inputDepth, 0).r; }
+#else
 layout(input_attachment_index=1, binding=1) uniform subpassInput inputDepth;
+float loadDepth() { return subpassLoad(inputDepth).r; }
+#endif
+
+// effects compiled into this variant, the generic one keeps every branch and follows the push constants
+layout(constant_id = 0) const uint ENABLED_EFFECTS = 0xffffffff;
+
+const uint DEPTH_TINT = 0x1;
+const uint SPLIT_SCREEN = 0x2;
+
+layout(push_constant) uniform PostConstants {
+  vec2 extent;
+  float nearPlane;
+  float farPlane;
+  float splitPosition;
+  uint effects;
+} post;
 
 layout(location=0) out vec4 colour;
 
 void main()
 {
-  int xHalf = 1680/2;
-  if(gl_FragCoord.x > xHalf)
+  uint effects = post.effects & ENABLED_EFFECTS;
+  colour = subpassLoad(inputColour).rgba;
+
+  if((effects & DEPTH_TINT) == 0)
   {
-    float lowerbound = 0.98;
-    float upperbound = 1;
-    float depth = subpassLoad(inputDepth).r;
-    float depthColorScale = 1.0f - ((depth - lowerbound)/ (upperbound - lowerbound));
-    colour = vec4(subpassLoad(inputColour).rgb*depthColorScale,  1.0f);
+    return;
   }
 
-  else
+  if((effects & SPLIT_SCREEN) != 0 && gl_FragCoord.x <= post.splitPosition*post.extent.x)
   {
-    colour = subpassLoad(inputColour).rgba;
-
+    return;
   }
 
+  // darken with the linear view distance, black at the far plane
+  float depth = loadDepth();
+  float distance = post.nearPlane*post.farPlane/(post.farPlane - depth*(post.farPlane - post.nearPlane));
+  float depthColorScale = 1.0f - clamp((distance - post.nearPlane)/(post.farPlane - post.nearPlane), 0.0f, 1.0f);
+  colour = vec4(colour.rgb*depthColorScale,  1.0f);
 }
-
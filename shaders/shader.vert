@@ -9,14 +9,12 @@ layout(set=0, binding = 0) uniform UboViewProjection {
   mat4 view;
 } uboViewProjection;
 
-// NOT IN USE
-layout(set=0, binding = 1) uniform UboModel {
-  mat4 model;
-} uboModel;
+// column c of instance i is stored at c*MAX_INSTANCES + i
+layout(constant_id = 0) const uint MAX_INSTANCES = 4096;
 
-layout(push_constant) uniform PushModel {
-  mat4 model;
-} pushModel;
+layout(std430, set=2, binding = 0) readonly buffer ModelTransforms {
+  vec4 columns[];
+} modelTransforms;
 
 
 layout(location = 0) out vec3 fragCol;
@@ -24,7 +22,15 @@ layout(location = 1) out vec2 fragTex;
 
 
 void main() {
-  gl_Position = uboViewProjection.projection*uboViewProjection.view*pushModel.model*vec4(pos, 1.0);
+  uint instance = gl_InstanceIndex;
+  mat4 model = mat4(
+    modelTransforms.columns[instance],
+    modelTransforms.columns[MAX_INSTANCES + instance],
+    modelTransforms.columns[2*MAX_INSTANCES + instance],
+    modelTransforms.columns[3*MAX_INSTANCES + instance]
+  );
+
+  gl_Position = uboViewProjection.projection*uboViewProjection.view*model*vec4(pos, 1.0);
   fragCol = col;
   fragTex = tex;
 }
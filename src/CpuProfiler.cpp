@@ -0,0 +1,123 @@
+#include "CpuProfiler.h"
+
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+
+std::mutex CpuProfiler::buffersMutex;
+std::vector<std::unique_ptr<CpuProfiler::ThreadBuffer>> CpuProfiler::buffers;
+
+namespace {
+
+const auto startTime = std::chrono::steady_clock::now();
+
+}
+
+CpuProfiler::Zone::Zone(const char *newName)
+{
+  name = newName;
+  startNs = now();
+}
+
+CpuProfiler::Zone::~Zone()
+{
+  uint64_t endNs = now();
+  ThreadBuffer *buffer = threadBuffer();
+
+  // only this thread writes the buffer, publishing the count makes the event visible to the exporter
+  uint64_t index = buffer->written.load(std::memory_order_relaxed);
+  buffer->events[index % RING_SIZE] = {name, startNs, endNs};
+  buffer->written.store(index + 1, std::memory_order_release);
+}
+
+bool CpuProfiler::isEnabled()
+{
+#ifdef VKDEMO_PROFILE
+  return true;
+#else
+  return false;
+#endif
+}
+
+void CpuProfiler::setThreadName(const char *name)
+{
+  threadBuffer()->threadName = name;
+}
+
+uint64_t CpuProfiler::now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+CpuProfiler::ThreadBuffer *CpuProfiler::threadBuffer()
+{
+  thread_local ThreadBuffer *buffer = nullptr;
+  if(!buffer)
+  {
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    buffers.push_back(std::make_unique<ThreadBuffer>());
+    buffer = buffers.back().get();
+    buffer->threadId = static_cast<uint32_t>(buffers.size());
+  }
+  return buffer;
+}
+
+bool CpuProfiler::writeChromeTrace(const std::string &fileName)
+{
+  if(!isEnabled())
+  {
+    printf("CPU profiling is not compiled in, configure with -DVKDEMO_PROFILE=ON\n");
+    return false;
+  }
+
+  FILE *file = fopen(fileName.c_str(), "wb");
+  if(!file)
+  {
+    printf("ERROR: Failed to write CPU trace %s!\n", fileName.c_str());
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(buffersMutex);
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  bool first = true;
+  for(const auto &buffer: buffers)
+  {
+    if(buffer->threadName)
+    {
+      fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+              first ? "" : ",", buffer->threadId, buffer->threadName);
+      first = false;
+    }
+
+    uint64_t end = buffer->written.load(std::memory_order_acquire);
+    uint64_t begin = end > RING_SIZE ? end - RING_SIZE : 0;
+    std::vector<Event> events;
+    events.reserve(end - begin);
+    for(uint64_t i=begin; i<end; i++)
+    {
+      events.push_back(buffer->events[i % RING_SIZE]);
+    }
+
+    // the owning thread may have lapped the oldest entries while they were copied, and may be
+    // writing over the oldest one that is left
+    uint64_t after = buffer->written.load(std::memory_order_acquire) + 1;
+    uint64_t skip = after > begin + RING_SIZE ? std::min<uint64_t>(after - begin - RING_SIZE, events.size()) : 0;
+
+    for(size_t i=skip; i<events.size(); i++)
+    {
+      const Event &event = events[i];
+      fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+              first ? "" : ",", event.name, buffer->threadId, event.startNs*1e-3, (event.endNs - event.startNs)*1e-3);
+      first = false;
+    }
+  }
+  fprintf(file, "\n]}\n");
+
+  bool written = !ferror(file);
+  fclose(file);
+  if(!written)
+  {
+    printf("ERROR: Failed to write CPU trace %s!\n", fileName.c_str());
+  }
+  return written;
+}
@@ -0,0 +1,88 @@
+#include "FrameAllocator.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void FrameAllocator::create(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkBufferUsageFlags usage,
+                            VkDeviceSize newPersistentSize, VkDeviceSize newTransientSize, uint32_t frameCount)
+{
+  physicalDevice = newPhysicalDevice;
+  device = newDevice;
+
+  // offsets must be valid dynamic offsets and whole atoms for flushing
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+  alignment = std::max({deviceProperties.limits.minUniformBufferOffsetAlignment,
+                        deviceProperties.limits.minStorageBufferOffsetAlignment,
+                        deviceProperties.limits.nonCoherentAtomSize});
+
+  persistentSize = alignUp(newPersistentSize);
+  regionSize = persistentSize + alignUp(newTransientSize);
+
+  createBuffer(physicalDevice, device, regionSize*frameCount, usage,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, MemoryCategory::Uniform, &buffer, &memory);
+
+  VkMemoryRequirements memRequirements;
+  vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+  allocationSize = memRequirements.size;
+
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+  uint32_t typeIndex = findMemoryTypeIndex(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+  coherent = memoryProperties.memoryTypes[typeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+  void *data;
+  if(vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS)
+  {
+    throw std::runtime_error("Failed to map Frame Allocator Buffer!");
+  }
+  mapped = static_cast<char*>(data);
+
+  beginFrame(0);
+}
+
+void FrameAllocator::destroy()
+{
+  vkUnmapMemory(device, memory);
+  vkDestroyBuffer(device, buffer, nullptr);
+  MemoryTracker::free(device, memory);
+}
+
+void FrameAllocator::beginFrame(uint32_t frame)
+{
+  currentFrame = frame;
+  head = persistentSize;
+}
+
+FrameAllocator::Allocation FrameAllocator::allocate(VkDeviceSize size)
+{
+  VkDeviceSize alignedSize = alignUp(size);
+  if(head + alignedSize > regionSize)
+  {
+    throw std::runtime_error("Frame Allocator out of memory!");
+  }
+
+  VkDeviceSize offset = regionSize*currentFrame + head;
+  head += alignedSize;
+
+  return {offset, mapped + offset};
+}
+
+FrameAllocator::Allocation FrameAllocator::persistent(uint32_t frame)
+{
+  VkDeviceSize offset = regionSize*frame;
+  return {offset, mapped + offset};
+}
+
+void FrameAllocator::flush(const Allocation &allocation, VkDeviceSize size)
+{
+  if(coherent) return;
+
+  VkMappedMemoryRange range{};
+  range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+  range.memory = memory;
+  range.offset = allocation.offset;
+  range.size = std::min(alignUp(size), allocationSize - allocation.offset);
+
+  vkFlushMappedMemoryRanges(device, 1, &range);
+}
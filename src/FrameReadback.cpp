@@ -0,0 +1,168 @@
+#include "FrameReadback.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void FrameReadback::create(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkExtent2D newExtent, uint32_t slotCount)
+{
+  physicalDevice = newPhysicalDevice;
+  device = newDevice;
+  extent = newExtent;
+
+  // offscreen targets are always 4 byte rgba
+  imageSize = VkDeviceSize(extent.width)*extent.height*4;
+
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  slots.resize(slotCount);
+  for(auto &slot: slots)
+  {
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = imageSize;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if(vkCreateBuffer(device, &bufferInfo, nullptr, &slot.buffer) != VK_SUCCESS)
+    {
+      throw std::runtime_error("Failed to create Readback Buffer!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, slot.buffer, &memRequirements);
+
+    // reads from uncached memory are slow, prefer cached and invalidate when it is not coherent
+    uint32_t typeIndex;
+    try {
+      typeIndex = findMemoryTypeIndex(physicalDevice, memRequirements.memoryTypeBits,
+                                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+    }
+    catch (const std::runtime_error &) {
+      typeIndex = findMemoryTypeIndex(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    }
+    coherent = memoryProperties.memoryTypes[typeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    VkMemoryAllocateInfo memAllocInfo{};
+    memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memAllocInfo.allocationSize = memRequirements.size;
+    memAllocInfo.memoryTypeIndex = typeIndex;
+
+    if(MemoryTracker::allocate(device, &memAllocInfo, MemoryCategory::Staging, &slot.memory) != VK_SUCCESS)
+    {
+      throw std::runtime_error("Failed to allocate Readback Buffer Memory!");
+    }
+    vkBindBufferMemory(device, slot.buffer, slot.memory, 0);
+
+    if(vkMapMemory(device, slot.memory, 0, VK_WHOLE_SIZE, 0, &slot.mapped) != VK_SUCCESS)
+    {
+      throw std::runtime_error("Failed to map Readback Buffer!");
+    }
+    slot.frameIndex = 0;
+    slot.state = SlotState::Free;
+  }
+}
+
+void FrameReadback::destroy()
+{
+  for(auto &slot: slots)
+  {
+    vkUnmapMemory(device, slot.memory);
+    vkDestroyBuffer(device, slot.buffer, nullptr);
+    MemoryTracker::free(device, slot.memory);
+  }
+  slots.clear();
+}
+
+uint32_t FrameReadback::acquireSlot(uint64_t *oldestInFlight)
+{
+  std::lock_guard<std::mutex> lock(slotMutex);
+
+  *oldestInFlight = 0;
+  for(uint32_t i=0; i<slots.size(); i++)
+  {
+    if(slots[i].state == SlotState::Free) return i;
+    if(slots[i].state == SlotState::InFlight && (*oldestInFlight == 0 || slots[i].frameIndex < *oldestInFlight))
+    {
+      *oldestInFlight = slots[i].frameIndex;
+    }
+  }
+  return NO_SLOT;
+}
+
+void FrameReadback::recordCopy(VkCommandBuffer commandBuffer, VkImage image, uint32_t slot, uint64_t frameIndex)
+{
+  // the render graph moves the image to TRANSFER_SRC_OPTIMAL and its barrier covers the copy
+  VkBufferImageCopy region{};
+  region.bufferOffset = 0;
+  region.bufferRowLength = 0;
+  region.bufferImageHeight = 0;
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.mipLevel = 0;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount = 1;
+  region.imageOffset = {0, 0, 0};
+  region.imageExtent = {extent.width, extent.height, 1};
+
+  vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slots[slot].buffer, 1, &region);
+
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = slots[slot].buffer;
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                       0, nullptr, 1, &barrier, 0, nullptr);
+
+  std::lock_guard<std::mutex> lock(slotMutex);
+  slots[slot].frameIndex = frameIndex;
+  slots[slot].state = SlotState::InFlight;
+}
+
+std::vector<FrameReadback::Frame> FrameReadback::collect(uint64_t completedFrame)
+{
+  std::vector<Frame> completed;
+  std::vector<VkMappedMemoryRange> ranges;
+
+  {
+    std::lock_guard<std::mutex> lock(slotMutex);
+    for(uint32_t i=0; i<slots.size(); i++)
+    {
+      Slot &slot = slots[i];
+      if(slot.state != SlotState::InFlight || slot.frameIndex > completedFrame) continue;
+
+      slot.state = SlotState::Handed;
+      completed.push_back({slot.frameIndex, i, extent.width, extent.height, extent.width*4, slot.mapped});
+
+      if(!coherent)
+      {
+        VkMappedMemoryRange range{};
+        range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.memory = slot.memory;
+        range.offset = 0;
+        range.size = VK_WHOLE_SIZE;
+        ranges.push_back(range);
+      }
+    }
+  }
+
+  if(!ranges.empty())
+  {
+    vkInvalidateMappedMemoryRanges(device, static_cast<uint32_t>(ranges.size()), ranges.data());
+  }
+
+  std::sort(completed.begin(), completed.end(), [](const Frame &a, const Frame &b){ return a.frameIndex < b.frameIndex; });
+  return completed;
+}
+
+void FrameReadback::release(uint32_t slot)
+{
+  std::lock_guard<std::mutex> lock(slotMutex);
+  slots[slot].state = SlotState::Free;
+  slots[slot].frameIndex = 0;
+}
@@ -0,0 +1,219 @@
+#include "FrameWriter.h"
+#include "CpuProfiler.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+uint32_t crcTable[256];
+
+void initCrcTable()
+{
+  for(uint32_t n=0; n<256; n++)
+  {
+    uint32_t c = n;
+    for(int k=0; k<8; k++)
+    {
+      c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+    }
+    crcTable[n] = c;
+  }
+}
+
+uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0xffffffffu)
+{
+  for(size_t i=0; i<size; i++)
+  {
+    crc = crcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+void appendU32(std::vector<uint8_t> *out, uint32_t value)
+{
+  out->push_back(value >> 24);
+  out->push_back(value >> 16);
+  out->push_back(value >> 8);
+  out->push_back(value);
+}
+
+void appendChunk(std::vector<uint8_t> *out, const char *type, const uint8_t *data, size_t size)
+{
+  appendU32(out, static_cast<uint32_t>(size));
+  size_t typeOffset = out->size();
+  out->insert(out->end(), type, type + 4);
+  out->insert(out->end(), data, data + size);
+  appendU32(out, crc32(out->data() + typeOffset, size + 4) ^ 0xffffffffu);
+}
+
+}
+
+void FrameWriter::start(Sink newSink, const std::string &newTarget, std::function<void(const FrameReadback::Frame&)> newOnWritten)
+{
+  sink = newSink;
+  target = newTarget;
+  onWritten = newOnWritten;
+
+  if(sink == Sink::Raw)
+  {
+    output = fopen(target.c_str(), "wb");
+  }
+  else if(sink == Sink::Pipe)
+  {
+    output = popen(target.c_str(), "w");
+  }
+
+  if(sink != Sink::Png && output == nullptr)
+  {
+    throw std::runtime_error("Failed to open Frame Writer output!");
+  }
+
+  initCrcTable();
+
+  stopping = false;
+  thread = std::thread(&FrameWriter::run, this);
+}
+
+void FrameWriter::push(const FrameReadback::Frame &frame)
+{
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    queue.push_back(frame);
+  }
+  queueChanged.notify_one();
+}
+
+void FrameWriter::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    stopping = true;
+  }
+  queueChanged.notify_one();
+
+  if(thread.joinable())
+  {
+    thread.join();
+  }
+
+  if(sink == Sink::Raw && output)
+  {
+    fclose(output);
+  }
+  else if(sink == Sink::Pipe && output)
+  {
+    pclose(output);
+  }
+  output = nullptr;
+}
+
+void FrameWriter::run()
+{
+  PROFILE_THREAD("frame writer");
+  while(true)
+  {
+    FrameReadback::Frame frame;
+    {
+      std::unique_lock<std::mutex> lock(queueMutex);
+      queueChanged.wait(lock, [this]{ return stopping || !queue.empty(); });
+
+      // drain everything that was pushed before stop
+      if(queue.empty()) return;
+
+      frame = queue.front();
+      queue.pop_front();
+    }
+
+    if(!failed)
+    {
+      PROFILE_ZONE("FrameWriter::write");
+      write(frame);
+    }
+    framesWritten++;
+
+    if(onWritten)
+    {
+      onWritten(frame);
+    }
+  }
+}
+
+void FrameWriter::write(const FrameReadback::Frame &frame)
+{
+  if(sink == Sink::Png)
+  {
+    writePng(frame);
+    return;
+  }
+
+  size_t size = size_t(frame.rowPitch)*frame.height;
+  if(fwrite(frame.pixels, 1, size, output) != size)
+  {
+    printf("ERROR: Failed to write frame %lu, further frames are dropped!\n", (unsigned long) frame.frameIndex);
+    failed = true;
+  }
+}
+
+void FrameWriter::writePng(const FrameReadback::Frame &frame)
+{
+  // stored (uncompressed) deflate blocks, encoding speed matters more than file size here
+  const uint8_t *pixels = static_cast<const uint8_t*>(frame.pixels);
+  size_t rowSize = size_t(frame.width)*4;
+
+  std::vector<uint8_t> scanlines;
+  scanlines.reserve((rowSize + 1)*frame.height);
+  for(uint32_t y=0; y<frame.height; y++)
+  {
+    scanlines.push_back(0);
+    scanlines.insert(scanlines.end(), pixels + size_t(y)*frame.rowPitch, pixels + size_t(y)*frame.rowPitch + rowSize);
+  }
+
+  std::vector<uint8_t> zlib = {0x78, 0x01};
+  uint32_t adlerA = 1, adlerB = 0;
+  for(size_t offset=0; offset<scanlines.size(); offset += 65535)
+  {
+    size_t blockSize = std::min<size_t>(65535, scanlines.size() - offset);
+    bool last = offset + blockSize == scanlines.size();
+
+    zlib.push_back(last ? 1 : 0);
+    zlib.push_back(blockSize & 0xff);
+    zlib.push_back(blockSize >> 8);
+    zlib.push_back(~blockSize & 0xff);
+    zlib.push_back((~blockSize >> 8) & 0xff);
+    zlib.insert(zlib.end(), scanlines.begin() + offset, scanlines.begin() + offset + blockSize);
+
+    for(size_t i=offset; i<offset + blockSize; i++)
+    {
+      adlerA = (adlerA + scanlines[i]) % 65521;
+      adlerB = (adlerB + adlerA) % 65521;
+    }
+  }
+  appendU32(&zlib, (adlerB << 16) | adlerA);
+
+  std::vector<uint8_t> header;
+  appendU32(&header, frame.width);
+  appendU32(&header, frame.height);
+  header.insert(header.end(), {8, 6, 0, 0, 0});
+
+  encodeBuffer.clear();
+  const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  encodeBuffer.insert(encodeBuffer.end(), signature, signature + 8);
+  appendChunk(&encodeBuffer, "IHDR", header.data(), header.size());
+  appendChunk(&encodeBuffer, "IDAT", zlib.data(), zlib.size());
+  appendChunk(&encodeBuffer, "IEND", nullptr, 0);
+
+  char fileName[32];
+  snprintf(fileName, sizeof(fileName), "%06lu.png", (unsigned long) frame.frameIndex);
+
+  FILE *file = fopen((target + fileName).c_str(), "wb");
+  if(file == nullptr || fwrite(encodeBuffer.data(), 1, encodeBuffer.size(), file) != encodeBuffer.size())
+  {
+    printf("ERROR: Failed to write frame %lu, further frames are dropped!\n", (unsigned long) frame.frameIndex);
+    failed = true;
+  }
+  if(file)
+  {
+    fclose(file);
+  }
+}
@@ -0,0 +1,208 @@
+#include "GpuProfiler.h"
+
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+void GpuProfiler::create(VkPhysicalDevice physicalDevice, VkDevice newDevice, uint32_t queueFamily, uint32_t frameCount)
+{
+  device = newDevice;
+
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+  uint32_t validBits = queueFamily < familyCount ? families[queueFamily].timestampValidBits : 0;
+  if(validBits == 0 || properties.limits.timestampPeriod <= 0.0f)
+  {
+    printf("GPU timestamps are not supported on this queue, GPU profiling is off\n");
+    return;
+  }
+
+  // the counter wraps at validBits, differences are taken modulo that
+  timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+  timestampPeriod = properties.limits.timestampPeriod;
+
+  VkQueryPoolCreateInfo queryPoolInfo{};
+  queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  queryPoolInfo.queryCount = 2*MAX_ZONES*frameCount;
+
+  if(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS)
+  {
+    throw std::runtime_error("Failed to create Timestamp Query Pool!");
+  }
+
+  frames.assign(frameCount, FrameZones());
+}
+
+void GpuProfiler::destroy()
+{
+  if(queryPool != VK_NULL_HANDLE)
+  {
+    vkDestroyQueryPool(device, queryPool, nullptr);
+    queryPool = VK_NULL_HANDLE;
+  }
+  frames.clear();
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer commandBuffer, uint32_t frame, uint64_t frameIndex)
+{
+  if(!isEnabled()) return;
+
+  recordingFrame = frame;
+  FrameZones &frameZones = frames[frame];
+  frameZones.frameIndex = frameIndex;
+  frameZones.recorded = true;
+  frameZones.zones.clear();
+  openZones.clear();
+
+  vkCmdResetQueryPool(commandBuffer, queryPool, 2*MAX_ZONES*frame, 2*MAX_ZONES);
+  beginZone(commandBuffer, "frame");
+}
+
+void GpuProfiler::endFrame(VkCommandBuffer commandBuffer)
+{
+  if(!isEnabled()) return;
+
+  endZone(commandBuffer);
+}
+
+void GpuProfiler::beginZone(VkCommandBuffer commandBuffer, const std::string &name)
+{
+  if(!isEnabled()) return;
+
+  FrameZones &frameZones = frames[recordingFrame];
+  if(frameZones.zones.size() >= MAX_ZONES)
+  {
+    openZones.push_back(MAX_ZONES);
+    return;
+  }
+
+  uint32_t zone = static_cast<uint32_t>(frameZones.zones.size());
+  frameZones.zones.push_back({nameIndex(name), static_cast<uint32_t>(openZones.size())});
+  openZones.push_back(zone);
+
+  // zones of consecutive passes may overlap on the gpu, top to bottom covers all of a zone's work
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 2*(MAX_ZONES*recordingFrame + zone));
+}
+
+void GpuProfiler::endZone(VkCommandBuffer commandBuffer)
+{
+  if(!isEnabled() || openZones.empty()) return;
+
+  uint32_t zone = openZones.back();
+  openZones.pop_back();
+  if(zone == MAX_ZONES) return;
+
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 2*(MAX_ZONES*recordingFrame + zone) + 1);
+}
+
+void GpuProfiler::collect(uint32_t frame)
+{
+  if(!isEnabled() || !frames[frame].recorded) return;
+
+  FrameZones &frameZones = frames[frame];
+  frameZones.recorded = false;
+  if(frameZones.zones.empty()) return;
+
+  uint32_t queryCount = 2*static_cast<uint32_t>(frameZones.zones.size());
+  std::vector<uint64_t> timestamps(queryCount);
+  VkResult result = vkGetQueryPoolResults(device, queryPool, 2*MAX_ZONES*frame, queryCount, sizeof(uint64_t)*queryCount,
+                                          timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+  if(result != VK_SUCCESS) return;
+
+  if(!traceBaseSet)
+  {
+    traceBase = timestamps[0];
+    traceBaseSet = true;
+  }
+
+  for(size_t i=0; i<frameZones.zones.size(); i++)
+  {
+    uint64_t begin = timestamps[2*i];
+    uint64_t end = timestamps[2*i + 1];
+    double durationNs = double((end - begin) & timestampMask)*timestampPeriod;
+
+    ZoneHistory &history = histories[frameZones.zones[i].name];
+    history.samples.push_back(float(durationNs*1e-6));
+    if(history.samples.size() > STATS_WINDOW)
+    {
+      history.samples.pop_front();
+    }
+
+    double startNs = double((begin - traceBase) & timestampMask)*timestampPeriod;
+    traceEvents.push_back({frameZones.zones[i].name, frameZones.frameIndex, startNs*1e-3, durationNs*1e-3});
+    if(traceEvents.size() > MAX_TRACE_EVENTS)
+    {
+      traceEvents.pop_front();
+    }
+  }
+}
+
+std::vector<GpuProfiler::ZoneStats> GpuProfiler::getStats()
+{
+  std::vector<ZoneStats> stats;
+  for(const auto &history: histories)
+  {
+    if(history.samples.empty()) continue;
+
+    std::vector<float> sorted(history.samples.begin(), history.samples.end());
+    std::sort(sorted.begin(), sorted.end());
+
+    float sum = 0.0f;
+    for(float sample: sorted)
+    {
+      sum += sample;
+    }
+
+    size_t p99 = static_cast<size_t>(std::ceil(0.99*sorted.size())) - 1;
+    stats.push_back({history.name, sorted.front(), sum/sorted.size(), sorted[p99], static_cast<uint32_t>(sorted.size())});
+  }
+  return stats;
+}
+
+bool GpuProfiler::writeChromeTrace(const std::string &fileName)
+{
+  FILE *file = fopen(fileName.c_str(), "wb");
+  if(!file)
+  {
+    printf("ERROR: Failed to write GPU trace %s!\n", fileName.c_str());
+    return false;
+  }
+
+  // complete events on one track, nested zones show up stacked by their times
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  for(size_t i=0; i<traceEvents.size(); i++)
+  {
+    const TraceEvent &event = traceEvents[i];
+    fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%llu}}",
+            i == 0 ? "" : ",", histories[event.name].name.c_str(), event.startUs, event.durationUs,
+            static_cast<unsigned long long>(event.frameIndex));
+  }
+  fprintf(file, "\n]}\n");
+
+  bool written = !ferror(file);
+  fclose(file);
+  if(!written)
+  {
+    printf("ERROR: Failed to write GPU trace %s!\n", fileName.c_str());
+  }
+  return written;
+}
+
+uint32_t GpuProfiler::nameIndex(const std::string &name)
+{
+  auto found = nameIndices.find(name);
+  if(found != nameIndices.end()) return found->second;
+
+  uint32_t index = static_cast<uint32_t>(histories.size());
+  nameIndices[name] = index;
+  histories.push_back({name, {}});
+  return index;
+}
@@ -0,0 +1,184 @@
+#include "MemoryTracker.h"
+
+#include <cstdio>
+#include <algorithm>
+
+std::mutex MemoryTracker::trackerMutex;
+VkPhysicalDevice MemoryTracker::physicalDevice{VK_NULL_HANDLE};
+bool MemoryTracker::budgetSupported{false};
+VkPhysicalDeviceMemoryProperties MemoryTracker::memoryProperties{};
+
+std::unordered_map<VkDeviceMemory, MemoryTracker::Allocation> MemoryTracker::allocations;
+std::array<MemoryTracker::CategoryStats, static_cast<size_t>(MemoryCategory::Count)> MemoryTracker::categories{};
+std::vector<VkDeviceSize> MemoryTracker::heapTracked;
+VkDeviceSize MemoryTracker::current{0};
+VkDeviceSize MemoryTracker::peak{0};
+
+VkDeviceSize MemoryTracker::budget{0};
+bool MemoryTracker::strictBudget{false};
+bool MemoryTracker::overBudget{false};
+std::vector<bool> MemoryTracker::heapOverBudget;
+
+namespace {
+
+double toMb(VkDeviceSize bytes)
+{
+  return bytes/1048576.0;
+}
+
+}
+
+void MemoryTracker::create(VkPhysicalDevice newPhysicalDevice, bool newBudgetSupported)
+{
+  std::lock_guard<std::mutex> lock(trackerMutex);
+  physicalDevice = newPhysicalDevice;
+  budgetSupported = newBudgetSupported;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  allocations.clear();
+  categories = {};
+  heapTracked.assign(memoryProperties.memoryHeapCount, 0);
+  heapOverBudget.assign(memoryProperties.memoryHeapCount, false);
+  current = 0;
+  peak = 0;
+  overBudget = false;
+}
+
+void MemoryTracker::setBudget(VkDeviceSize bytes, bool strict)
+{
+  std::lock_guard<std::mutex> lock(trackerMutex);
+  budget = bytes;
+  strictBudget = strict;
+  overBudget = false;
+}
+
+VkResult MemoryTracker::allocate(VkDevice device, const VkMemoryAllocateInfo *allocInfo, MemoryCategory category,
+                                 VkDeviceMemory *memory)
+{
+  std::lock_guard<std::mutex> lock(trackerMutex);
+  VkDeviceSize size = allocInfo->allocationSize;
+  uint32_t heap = memoryProperties.memoryTypes[allocInfo->memoryTypeIndex].heapIndex;
+
+  if(budget > 0 && current + size > budget)
+  {
+    if(strictBudget)
+    {
+      printf("ERROR: %.1fMB of %s memory would exceed the %.1fMB budget, %.1fMB in use\n", toMb(size),
+             getCategoryName(category), toMb(budget), toMb(current));
+      return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+    if(!overBudget)
+    {
+      printf("WARNING: device memory over the %.1fMB budget, %.1fMB in use after %.1fMB of %s memory\n", toMb(budget),
+             toMb(current + size), toMb(size), getCategoryName(category));
+      overBudget = true;
+    }
+  }
+
+  // the driver's budget covers other processes too, only warn, the allocation may still fit
+  if(budgetSupported && !heapOverBudget[heap])
+  {
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+    queryBudget(&budgetProperties);
+    if(budgetProperties.heapUsage[heap] + size > budgetProperties.heapBudget[heap])
+    {
+      printf("WARNING: memory heap %u is over the driver's %.1fMB budget\n", heap, toMb(budgetProperties.heapBudget[heap]));
+      heapOverBudget[heap] = true;
+    }
+  }
+
+  VkResult result = vkAllocateMemory(device, allocInfo, nullptr, memory);
+  if(result != VK_SUCCESS) return result;
+
+  allocations[*memory] = {size, category, heap};
+  CategoryStats &stats = categories[static_cast<size_t>(category)];
+  stats.current += size;
+  stats.peak = std::max(stats.peak, stats.current);
+  stats.allocations++;
+  heapTracked[heap] += size;
+  current += size;
+  peak = std::max(peak, current);
+  return result;
+}
+
+void MemoryTracker::free(VkDevice device, VkDeviceMemory memory)
+{
+  if(memory == VK_NULL_HANDLE) return;
+
+  std::lock_guard<std::mutex> lock(trackerMutex);
+  auto found = allocations.find(memory);
+  if(found != allocations.end())
+  {
+    const Allocation &allocation = found->second;
+    CategoryStats &stats = categories[static_cast<size_t>(allocation.category)];
+    stats.current -= allocation.size;
+    stats.allocations--;
+    heapTracked[allocation.heap] -= allocation.size;
+    current -= allocation.size;
+
+    if(budget > 0 && current <= budget) overBudget = false;
+    allocations.erase(found);
+  }
+
+  vkFreeMemory(device, memory, nullptr);
+}
+
+MemoryTracker::CategoryStats MemoryTracker::getStats(MemoryCategory category)
+{
+  std::lock_guard<std::mutex> lock(trackerMutex);
+  return categories[static_cast<size_t>(category)];
+}
+
+VkDeviceSize MemoryTracker::getCurrent()
+{
+  std::lock_guard<std::mutex> lock(trackerMutex);
+  return current;
+}
+
+VkDeviceSize MemoryTracker::getPeak()
+{
+  std::lock_guard<std::mutex> lock(trackerMutex);
+  return peak;
+}
+
+std::vector<MemoryTracker::HeapStats> MemoryTracker::getHeapStats()
+{
+  std::lock_guard<std::mutex> lock(trackerMutex);
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+  if(budgetSupported)
+  {
+    queryBudget(&budgetProperties);
+  }
+
+  std::vector<HeapStats> heaps;
+  for(uint32_t i=0; i<memoryProperties.memoryHeapCount; i++)
+  {
+    heaps.push_back({(memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0,
+                     memoryProperties.memoryHeaps[i].size, heapTracked[i],
+                     budgetProperties.heapBudget[i], budgetProperties.heapUsage[i]});
+  }
+  return heaps;
+}
+
+const char *MemoryTracker::getCategoryName(MemoryCategory category)
+{
+  switch(category)
+  {
+    case MemoryCategory::Mesh: return "mesh";
+    case MemoryCategory::Texture: return "texture";
+    case MemoryCategory::Attachment: return "attachment";
+    case MemoryCategory::Uniform: return "uniform";
+    case MemoryCategory::Staging: return "staging";
+    default: return "unknown";
+  }
+}
+
+void MemoryTracker::queryBudget(VkPhysicalDeviceMemoryBudgetPropertiesEXT *budgetProperties)
+{
+  budgetProperties->sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+  VkPhysicalDeviceMemoryProperties2 properties{};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+  properties.pNext = budgetProperties;
+  vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &properties);
+}
@@ -1,22 +1,73 @@
 #include "Mesh.h"
 
 #include <cstring>
+#include <limits>
+#include <algorithm>
 
 Mesh::Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue,
            VkCommandPool transferCommandPool, std::vector<Vertex>* vertices, std::vector<uint32_t> *indices, int newTexid)
+  : Mesh(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, vertices, indices,
+         {{0, static_cast<uint32_t>(indices->size()), 0.0f}}, newTexid)
+{
+}
+
+Mesh::Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue,
+           VkCommandPool transferCommandPool, std::vector<Vertex>* vertices, std::vector<uint32_t> *indices,
+           std::vector<MeshLod> newLods, int newTexid)
 
 {
   vertexCount = vertices->size();
-  indexCount = indices->size();
+  indexCount = newLods[0].indexCount;
   physicalDevice = newPhysicalDevice;
   device = newDevice;
   createVertexBuffer(transferQueue, transferCommandPool, vertices);
   createIndexBuffer(transferQueue, transferCommandPool, indices);
+  computeBounds(vertices);
 
+  lods = newLods;
   model.model = glm::mat4(1.0f);
   texId = newTexid;
 }
 
+void Mesh::computeBounds(std::vector<Vertex> *vertices)
+{
+  glm::vec3 minPos(std::numeric_limits<float>::max());
+  glm::vec3 maxPos(std::numeric_limits<float>::lowest());
+
+  for(const auto &vertex: *vertices)
+  {
+    minPos = glm::min(minPos, vertex.pos);
+    maxPos = glm::max(maxPos, vertex.pos);
+  }
+
+  boundsCenter = vertices->empty() ? glm::vec3(0.0f) : 0.5f*(minPos + maxPos);
+  boundsRadius = 0.0f;
+  for(const auto &vertex: *vertices)
+  {
+    boundsRadius = std::max(boundsRadius, glm::length(vertex.pos - boundsCenter));
+  }
+}
+
+uint32_t Mesh::selectLod(float pixelsPerUnit, float maxPixelError, float hysteresis)
+{
+  // coarsest level whose projected error stays below the threshold, errors grow with the level
+  uint32_t target = 0;
+  for(uint32_t i=1; i<lods.size(); i++)
+  {
+    if(lods[i].error*pixelsPerUnit > maxPixelError) break;
+    target = i;
+  }
+
+  // only step down in detail once the error is clearly below the threshold so lods don't flicker
+  while(target > currentLod && lods[target].error*pixelsPerUnit > maxPixelError*(1.0f - hysteresis))
+  {
+    target--;
+  }
+
+  currentLod = target;
+  return currentLod;
+}
+
 
 void Mesh::createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex> *vertices)
 {
@@ -27,7 +78,7 @@ void Mesh::createVertexBuffer(VkQueue transferQueue, VkCommandPool transferComma
   VkDeviceMemory stagingBufferMemory;
 
   createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Staging,
     &stagingBuffer, &stagingBufferMemory
   );
 
@@ -37,14 +88,14 @@ void Mesh::createVertexBuffer(VkQueue transferQueue, VkCommandPool transferComma
   vkUnmapMemory(device, stagingBufferMemory);
 
   createBuffer(physicalDevice, device, bufferSize, 
-    VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+    VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Mesh,
     &vertexBuffer, &vertexBufferMemory
   );
 
   copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, vertexBuffer, bufferSize);
 
   vkDestroyBuffer(device, stagingBuffer, nullptr);
-  vkFreeMemory(device, stagingBufferMemory, nullptr);
+  MemoryTracker::free(device, stagingBufferMemory);
 }
   
 void Mesh::createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t> *indices)
@@ -56,7 +107,7 @@ void Mesh::createIndexBuffer(VkQueue transferQueue, VkCommandPool transferComman
   VkDeviceMemory stagingBufferMemory;
 
   createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Staging,
     &stagingBuffer, &stagingBufferMemory
   );
 
@@ -66,14 +117,14 @@ void Mesh::createIndexBuffer(VkQueue transferQueue, VkCommandPool transferComman
   vkUnmapMemory(device, stagingBufferMemory);
 
   createBuffer(physicalDevice, device, bufferSize, 
-    VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+    VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Mesh,
     &indexBuffer, &indexBufferMemory
   );
 
   copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, indexBuffer, bufferSize);
 
   vkDestroyBuffer(device, stagingBuffer, nullptr);
-  vkFreeMemory(device, stagingBufferMemory, nullptr);
+  MemoryTracker::free(device, stagingBufferMemory);
 
 }
 
@@ -82,6 +133,6 @@ void Mesh::destroyBuffers()
 {
   vkDestroyBuffer(device, vertexBuffer, nullptr);
   vkDestroyBuffer(device, indexBuffer, nullptr);
-  vkFreeMemory(device, vertexBufferMemory, nullptr);
-  vkFreeMemory(device, indexBufferMemory, nullptr);
+  MemoryTracker::free(device, vertexBufferMemory);
+  MemoryTracker::free(device, indexBufferMemory);
 }
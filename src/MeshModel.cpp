@@ -1,9 +1,18 @@
 #include "MeshModel.h"
+#include "CpuProfiler.h"
 
 MeshModel::MeshModel(std::vector<Mesh> newMeshList)
 {
   meshList = newMeshList;
-  model = glm::mat4(1.0f);
+  sceneGraph.addNode(SceneGraph::NO_PARENT, glm::mat4(1.0f));
+  meshNodes.assign(meshList.size(), 0);
+}
+
+MeshModel::MeshModel(std::vector<Mesh> newMeshList, SceneGraph newSceneGraph, std::vector<uint32_t> newMeshNodes)
+{
+  meshList = newMeshList;
+  sceneGraph = newSceneGraph;
+  meshNodes = newMeshNodes;
 }
 
 size_t MeshModel::getMeshCount()
@@ -23,12 +32,23 @@ Mesh* MeshModel::getMesh(size_t index)
 
 glm::mat4 MeshModel::getModel()
 {
-  return model;
+  return sceneGraph.getRoot();
 }
 
 void MeshModel::setModel(glm::mat4 newModel)
 {
-  model = newModel;
+  sceneGraph.setRoot(newModel);
+}
+
+void MeshModel::updateTransforms(TransformBuffer *transformBuffer)
+{
+  changedNodes.clear();
+  if(!sceneGraph.update(&changedNodes)) return;
+
+  for(uint32_t node: changedNodes)
+  {
+    transformBuffer->setTransform(instanceId + node, sceneGraph.getWorld(node));
+  }
 }
 
 void MeshModel::destroyMeshModel()
@@ -76,6 +96,7 @@ Mesh MeshModel::LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice,
                                   VkQueue transferQueue, VkCommandPool transferCommandPool,
                                     aiMesh *mesh, const aiScene *scene, std::vector<int> matToTex)
 {
+  PROFILE_ZONE("MeshModel::LoadMesh");
   std::vector<Vertex> vertices;
   std::vector<uint32_t> indices;
 
@@ -106,25 +127,45 @@ Mesh MeshModel::LoadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice,
     }
   }
 
-  Mesh newMesh = Mesh(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, &vertices, &indices, matToTex[mesh->mMaterialIndex]);
+  std::vector<MeshLod> lods = MeshSimplifier::generateLods(vertices, &indices);
+
+  Mesh newMesh = Mesh(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, &vertices, &indices, lods, matToTex[mesh->mMaterialIndex]);
+
+  // translucent materials select the blended pipeline permutation
+  float opacity = 1.0f;
+  if(scene->mMaterials[mesh->mMaterialIndex]->Get(AI_MATKEY_OPACITY, opacity) == AI_SUCCESS && opacity < 1.0f)
+  {
+    newMesh.setBlendMode(BlendMode::Alpha);
+  }
   return newMesh;
 }
 
 std::vector<Mesh> MeshModel::LoadNode(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, 
                                   VkQueue transferQueue, VkCommandPool transferCommandPool,
-                                    aiNode *node, const aiScene *scene, std::vector<int> matToTex)
+                                    aiNode *node, const aiScene *scene, std::vector<int> matToTex,
+                                    int32_t parent, SceneGraph *sceneGraph, std::vector<uint32_t> *meshNodes)
 {
   std::vector<Mesh> meshList;
 
+  // assimp matrices are row major
+  const aiMatrix4x4 &m = node->mTransformation;
+  glm::mat4 local(m.a1, m.b1, m.c1, m.d1,
+                  m.a2, m.b2, m.c2, m.d2,
+                  m.a3, m.b3, m.c3, m.d3,
+                  m.a4, m.b4, m.c4, m.d4);
+  uint32_t sceneNode = sceneGraph->addNode(parent, local, node->mName.C_Str());
+
   for(size_t i=0; i < node->mNumMeshes; i++)
   {
     meshList.push_back(
        LoadMesh(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, scene->mMeshes[node->mMeshes[i]], scene, matToTex)
     );
+    meshNodes->push_back(sceneNode);
   }
   
   for(size_t i=0; i < node->mNumChildren; i++){
-    std::vector<Mesh> newList = LoadNode(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, node->mChildren[i], scene, matToTex);
+    std::vector<Mesh> newList = LoadNode(newPhysicalDevice, newDevice, transferQueue, transferCommandPool, node->mChildren[i],
+                                         scene, matToTex, static_cast<int32_t>(sceneNode), sceneGraph, meshNodes);
     meshList.insert(meshList.end(), newList.begin(), newList.end());
   }
   return meshList;
@@ -0,0 +1,257 @@
+#include "MeshSimplifier.h"
+#include "CpuProfiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <unordered_map>
+
+namespace {
+
+struct Collapse {
+  double cost;
+  uint32_t from;
+  uint32_t to;
+  uint32_t fromVersion;
+  uint32_t toVersion;
+
+  bool operator>(const Collapse &other) const { return cost > other.cost; }
+};
+
+uint64_t edgeKey(uint32_t a, uint32_t b)
+{
+  if(a > b) std::swap(a, b);
+  return (uint64_t(a) << 32) | b;
+}
+
+}
+
+void MeshSimplifier::addPlane(Quadric *q, glm::vec3 n, float d, double weight)
+{
+  q->a[0] += weight*n.x*n.x; q->a[1] += weight*n.x*n.y; q->a[2] += weight*n.x*n.z; q->a[3] += weight*n.x*d;
+  q->a[4] += weight*n.y*n.y; q->a[5] += weight*n.y*n.z; q->a[6] += weight*n.y*d;
+  q->a[7] += weight*n.z*n.z; q->a[8] += weight*n.z*d;
+  q->a[9] += weight*d*d;
+  q->weight += weight;
+}
+
+void MeshSimplifier::addQuadric(Quadric *q, const Quadric &other)
+{
+  for(size_t i=0; i<10; i++)
+  {
+    q->a[i] += other.a[i];
+  }
+  q->weight += other.weight;
+}
+
+double MeshSimplifier::evaluate(const Quadric &q, glm::vec3 p)
+{
+  double x = p.x, y = p.y, z = p.z;
+  double error = q.a[0]*x*x + 2*q.a[1]*x*y + 2*q.a[2]*x*z + 2*q.a[3]*x
+               + q.a[4]*y*y + 2*q.a[5]*y*z + 2*q.a[6]*y
+               + q.a[7]*z*z + 2*q.a[8]*z
+               + q.a[9];
+
+  // normalise by the accumulated area so the error is a squared distance
+  return q.weight > 0.0 ? std::max(error, 0.0)/q.weight : 0.0;
+}
+
+std::vector<uint32_t> MeshSimplifier::simplify(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices,
+                                               size_t targetIndexCount, float *resultError)
+{
+  size_t vertexCount = vertices.size();
+  size_t triangleCount = indices.size()/3;
+
+  std::vector<uint32_t> triangles(indices.begin(), indices.begin() + triangleCount*3);
+  std::vector<bool> triangleAlive(triangleCount, true);
+  std::vector<std::vector<uint32_t>> vertexTriangles(vertexCount);
+
+  std::vector<Quadric> quadrics(vertexCount, Quadric{});
+  std::unordered_map<uint64_t, uint32_t> edgeUse;
+
+  for(size_t t=0; t<triangleCount; t++)
+  {
+    uint32_t i0 = triangles[t*3 + 0], i1 = triangles[t*3 + 1], i2 = triangles[t*3 + 2];
+
+    glm::vec3 normal = glm::cross(vertices[i1].pos - vertices[i0].pos, vertices[i2].pos - vertices[i0].pos);
+    float length = glm::length(normal);
+    if(length > 0.0f)
+    {
+      normal /= length;
+      float d = -glm::dot(normal, vertices[i0].pos);
+      for(uint32_t index: {i0, i1, i2})
+      {
+        addPlane(&quadrics[index], normal, d, 0.5*length);
+      }
+    }
+
+    for(uint32_t index: {i0, i1, i2})
+    {
+      vertexTriangles[index].push_back(t);
+    }
+
+    edgeUse[edgeKey(i0, i1)]++;
+    edgeUse[edgeKey(i1, i2)]++;
+    edgeUse[edgeKey(i2, i0)]++;
+  }
+
+  // border vertices (including uv seams split by the importer) are never moved, which keeps the lods crack free
+  std::vector<bool> locked(vertexCount, false);
+  for(const auto &edge: edgeUse)
+  {
+    if(edge.second != 2)
+    {
+      locked[edge.first >> 32] = true;
+      locked[edge.first & 0xffffffff] = true;
+    }
+  }
+
+  std::vector<bool> removed(vertexCount, false);
+  std::vector<uint32_t> version(vertexCount, 0);
+
+  std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+
+  auto pushCollapse = [&](uint32_t from, uint32_t to)
+  {
+    if(locked[from] || removed[from] || removed[to]) return;
+
+    Quadric merged = quadrics[from];
+    addQuadric(&merged, quadrics[to]);
+    queue.push({evaluate(merged, vertices[to].pos), from, to, version[from], version[to]});
+  };
+
+  for(const auto &edge: edgeUse)
+  {
+    uint32_t a = edge.first >> 32;
+    uint32_t b = edge.first & 0xffffffff;
+    pushCollapse(a, b);
+    pushCollapse(b, a);
+  }
+
+  // rejects collapses that would flip or degenerate a remaining triangle around from
+  auto collapseValid = [&](uint32_t from, uint32_t to)
+  {
+    for(uint32_t t: vertexTriangles[from])
+    {
+      if(!triangleAlive[t]) continue;
+
+      uint32_t *tri = &triangles[t*3];
+      if(tri[0] == to || tri[1] == to || tri[2] == to) continue;
+
+      glm::vec3 p[3], q[3];
+      for(size_t k=0; k<3; k++)
+      {
+        p[k] = vertices[tri[k]].pos;
+        q[k] = tri[k] == from ? vertices[to].pos : p[k];
+      }
+
+      glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+      glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+
+      float afterLength = glm::length(after);
+      if(afterLength <= 0.0f) return false;
+      if(glm::dot(before, after) < 0.2f*glm::length(before)*afterLength) return false;
+    }
+    return true;
+  };
+
+  size_t liveTriangles = triangleCount;
+  double maxError = 0.0;
+
+  while(liveTriangles*3 > targetIndexCount && !queue.empty())
+  {
+    Collapse collapse = queue.top();
+    queue.pop();
+
+    uint32_t from = collapse.from;
+    uint32_t to = collapse.to;
+
+    if(removed[from] || removed[to]) continue;
+    if(version[from] != collapse.fromVersion || version[to] != collapse.toVersion) continue;
+    if(!collapseValid(from, to)) continue;
+
+    for(uint32_t t: vertexTriangles[from])
+    {
+      if(!triangleAlive[t]) continue;
+
+      uint32_t *tri = &triangles[t*3];
+      if(tri[0] == to || tri[1] == to || tri[2] == to)
+      {
+        triangleAlive[t] = false;
+        liveTriangles--;
+        continue;
+      }
+
+      for(size_t k=0; k<3; k++)
+      {
+        if(tri[k] == from) tri[k] = to;
+      }
+      vertexTriangles[to].push_back(t);
+    }
+
+    removed[from] = true;
+    addQuadric(&quadrics[to], quadrics[from]);
+    version[to]++;
+    maxError = std::max(maxError, collapse.cost);
+
+    // drop dead triangles so the adjacency of hub vertices does not grow without bound
+    auto &adjacent = vertexTriangles[to];
+    adjacent.erase(std::remove_if(adjacent.begin(), adjacent.end(), [&](uint32_t t){ return !triangleAlive[t]; }), adjacent.end());
+
+    for(uint32_t t: adjacent)
+    {
+      for(size_t k=0; k<3; k++)
+      {
+        uint32_t other = triangles[t*3 + k];
+        if(other == to) continue;
+        pushCollapse(to, other);
+        pushCollapse(other, to);
+      }
+    }
+  }
+
+  std::vector<uint32_t> result;
+  result.reserve(liveTriangles*3);
+  for(size_t t=0; t<triangleCount; t++)
+  {
+    if(!triangleAlive[t]) continue;
+    result.insert(result.end(), &triangles[t*3], &triangles[t*3] + 3);
+  }
+
+  if(resultError)
+  {
+    *resultError = static_cast<float>(std::sqrt(maxError));
+  }
+  return result;
+}
+
+std::vector<MeshLod> MeshSimplifier::generateLods(const std::vector<Vertex> &vertices, std::vector<uint32_t> *indices)
+{
+  PROFILE_ZONE("MeshSimplifier::generateLods");
+  const size_t minLodIndexCount = 3*64;
+
+  std::vector<MeshLod> lods;
+  uint32_t baseIndexCount = static_cast<uint32_t>(indices->size());
+  lods.push_back({0, baseIndexCount, 0.0f});
+
+  std::vector<uint32_t> source(indices->begin(), indices->end());
+  float previousError = 0.0f;
+
+  for(int level=1; level<MAX_MESH_LODS; level++)
+  {
+    size_t targetIndexCount = (baseIndexCount >> level)/3*3;
+    if(targetIndexCount < minLodIndexCount) break;
+
+    float error = 0.0f;
+    std::vector<uint32_t> lodIndices = simplify(vertices, source, targetIndexCount, &error);
+
+    // stop once the collapses are blocked by locked borders or flips
+    if(lodIndices.empty() || lodIndices.size() > lods.back().indexCount*9/10) break;
+
+    previousError = std::max(previousError, error);
+    lods.push_back({static_cast<uint32_t>(indices->size()), static_cast<uint32_t>(lodIndices.size()), previousError});
+    indices->insert(indices->end(), lodIndices.begin(), lodIndices.end());
+  }
+
+  return lods;
+}
@@ -0,0 +1,132 @@
+#include "PipelineCache.h"
+#include "Utilities.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+const uint32_t CACHE_FILE_MAGIC = 0x43504b56; // "VKPC"
+const uint32_t CACHE_FILE_VERSION = 1;
+
+}
+
+void PipelineCache::create(VkPhysicalDevice physicalDevice, VkDevice newDevice, const std::string &newPath)
+{
+  device = newDevice;
+  path = newPath;
+
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+  expectedHeader.magic = CACHE_FILE_MAGIC;
+  expectedHeader.headerVersion = CACHE_FILE_VERSION;
+  expectedHeader.vendorID = deviceProperties.vendorID;
+  expectedHeader.deviceID = deviceProperties.deviceID;
+  expectedHeader.driverVersion = deviceProperties.driverVersion;
+  memcpy(expectedHeader.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+
+  std::vector<char> initialData = load();
+  loadedFromDisk = !initialData.empty();
+  loadedSize = initialData.size();
+
+  VkPipelineCacheCreateInfo cacheCreateInfo{};
+  cacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  cacheCreateInfo.initialDataSize = initialData.size();
+  cacheCreateInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+  if(vkCreatePipelineCache(device, &cacheCreateInfo, nullptr, &cache) != VK_SUCCESS)
+  {
+    throw std::runtime_error("Failed to create Pipeline Cache!");
+  }
+}
+
+std::vector<char> PipelineCache::load()
+{
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if(!file.is_open()) return {};
+
+  size_t fileSize = (size_t) file.tellg();
+  if(fileSize < sizeof(FileHeader)) return {};
+
+  FileHeader header;
+  file.seekg(0);
+  file.read(reinterpret_cast<char*>(&header), sizeof(FileHeader));
+
+  // anything but an exact match means another device or driver, let the driver start from scratch
+  if(header.magic != expectedHeader.magic || header.headerVersion != expectedHeader.headerVersion ||
+     header.vendorID != expectedHeader.vendorID || header.deviceID != expectedHeader.deviceID ||
+     header.driverVersion != expectedHeader.driverVersion ||
+     memcmp(header.pipelineCacheUUID, expectedHeader.pipelineCacheUUID, VK_UUID_SIZE) != 0 ||
+     header.dataSize != fileSize - sizeof(FileHeader))
+  {
+    return {};
+  }
+
+  std::vector<char> data(header.dataSize);
+  file.read(data.data(), data.size());
+  if(!file || checksum(data.data(), data.size()) != header.checksum) return {};
+
+  // the driver's own header has to agree as well
+  VkPipelineCacheHeaderVersionOne cacheHeader;
+  if(data.size() < sizeof(cacheHeader)) return {};
+  memcpy(&cacheHeader, data.data(), sizeof(cacheHeader));
+
+  if(cacheHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+     cacheHeader.vendorID != expectedHeader.vendorID || cacheHeader.deviceID != expectedHeader.deviceID ||
+     memcmp(cacheHeader.pipelineCacheUUID, expectedHeader.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+  {
+    return {};
+  }
+
+  return data;
+}
+
+void PipelineCache::save()
+{
+  size_t dataSize = 0;
+  if(vkGetPipelineCacheData(device, cache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) return;
+
+  std::vector<char> data(dataSize);
+  if(vkGetPipelineCacheData(device, cache, &dataSize, data.data()) != VK_SUCCESS) return;
+  data.resize(dataSize);
+
+  FileHeader header = expectedHeader;
+  header.dataSize = dataSize;
+  header.checksum = checksum(data.data(), data.size());
+
+  // write next to the target and rename over it, a crash mid write never leaves a torn cache behind
+  std::string tempPath = path + ".tmp";
+  FILE *file = fopen(tempPath.c_str(), "wb");
+  if(file == nullptr)
+  {
+    printf("ERROR: Failed to write Pipeline Cache %s!\n", tempPath.c_str());
+    return;
+  }
+
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(data.data(), 1, data.size(), file) == data.size();
+  written = fflush(file) == 0 && written;
+  fclose(file);
+
+  if(!written || rename(tempPath.c_str(), path.c_str()) != 0)
+  {
+    printf("ERROR: Failed to write Pipeline Cache %s!\n", path.c_str());
+    remove(tempPath.c_str());
+  }
+}
+
+void PipelineCache::destroy()
+{
+  vkDestroyPipelineCache(device, cache, nullptr);
+  cache = VK_NULL_HANDLE;
+}
+
+uint64_t PipelineCache::checksum(const char *data, size_t size)
+{
+  // fnv-1a, only guards against truncated or corrupted files
+  uint64_t hash = HASH_SEED;
+  hashBytes(&hash, data, size);
+  return hash;
+}
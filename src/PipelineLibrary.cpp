@@ -0,0 +1,449 @@
+#include "PipelineLibrary.h"
+#include "CpuProfiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+template<typename T>
+void hashValue(uint64_t *hash, const T &value)
+{
+  hashBytes(hash, &value, sizeof(T));
+}
+
+}
+
+uint64_t PipelineKey::hash() const
+{
+  uint64_t hash = HASH_SEED;
+  hashBytes(&hash, vertexShader.data(), vertexShader.size());
+  hashValue(&hash, '\0');
+  hashBytes(&hash, fragmentShader.data(), fragmentShader.size());
+  hashValue(&hash, vertexLayout);
+  hashValue(&hash, blendMode);
+  hashValue(&hash, depthTest);
+  hashValue(&hash, depthWrite);
+  hashValue(&hash, depthCompare);
+  hashValue(&hash, cullMode);
+  hashValue(&hash, samples);
+  hashValue(&hash, renderPass);
+  hashValue(&hash, subpass);
+  hashValue(&hash, layout);
+  hashBytes(&hash, vertexConstants.data(), sizeof(uint32_t)*vertexConstantCount);
+  hashValue(&hash, vertexConstantCount);
+  hashBytes(&hash, fragmentConstants.data(), sizeof(uint32_t)*fragmentConstantCount);
+  hashValue(&hash, fragmentConstantCount);
+  return hash;
+}
+
+bool PipelineKey::operator==(const PipelineKey &other) const
+{
+  return vertexShader == other.vertexShader && fragmentShader == other.fragmentShader &&
+         vertexLayout == other.vertexLayout && blendMode == other.blendMode &&
+         depthTest == other.depthTest && depthWrite == other.depthWrite && depthCompare == other.depthCompare &&
+         cullMode == other.cullMode && samples == other.samples && renderPass == other.renderPass && subpass == other.subpass &&
+         layout == other.layout &&
+         vertexConstantCount == other.vertexConstantCount && fragmentConstantCount == other.fragmentConstantCount &&
+         memcmp(vertexConstants.data(), other.vertexConstants.data(), sizeof(uint32_t)*vertexConstantCount) == 0 &&
+         memcmp(fragmentConstants.data(), other.fragmentConstants.data(), sizeof(uint32_t)*fragmentConstantCount) == 0;
+}
+
+void PipelineLibrary::create(VkDevice newDevice, VkPipelineCache newCache, ShaderLibrary *newShaders, uint32_t workerCount)
+{
+  device = newDevice;
+  cache = newCache;
+  shaders = newShaders;
+  stopping = false;
+
+  for(uint32_t i=0; i<workerCount; i++)
+  {
+    workers.emplace_back(&PipelineLibrary::workerLoop, this);
+  }
+}
+
+void PipelineLibrary::destroy()
+{
+  {
+    std::lock_guard<std::mutex> lock(entryMutex);
+    stopping = true;
+    queue.clear();
+  }
+  queueChanged.notify_all();
+
+  for(auto &worker: workers)
+  {
+    worker.join();
+  }
+  workers.clear();
+
+  for(auto &entry: entries)
+  {
+    vkDestroyPipeline(device, entry.second.pipeline, nullptr);
+  }
+  entries.clear();
+}
+
+VkPipeline PipelineLibrary::compile(const PipelineKey &key)
+{
+  uint64_t hash = key.hash();
+  {
+    std::unique_lock<std::mutex> lock(entryMutex);
+    auto queued = std::find(queue.begin(), queue.end(), hash);
+    if(queued != queue.end())
+    {
+      // not picked up by a worker yet, build it right here
+      queue.erase(queued);
+    }
+    else if(entries.count(hash))
+    {
+      // a worker may be busy with it already
+      entryCompiled.wait(lock, [&]{ return entries.count(hash) == 0 || entries[hash].state != EntryState::Queued; });
+
+      auto found = entries.find(hash);
+      if(found != entries.end() && found->second.state == EntryState::Ready) return found->second.pipeline;
+    }
+  }
+
+  VkPipeline pipeline;
+  try {
+    pipeline = build(key);
+  }
+  catch (const std::runtime_error &) {
+    // a queued entry taken off the queue would otherwise wait for a worker forever
+    {
+      std::lock_guard<std::mutex> lock(entryMutex);
+      auto found = entries.find(hash);
+      if(found != entries.end()) found->second.state = EntryState::Failed;
+    }
+    entryCompiled.notify_all();
+    throw;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(entryMutex);
+    entries[hash] = {key, EntryState::Ready, pipeline};
+  }
+  entryCompiled.notify_all();
+  return pipeline;
+}
+
+VkPipeline PipelineLibrary::find(const PipelineKey &key)
+{
+  uint64_t hash = key.hash();
+  {
+    std::lock_guard<std::mutex> lock(entryMutex);
+    auto found = entries.find(hash);
+    if(found != entries.end())
+    {
+      // a colliding key keeps drawing with the fallback rather than evicting the other permutation
+      bool ready = found->second.state == EntryState::Ready && found->second.key == key;
+      return ready ? found->second.pipeline : VK_NULL_HANDLE;
+    }
+
+    entries[hash] = {key, EntryState::Queued, VK_NULL_HANDLE};
+    queue.push_back(hash);
+  }
+  queueChanged.notify_one();
+
+  return VK_NULL_HANDLE;
+}
+
+void PipelineLibrary::request(const PipelineKey &key)
+{
+  find(key);
+}
+
+void PipelineLibrary::clear()
+{
+  std::unique_lock<std::mutex> lock(entryMutex);
+  queue.clear();
+  entryCompiled.wait(lock, [this]{ return compiling == 0; });
+
+  for(auto &entry: entries)
+  {
+    vkDestroyPipeline(device, entry.second.pipeline, nullptr);
+  }
+  entries.clear();
+}
+
+void PipelineLibrary::invalidate(const std::string &shaderName)
+{
+  std::unique_lock<std::mutex> lock(entryMutex);
+  auto usesShader = [&](const PipelineKey &key){
+    return key.vertexShader == shaderName || key.fragmentShader == shaderName;
+  };
+
+  // a worker may be building from the old module, let it finish before dropping the entry
+  queue.erase(std::remove_if(queue.begin(), queue.end(), [&](uint64_t hash){ return usesShader(entries[hash].key); }), queue.end());
+  entryCompiled.wait(lock, [this]{ return compiling == 0; });
+
+  for(auto entry = entries.begin(); entry != entries.end();)
+  {
+    if(usesShader(entry->second.key))
+    {
+      vkDestroyPipeline(device, entry->second.pipeline, nullptr);
+      entry = entries.erase(entry);
+    }
+    else
+    {
+      ++entry;
+    }
+  }
+}
+
+size_t PipelineLibrary::getPendingCount()
+{
+  std::lock_guard<std::mutex> lock(entryMutex);
+  return queue.size() + compiling;
+}
+
+void PipelineLibrary::workerLoop()
+{
+  PROFILE_THREAD("pipeline compiler");
+  while(true)
+  {
+    PipelineKey key;
+    uint64_t hash;
+    {
+      std::unique_lock<std::mutex> lock(entryMutex);
+      queueChanged.wait(lock, [this]{ return stopping || !queue.empty(); });
+      if(stopping) return;
+
+      hash = queue.front();
+      queue.pop_front();
+      key = entries[hash].key;
+      compiling++;
+    }
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    EntryState state = EntryState::Ready;
+    try {
+      PROFILE_ZONE("PipelineLibrary::build");
+      pipeline = build(key);
+    }
+    catch (const std::runtime_error &e) {
+      printf("ERROR: %s\n", e.what());
+      state = EntryState::Failed;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(entryMutex);
+      compiling--;
+
+      // cleared while compiling, the permutation is stale
+      auto found = entries.find(hash);
+      if(found == entries.end())
+      {
+        vkDestroyPipeline(device, pipeline, nullptr);
+      }
+      else
+      {
+        found->second.pipeline = pipeline;
+        found->second.state = state;
+      }
+    }
+    entryCompiled.notify_all();
+  }
+}
+
+VkShaderModule PipelineLibrary::loadShader(const std::string &name)
+{
+  std::vector<uint32_t> code = shaders->getCode(name);
+
+  VkShaderModuleCreateInfo shaderModuleCreateInfo{};
+  shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  shaderModuleCreateInfo.codeSize = sizeof(uint32_t)*code.size();
+  shaderModuleCreateInfo.pCode = code.data();
+
+  VkShaderModule shaderModule;
+  if(vkCreateShaderModule(device, &shaderModuleCreateInfo, nullptr, &shaderModule) != VK_SUCCESS)
+  {
+    throw std::runtime_error("Failed to create a Shader Module!");
+  }
+  return shaderModule;
+}
+
+VkPipeline PipelineLibrary::build(const PipelineKey &key)
+{
+  VkShaderModule vertexShaderModule = loadShader(key.vertexShader);
+  VkShaderModule fragmentShaderModule;
+  try {
+    fragmentShaderModule = loadShader(key.fragmentShader);
+  }
+  catch (const std::runtime_error &) {
+    vkDestroyShaderModule(device, vertexShaderModule, nullptr);
+    throw;
+  }
+
+  std::array<VkSpecializationMapEntry, 4> constantEntries;
+  for(uint32_t i=0; i<constantEntries.size(); i++)
+  {
+    constantEntries[i].constantID = i;
+    constantEntries[i].offset = sizeof(uint32_t)*i;
+    constantEntries[i].size = sizeof(uint32_t);
+  }
+
+  VkSpecializationInfo vertexSpecializationInfo{};
+  vertexSpecializationInfo.mapEntryCount = key.vertexConstantCount;
+  vertexSpecializationInfo.pMapEntries = constantEntries.data();
+  vertexSpecializationInfo.dataSize = sizeof(uint32_t)*key.vertexConstantCount;
+  vertexSpecializationInfo.pData = key.vertexConstants.data();
+
+  VkSpecializationInfo fragmentSpecializationInfo{};
+  fragmentSpecializationInfo.mapEntryCount = key.fragmentConstantCount;
+  fragmentSpecializationInfo.pMapEntries = constantEntries.data();
+  fragmentSpecializationInfo.dataSize = sizeof(uint32_t)*key.fragmentConstantCount;
+  fragmentSpecializationInfo.pData = key.fragmentConstants.data();
+
+  VkPipelineShaderStageCreateInfo vertexShaderStageCreateInfo{};
+  vertexShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  vertexShaderStageCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+  vertexShaderStageCreateInfo.module = vertexShaderModule;
+  vertexShaderStageCreateInfo.pName = "main";
+  vertexShaderStageCreateInfo.pSpecializationInfo = key.vertexConstantCount ? &vertexSpecializationInfo : nullptr;
+
+  VkPipelineShaderStageCreateInfo fragmentShaderStageCreateInfo{};
+  fragmentShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  fragmentShaderStageCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  fragmentShaderStageCreateInfo.module = fragmentShaderModule;
+  fragmentShaderStageCreateInfo.pName = "main";
+  fragmentShaderStageCreateInfo.pSpecializationInfo = key.fragmentConstantCount ? &fragmentSpecializationInfo : nullptr;
+
+  VkPipelineShaderStageCreateInfo shaderStages[] = {vertexShaderStageCreateInfo, fragmentShaderStageCreateInfo};
+
+  // vertex data
+  VkVertexInputBindingDescription bindingDescription{};
+  bindingDescription.binding = 0;
+  bindingDescription.stride = sizeof(Vertex);
+  bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+  //position, color and texture coordinates
+  std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions;
+
+  attributeDescriptions[0].binding = 0;
+  attributeDescriptions[0].location = 0;
+  attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+  attributeDescriptions[0].offset = offsetof(Vertex, pos);
+
+  attributeDescriptions[1].binding = 0;
+  attributeDescriptions[1].location = 1;
+  attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+  attributeDescriptions[1].offset = offsetof(Vertex, col);
+
+  attributeDescriptions[2].binding = 0;
+  attributeDescriptions[2].location = 2;
+  attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
+  attributeDescriptions[2].offset = offsetof(Vertex, tex);
+
+  //VERTEX INPUT
+  bool meshVertices = key.vertexLayout == VertexLayout::Mesh;
+
+  VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo{};
+  vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertexInputCreateInfo.vertexBindingDescriptionCount = meshVertices ? 1 : 0;
+  vertexInputCreateInfo.pVertexBindingDescriptions = &bindingDescription;
+  vertexInputCreateInfo.vertexAttributeDescriptionCount = meshVertices ? static_cast<uint32_t>(attributeDescriptions.size()) : 0;
+  vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+  //INPUT ASSEMBLY
+  VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+  inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+  //VIEWPORT + SCISSOR
+  // both are dynamic so the pipelines survive a resize
+  VkPipelineViewportStateCreateInfo viewPortStateCreateInfo{};
+  viewPortStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewPortStateCreateInfo.viewportCount = 1;
+  viewPortStateCreateInfo.pViewports = nullptr;
+  viewPortStateCreateInfo.scissorCount = 1;
+  viewPortStateCreateInfo.pScissors = nullptr;
+
+  std::array<VkDynamicState, 2> dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+
+  VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo{};
+  dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+  dynamicStateCreateInfo.pDynamicStates = dynamicStates.data();
+
+  // RASTERIZER
+  VkPipelineRasterizationStateCreateInfo rasterizerCreateInfo{};
+  rasterizerCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterizerCreateInfo.depthClampEnable = VK_FALSE;
+  rasterizerCreateInfo.rasterizerDiscardEnable = VK_FALSE;
+  rasterizerCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterizerCreateInfo.lineWidth = 1.0f;
+  rasterizerCreateInfo.cullMode = key.cullMode;
+  rasterizerCreateInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+  rasterizerCreateInfo.depthBiasEnable = VK_FALSE;
+
+  // MULTISAMPLING
+  VkPipelineMultisampleStateCreateInfo multiSamplingCreateInfo{};
+  multiSamplingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multiSamplingCreateInfo.sampleShadingEnable = VK_FALSE;
+  multiSamplingCreateInfo.rasterizationSamples = key.samples;
+
+  // BLENDING
+  VkPipelineColorBlendAttachmentState colourState{};
+  colourState.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                               VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  colourState.blendEnable = key.blendMode == BlendMode::Alpha ? VK_TRUE : VK_FALSE;
+  colourState.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+  colourState.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+  colourState.colorBlendOp = VK_BLEND_OP_ADD;
+  colourState.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  colourState.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+  colourState.alphaBlendOp = VK_BLEND_OP_ADD;
+
+  VkPipelineColorBlendStateCreateInfo colorBlendingCreateInfo{};
+  colorBlendingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  colorBlendingCreateInfo.logicOpEnable = VK_FALSE;
+  colorBlendingCreateInfo.attachmentCount = 1;
+  colorBlendingCreateInfo.pAttachments = &colourState;
+
+  // DEPTH STENCIL TESTING
+  VkPipelineDepthStencilStateCreateInfo depthStencilCreateInfo{};
+  depthStencilCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depthStencilCreateInfo.depthTestEnable = key.depthTest ? VK_TRUE : VK_FALSE;
+  depthStencilCreateInfo.depthWriteEnable = key.depthWrite ? VK_TRUE : VK_FALSE;
+  depthStencilCreateInfo.depthCompareOp = key.depthCompare;
+  depthStencilCreateInfo.depthBoundsTestEnable = VK_FALSE;
+  depthStencilCreateInfo.stencilTestEnable = VK_FALSE;
+
+  VkGraphicsPipelineCreateInfo pipelineCreateInfo{};
+  pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineCreateInfo.stageCount = 2;
+  pipelineCreateInfo.pStages = shaderStages;
+  pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
+  pipelineCreateInfo.pInputAssemblyState = &inputAssembly;
+  pipelineCreateInfo.pViewportState = &viewPortStateCreateInfo;
+  pipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
+  pipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
+  pipelineCreateInfo.pMultisampleState = &multiSamplingCreateInfo;
+  pipelineCreateInfo.pColorBlendState = &colorBlendingCreateInfo;
+  pipelineCreateInfo.pDepthStencilState = &depthStencilCreateInfo;
+  pipelineCreateInfo.layout = key.layout;
+  pipelineCreateInfo.renderPass = key.renderPass;
+  pipelineCreateInfo.subpass = key.subpass;
+
+  // no pipeline derivatives
+  pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
+  pipelineCreateInfo.basePipelineIndex = -1;
+
+  // the pipeline cache is internally synchronized, workers share it
+  VkPipeline pipeline;
+  VkResult result = vkCreateGraphicsPipelines(device, cache, 1, &pipelineCreateInfo, nullptr, &pipeline);
+
+  vkDestroyShaderModule(device, fragmentShaderModule, nullptr);
+  vkDestroyShaderModule(device, vertexShaderModule, nullptr);
+
+  if(result != VK_SUCCESS)
+  {
+    throw std::runtime_error("Failed to create Pipeline " + key.vertexShader + " / " + key.fragmentShader + "!");
+  }
+  return pipeline;
+}
@@ -0,0 +1,310 @@
+#include "PostChain.h"
+
+#include <array>
+#include <stdexcept>
+
+namespace {
+
+const char *POST_SHADER = "shaders/post_comp.spv";
+const uint32_t TILE_SIZE = 16;
+
+// bits of the PROLOGUE and EPILOGUE constants in post.comp, applied in this order
+const uint32_t POINTWISE_TONEMAP = 0x1;
+const uint32_t POINTWISE_COLOR_GRADE = 0x2;
+
+// values of the KERNEL constant
+const uint32_t KERNEL_FXAA = 1;
+const uint32_t KERNEL_SHARPEN = 2;
+
+}
+
+void PostChain::create(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkPipelineCache newCache, ShaderLibrary *newShaders,
+                       const std::vector<PostPass> &passes)
+{
+  physicalDevice = newPhysicalDevice;
+  device = newDevice;
+  cache = newCache;
+  shaders = newShaders;
+
+  planStages(passes);
+  if(stages.empty()) return;
+
+  SpirvReflection reflection = shaders->getReflection(POST_SHADER);
+  std::vector<VkDescriptorSetLayoutBinding> bindings = SpirvReflection::mergeSet({reflection}, 0);
+
+  VkDescriptorSetLayoutCreateInfo setLayoutInfo{};
+  setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  setLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  setLayoutInfo.pBindings = bindings.data();
+
+  if(vkCreateDescriptorSetLayout(device, &setLayoutInfo, nullptr, &setLayout) != VK_SUCCESS)
+  {
+    throw std::runtime_error("Failed to create Post Descriptor Set Layout!");
+  }
+
+  std::vector<VkPushConstantRange> pushConstantRanges = SpirvReflection::mergePushConstants({reflection});
+  if(pushConstantRanges.empty() || pushConstantRanges[0].size != sizeof(PushConstants))
+  {
+    throw std::runtime_error("Post Shader Push Constants do not match!");
+  }
+
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &setLayout;
+  pipelineLayoutInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstantRanges.size());
+  pipelineLayoutInfo.pPushConstantRanges = pushConstantRanges.data();
+
+  if(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+  {
+    throw std::runtime_error("Failed to create Post Pipeline Layout!");
+  }
+
+  // every stage reads one storage image and writes another
+  VkDescriptorPoolSize poolSize{};
+  poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  poolSize.descriptorCount = static_cast<uint32_t>(2*stages.size());
+
+  VkDescriptorPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.maxSets = static_cast<uint32_t>(stages.size());
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+
+  if(vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+  {
+    throw std::runtime_error("Failed to create Post Descriptor Pool!");
+  }
+
+  std::vector<VkDescriptorSetLayout> setLayouts(stages.size(), setLayout);
+  std::vector<VkDescriptorSet> descriptorSets(stages.size());
+
+  VkDescriptorSetAllocateInfo setAllocInfo{};
+  setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  setAllocInfo.descriptorPool = descriptorPool;
+  setAllocInfo.descriptorSetCount = static_cast<uint32_t>(setLayouts.size());
+  setAllocInfo.pSetLayouts = setLayouts.data();
+
+  if(vkAllocateDescriptorSets(device, &setAllocInfo, descriptorSets.data()) != VK_SUCCESS)
+  {
+    throw std::runtime_error("Failed to allocate Post Descriptor Sets!");
+  }
+  for(size_t i=0; i<stages.size(); i++)
+  {
+    stages[i].descriptorSet = descriptorSets[i];
+  }
+
+  createPipelines();
+}
+
+void PostChain::planStages(const std::vector<PostPass> &passes)
+{
+  stages.clear();
+
+  for(PostPass pass: passes)
+  {
+    uint32_t pointwise = 0;
+    uint32_t kernel = 0;
+    std::string name;
+    switch(pass)
+    {
+      case PostPass::Tonemap: pointwise = POINTWISE_TONEMAP; name = "tonemap"; break;
+      case PostPass::ColorGrade: pointwise = POINTWISE_COLOR_GRADE; name = "grade"; break;
+      case PostPass::Fxaa: kernel = KERNEL_FXAA; name = "fxaa"; break;
+      case PostPass::Sharpen: kernel = KERNEL_SHARPEN; name = "sharpen"; break;
+    }
+
+    // the shader applies pointwise passes in bit order, so one only fuses if nothing later is there yet.
+    // a kernel fuses into a stage that has none and has not started its epilogue
+    if(!stages.empty())
+    {
+      Stage &last = stages.back();
+      bool fused = false;
+      if(pointwise && !last.kernel && last.prologue < pointwise)
+      {
+        last.prologue |= pointwise;
+        fused = true;
+      }
+      else if(pointwise && last.kernel && last.epilogue < pointwise)
+      {
+        last.epilogue |= pointwise;
+        fused = true;
+      }
+      else if(kernel && !last.kernel && !last.epilogue)
+      {
+        last.kernel = kernel;
+        fused = true;
+      }
+
+      if(fused)
+      {
+        last.name += "+" + name;
+        continue;
+      }
+    }
+
+    Stage stage;
+    stage.prologue = pointwise;
+    stage.kernel = kernel;
+    stage.name = name;
+    stages.push_back(stage);
+  }
+}
+
+void PostChain::createPipelines()
+{
+  std::vector<uint32_t> code = shaders->getCode(POST_SHADER);
+
+  VkShaderModuleCreateInfo shaderModuleCreateInfo{};
+  shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  shaderModuleCreateInfo.codeSize = sizeof(uint32_t)*code.size();
+  shaderModuleCreateInfo.pCode = code.data();
+
+  VkShaderModule shaderModule;
+  if(vkCreateShaderModule(device, &shaderModuleCreateInfo, nullptr, &shaderModule) != VK_SUCCESS)
+  {
+    throw std::runtime_error("Failed to create a Shader Module!");
+  }
+
+  std::array<VkSpecializationMapEntry, 3> constantEntries;
+  for(uint32_t i=0; i<constantEntries.size(); i++)
+  {
+    constantEntries[i].constantID = i;
+    constantEntries[i].offset = sizeof(uint32_t)*i;
+    constantEntries[i].size = sizeof(uint32_t);
+  }
+
+  for(auto &stage: stages)
+  {
+    if(stage.pipeline != VK_NULL_HANDLE)
+    {
+      vkDestroyPipeline(device, stage.pipeline, nullptr);
+    }
+
+    std::array<uint32_t, 3> constants = {stage.prologue, stage.kernel, stage.epilogue};
+
+    VkSpecializationInfo specializationInfo{};
+    specializationInfo.mapEntryCount = static_cast<uint32_t>(constantEntries.size());
+    specializationInfo.pMapEntries = constantEntries.data();
+    specializationInfo.dataSize = sizeof(constants);
+    specializationInfo.pData = constants.data();
+
+    VkComputePipelineCreateInfo pipelineCreateInfo{};
+    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineCreateInfo.stage.module = shaderModule;
+    pipelineCreateInfo.stage.pName = "main";
+    pipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
+    pipelineCreateInfo.layout = pipelineLayout;
+
+    if(vkCreateComputePipelines(device, cache, 1, &pipelineCreateInfo, nullptr, &stage.pipeline) != VK_SUCCESS)
+    {
+      vkDestroyShaderModule(device, shaderModule, nullptr);
+      throw std::runtime_error("Failed to create a Post Pipeline!");
+    }
+  }
+
+  vkDestroyShaderModule(device, shaderModule, nullptr);
+}
+
+void PostChain::addPasses(RenderGraph *graph, RenderGraph::Resource source, RenderGraph::Resource target, VkExtent2D newExtent)
+{
+  extent = newExtent;
+
+  RenderGraph::Resource input = source;
+  for(size_t i=0; i<stages.size(); i++)
+  {
+    stages[i].input = input;
+    stages[i].output = graph->createImage("post." + stages[i].name, getFormat(), extent);
+
+    RenderGraph::Pass pass = graph->addPass("post." + stages[i].name, [this, i](VkCommandBuffer commandBuffer){
+      recordStage(commandBuffer, i);
+    });
+    graph->read(pass, stages[i].input, ImageUsage::Storage);
+    graph->write(pass, stages[i].output, ImageUsage::Storage);
+    input = stages[i].output;
+  }
+
+  // swapchain formats rarely allow storage, the result is blitted over which also converts the format
+  RenderGraph::Pass blit = graph->addPass("post.blit", [this, graph, input, target](VkCommandBuffer commandBuffer){
+    recordBlit(commandBuffer, graph->getImage(input), graph->getImage(target));
+  });
+  graph->read(blit, input, ImageUsage::Transfer);
+  graph->write(blit, target, ImageUsage::Transfer);
+}
+
+void PostChain::updateDescriptorSets(RenderGraph *graph)
+{
+  for(const auto &stage: stages)
+  {
+    std::array<VkDescriptorImageInfo, 2> imageInfos{};
+    imageInfos[0].imageView = graph->getImageView(stage.input);
+    imageInfos[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageInfos[1].imageView = graph->getImageView(stage.output);
+    imageInfos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    std::array<VkWriteDescriptorSet, 2> writes{};
+    for(uint32_t binding=0; binding<writes.size(); binding++)
+    {
+      writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      writes[binding].dstSet = stage.descriptorSet;
+      writes[binding].dstBinding = binding;
+      writes[binding].dstArrayElement = 0;
+      writes[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+      writes[binding].descriptorCount = 1;
+      writes[binding].pImageInfo = &imageInfos[binding];
+    }
+
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+  }
+}
+
+void PostChain::beginFrame(const Parameters &parameters, RenderStats *stats)
+{
+  frameStats = stats;
+  pushConstants.width = static_cast<int32_t>(extent.width);
+  pushConstants.height = static_cast<int32_t>(extent.height);
+  pushConstants.parameters = parameters;
+}
+
+void PostChain::recordStage(VkCommandBuffer commandBuffer, size_t stage)
+{
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, stages[stage].pipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &stages[stage].descriptorSet, 0, nullptr);
+  vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+  vkCmdDispatch(commandBuffer, (extent.width + TILE_SIZE - 1)/TILE_SIZE, (extent.height + TILE_SIZE - 1)/TILE_SIZE, 1);
+  frameStats->countPipelineBind();
+  frameStats->countDescriptorBind();
+  frameStats->countPushConstants();
+  frameStats->countDispatch();
+}
+
+void PostChain::recordBlit(VkCommandBuffer commandBuffer, VkImage source, VkImage target)
+{
+  VkImageBlit blit{};
+  blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  blit.srcSubresource.mipLevel = 0;
+  blit.srcSubresource.baseArrayLayer = 0;
+  blit.srcSubresource.layerCount = 1;
+  blit.srcOffsets[1] = {static_cast<int32_t>(extent.width), static_cast<int32_t>(extent.height), 1};
+  blit.dstSubresource = blit.srcSubresource;
+  blit.dstOffsets[1] = blit.srcOffsets[1];
+  vkCmdBlitImage(commandBuffer, source, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                 target, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_NEAREST);
+}
+
+void PostChain::destroy()
+{
+  if(stages.empty()) return;
+
+  for(auto &stage: stages)
+  {
+    vkDestroyPipeline(device, stage.pipeline, nullptr);
+  }
+  stages.clear();
+
+  vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+  vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+}
@@ -0,0 +1,424 @@
+#include "RenderGraph.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+const VkAccessFlags WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                                   VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+bool isDepthFormat(VkFormat format)
+{
+  return format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_D32_SFLOAT ||
+         format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
+
+}
+
+void RenderGraph::create(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice)
+{
+  physicalDevice = newPhysicalDevice;
+  device = newDevice;
+}
+
+void RenderGraph::destroy()
+{
+  reset();
+}
+
+void RenderGraph::reset()
+{
+  releaseImages();
+  resources.clear();
+  passes.clear();
+}
+
+RenderGraph::Resource RenderGraph::createImage(const std::string &name, VkFormat format, VkExtent2D extent)
+{
+  ImageResource resource;
+  resource.name = name;
+  resource.format = format;
+  resource.extent = extent;
+  resource.imported = false;
+  resource.aspect = isDepthFormat(format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+  resources.push_back(resource);
+  return static_cast<Resource>(resources.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::importImage(const std::string &name, VkFormat format)
+{
+  Resource resource = createImage(name, format, {0, 0});
+  resources[resource].imported = true;
+  return resource;
+}
+
+void RenderGraph::bindImage(Resource resource, VkImage image)
+{
+  resources[resource].image = image;
+}
+
+RenderGraph::Pass RenderGraph::addPass(const std::string &name, RecordFunction record)
+{
+  PassNode pass;
+  pass.name = name;
+  pass.record = record;
+  passes.push_back(pass);
+  return static_cast<Pass>(passes.size() - 1);
+}
+
+void RenderGraph::read(Pass pass, Resource resource, ImageUsage usage)
+{
+  declare(pass, resource, usage, false);
+}
+
+void RenderGraph::write(Pass pass, Resource resource, ImageUsage usage)
+{
+  if(usage == ImageUsage::Sampled || usage == ImageUsage::Present)
+  {
+    throw std::runtime_error("Render Graph pass " + passes[pass].name + " writes " + resources[resource].name + " through a read only usage!");
+  }
+  declare(pass, resource, usage, true);
+}
+
+void RenderGraph::declare(Pass pass, Resource resource, ImageUsage usage, bool write)
+{
+  // one layout per image and pass, a pass that needs two has to be split
+  for(const auto &declaration: passes[pass].declarations)
+  {
+    if(declaration.resource == resource)
+    {
+      throw std::runtime_error("Render Graph pass " + passes[pass].name + " uses " + resources[resource].name + " twice!");
+    }
+  }
+  passes[pass].declarations.push_back({resource, usage, write});
+}
+
+void RenderGraph::compile()
+{
+  releaseImages();
+  cullPasses();
+  allocateImages();
+  planBarriers();
+}
+
+void RenderGraph::cullPasses()
+{
+  // walking backwards every reader is decided before the writers it depends on. a pass is kept if it
+  // writes an imported image, writes something a kept pass reads, or writes nothing and is there for its side effect
+  std::vector<bool> needed(resources.size(), false);
+  for(size_t i = passes.size(); i-- > 0;)
+  {
+    PassNode &pass = passes[i];
+    bool writes = false;
+    bool used = false;
+    for(const auto &declaration: pass.declarations)
+    {
+      if(!declaration.write) continue;
+      writes = true;
+      used = used || resources[declaration.resource].imported || needed[declaration.resource];
+    }
+
+    pass.culled = writes && !used;
+    if(pass.culled) continue;
+
+    for(const auto &declaration: pass.declarations)
+    {
+      if(!declaration.write) needed[declaration.resource] = true;
+    }
+  }
+
+  for(Pass i=0; i<passes.size(); i++)
+  {
+    if(passes[i].culled) continue;
+    for(const auto &declaration: passes[i].declarations)
+    {
+      resources[declaration.resource].uses.push_back({i, declaration.usage, declaration.write});
+    }
+  }
+
+  // nothing to discard into, the contents would be whatever the memory held before
+  for(const auto &resource: resources)
+  {
+    if(!resource.uses.empty() && !resource.uses.front().write)
+    {
+      throw std::runtime_error("Render Graph reads " + resource.name + " before it is written!");
+    }
+  }
+}
+
+void RenderGraph::allocateImages()
+{
+  memoryStats = {};
+
+  std::vector<Resource> transient;
+  for(Resource i=0; i<resources.size(); i++)
+  {
+    ImageResource &resource = resources[i];
+    if(resource.imported || resource.uses.empty()) continue;
+
+    VkImageUsageFlags usage = 0;
+    for(const auto &use: resource.uses)
+    {
+      switch(use.usage)
+      {
+        case ImageUsage::ColorAttachment: usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; break;
+        case ImageUsage::DepthAttachment: usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT; break;
+        case ImageUsage::Sampled: usage |= VK_IMAGE_USAGE_SAMPLED_BIT; break;
+        case ImageUsage::Storage: usage |= VK_IMAGE_USAGE_STORAGE_BIT; break;
+        case ImageUsage::Transfer: usage |= use.write ? VK_IMAGE_USAGE_TRANSFER_DST_BIT : VK_IMAGE_USAGE_TRANSFER_SRC_BIT; break;
+        case ImageUsage::Present: throw std::runtime_error("Render Graph presents transient " + resource.name + "!");
+      }
+    }
+
+    VkImageCreateInfo imageCreateInfo{};
+    imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageCreateInfo.extent.width = resource.extent.width;
+    imageCreateInfo.extent.height = resource.extent.height;
+    imageCreateInfo.extent.depth = 1;
+    imageCreateInfo.mipLevels = 1;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.format = resource.format;
+    imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageCreateInfo.usage = usage;
+    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if(vkCreateImage(device, &imageCreateInfo, nullptr, &resource.image) != VK_SUCCESS)
+    {
+      throw std::runtime_error("Failed to create Render Graph Image " + resource.name + "!");
+    }
+    vkGetImageMemoryRequirements(device, resource.image, &resource.memoryRequirements);
+
+    transient.push_back(i);
+    memoryStats.requested += resource.memoryRequirements.size;
+  }
+
+  // largest first, each image goes into the first block whose images are all dead before it starts
+  // or born after it ends. every image sits at offset 0, so the alignment always holds
+  std::stable_sort(transient.begin(), transient.end(), [this](Resource a, Resource b){
+    return resources[a].memoryRequirements.size > resources[b].memoryRequirements.size;
+  });
+
+  auto overlaps = [this](Resource a, Resource b){
+    return resources[a].uses.front().pass <= resources[b].uses.back().pass &&
+           resources[b].uses.front().pass <= resources[a].uses.back().pass;
+  };
+
+  for(Resource index: transient)
+  {
+    ImageResource &resource = resources[index];
+
+    size_t blockIndex = 0;
+    for(; blockIndex<blocks.size(); blockIndex++)
+    {
+      const MemoryBlock &block = blocks[blockIndex];
+      if(!(block.memoryTypeBits & resource.memoryRequirements.memoryTypeBits)) continue;
+      bool free = std::none_of(block.resources.begin(), block.resources.end(),
+                               [&](Resource other){ return overlaps(index, other); });
+      if(free) break;
+    }
+    if(blockIndex == blocks.size())
+    {
+      blocks.emplace_back();
+    }
+
+    MemoryBlock &block = blocks[blockIndex];
+    block.memoryTypeBits &= resource.memoryRequirements.memoryTypeBits;
+    block.size = std::max(block.size, resource.memoryRequirements.size);
+    auto position = std::find_if(block.resources.begin(), block.resources.end(), [&](Resource other){
+      return resources[other].uses.front().pass > resource.uses.front().pass;
+    });
+    block.resources.insert(position, index);
+    resource.block = static_cast<int>(blockIndex);
+  }
+
+  for(auto &block: blocks)
+  {
+    VkMemoryAllocateInfo memoryAllocInfo{};
+    memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memoryAllocInfo.allocationSize = block.size;
+    memoryAllocInfo.memoryTypeIndex = findMemoryTypeIndex(physicalDevice, block.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    if(MemoryTracker::allocate(device, &memoryAllocInfo, MemoryCategory::Attachment, &block.memory) != VK_SUCCESS)
+    {
+      throw std::runtime_error("Failed to allocate Render Graph Memory!");
+    }
+    memoryStats.allocated += block.size;
+    memoryStats.allocations++;
+
+    for(Resource index: block.resources)
+    {
+      ImageResource &resource = resources[index];
+      vkBindImageMemory(device, resource.image, block.memory, 0);
+
+      VkImageViewCreateInfo viewCreateInfo{};
+      viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+      viewCreateInfo.image = resource.image;
+      viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+      viewCreateInfo.format = resource.format;
+      viewCreateInfo.subresourceRange.aspectMask = resource.aspect;
+      viewCreateInfo.subresourceRange.baseMipLevel = 0;
+      viewCreateInfo.subresourceRange.levelCount = 1;
+      viewCreateInfo.subresourceRange.baseArrayLayer = 0;
+      viewCreateInfo.subresourceRange.layerCount = 1;
+
+      if(vkCreateImageView(device, &viewCreateInfo, nullptr, &resource.view) != VK_SUCCESS)
+      {
+        throw std::runtime_error("Failed to create Render Graph Image View " + resource.name + "!");
+      }
+      memoryStats.images++;
+    }
+  }
+}
+
+void RenderGraph::planBarriers()
+{
+  for(auto &pass: passes)
+  {
+    pass.barriers.clear();
+  }
+
+  for(Resource index=0; index<resources.size(); index++)
+  {
+    const ImageResource &resource = resources[index];
+    for(size_t i=0; i<resource.uses.size(); i++)
+    {
+      const Use &use = resource.uses[i];
+      Access dst = useAccess(use.usage, use.write);
+      Access src{dst.stage, 0, VK_IMAGE_LAYOUT_UNDEFINED};
+
+      if(i > 0)
+      {
+        // reads in the same layout may overlap
+        const Use &previous = resource.uses[i - 1];
+        src = useAccess(previous.usage, previous.write);
+        if(!previous.write && !use.write && src.layout == dst.layout) continue;
+        src.access &= WRITE_ACCESS;
+      }
+      else if(!resource.imported)
+      {
+        // the contents are discarded, but whatever used the memory last has to be done with it. that is the
+        // image before in the same block, or the last one of the previous frame
+        const std::vector<Resource> &sharing = blocks[resource.block].resources;
+        auto position = std::find(sharing.begin(), sharing.end(), index);
+        Resource previousResource = position == sharing.begin() ? sharing.back() : *(position - 1);
+        const Use &previous = resources[previousResource].uses.back();
+        Access previousAccess = useAccess(previous.usage, previous.write);
+        src.stage = previousAccess.stage;
+        src.access = previousAccess.access & WRITE_ACCESS;
+      }
+      // an imported image is free once its owner says so, e.g. the acquire semaphore waits on this stage
+
+      passes[use.pass].barriers.push_back({index, src, dst});
+    }
+  }
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer, GpuProfiler *profiler)
+{
+  std::vector<VkImageMemoryBarrier> imageBarriers;
+  for(const auto &pass: passes)
+  {
+    if(pass.culled) continue;
+
+    // the zone includes the pass's barriers, a layout transition can cost as much as the pass
+    if(profiler) profiler->beginZone(commandBuffer, pass.name);
+
+    if(!pass.barriers.empty())
+    {
+      imageBarriers.clear();
+      VkPipelineStageFlags srcStages = 0;
+      VkPipelineStageFlags dstStages = 0;
+      for(const auto &barrier: pass.barriers)
+      {
+        const ImageResource &resource = resources[barrier.resource];
+        if(resource.image == VK_NULL_HANDLE)
+        {
+          throw std::runtime_error("Render Graph Image " + resource.name + " is not bound!");
+        }
+
+        VkImageMemoryBarrier imageBarrier{};
+        imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imageBarrier.srcAccessMask = barrier.src.access;
+        imageBarrier.dstAccessMask = barrier.dst.access;
+        imageBarrier.oldLayout = barrier.src.layout;
+        imageBarrier.newLayout = barrier.dst.layout;
+        imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.image = resource.image;
+        imageBarrier.subresourceRange.aspectMask = resource.aspect;
+        imageBarrier.subresourceRange.baseMipLevel = 0;
+        imageBarrier.subresourceRange.levelCount = 1;
+        imageBarrier.subresourceRange.baseArrayLayer = 0;
+        imageBarrier.subresourceRange.layerCount = 1;
+        imageBarriers.push_back(imageBarrier);
+
+        srcStages |= barrier.src.stage;
+        dstStages |= barrier.dst.stage;
+      }
+
+      vkCmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0, 0, nullptr, 0, nullptr,
+                           static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+    }
+
+    if(pass.record)
+    {
+      pass.record(commandBuffer);
+    }
+
+    if(profiler) profiler->endZone(commandBuffer);
+  }
+}
+
+VkPipelineStageFlags RenderGraph::getFirstStage(Resource resource)
+{
+  const ImageResource &image = resources[resource];
+  if(image.uses.empty()) return VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+  return useAccess(image.uses.front().usage, image.uses.front().write).stage;
+}
+
+RenderGraph::Access RenderGraph::useAccess(ImageUsage usage, bool write)
+{
+  Access access;
+  switch(usage)
+  {
+    case ImageUsage::ColorAttachment: access.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL; break;
+    case ImageUsage::DepthAttachment: access.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL; break;
+    case ImageUsage::Sampled: access.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL; break;
+    case ImageUsage::Storage: access.layout = VK_IMAGE_LAYOUT_GENERAL; break;
+    case ImageUsage::Transfer: access.layout = write ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL; break;
+    case ImageUsage::Present: access.layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; break;
+  }
+
+  layoutAccess(access.layout, &access.stage, &access.access);
+  if(!write)
+  {
+    access.access &= ~WRITE_ACCESS;
+  }
+  return access;
+}
+
+void RenderGraph::releaseImages()
+{
+  for(auto &resource: resources)
+  {
+    if(!resource.imported)
+    {
+      if(resource.view != VK_NULL_HANDLE) vkDestroyImageView(device, resource.view, nullptr);
+      if(resource.image != VK_NULL_HANDLE) vkDestroyImage(device, resource.image, nullptr);
+      resource.image = VK_NULL_HANDLE;
+    }
+    resource.view = VK_NULL_HANDLE;
+    resource.block = -1;
+    resource.uses.clear();
+  }
+
+  for(auto &block: blocks)
+  {
+    MemoryTracker::free(device, block.memory);
+  }
+  blocks.clear();
+}
@@ -0,0 +1,79 @@
+#include "RenderStats.h"
+
+#include <stdexcept>
+
+namespace {
+
+// results come back in the order of the bits
+const VkQueryPipelineStatisticFlags STATISTICS = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+                                                 VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+                                                 VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+                                                 VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+                                                 VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+const uint32_t STATISTIC_COUNT = 5;
+
+}
+
+void RenderStats::create(VkDevice newDevice, uint32_t frameCount, bool queries)
+{
+  device = newDevice;
+  frames.assign(frameCount, FrameQuery());
+  if(!queries) return;
+
+  VkQueryPoolCreateInfo queryPoolInfo{};
+  queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  queryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+  queryPoolInfo.queryCount = frameCount;
+  queryPoolInfo.pipelineStatistics = STATISTICS;
+
+  if(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS)
+  {
+    throw std::runtime_error("Failed to create Pipeline Statistics Query Pool!");
+  }
+}
+
+void RenderStats::destroy()
+{
+  if(queryPool != VK_NULL_HANDLE)
+  {
+    vkDestroyQueryPool(device, queryPool, nullptr);
+    queryPool = VK_NULL_HANDLE;
+  }
+  frames.clear();
+}
+
+void RenderStats::beginFrame(VkCommandBuffer commandBuffer, uint32_t frame, uint64_t frameIndex)
+{
+  recording = {};
+  recordingFrame = frame;
+  if(!hasPipelineStatistics()) return;
+
+  frames[frame].frameIndex = frameIndex;
+  frames[frame].recorded = true;
+  vkCmdResetQueryPool(commandBuffer, queryPool, frame, 1);
+  vkCmdBeginQuery(commandBuffer, queryPool, frame, 0);
+}
+
+void RenderStats::endFrame(VkCommandBuffer commandBuffer)
+{
+  counters = recording;
+  if(!hasPipelineStatistics()) return;
+
+  vkCmdEndQuery(commandBuffer, queryPool, recordingFrame);
+}
+
+void RenderStats::collect(uint32_t frame)
+{
+  if(!hasPipelineStatistics() || !frames[frame].recorded) return;
+
+  frames[frame].recorded = false;
+  uint64_t results[STATISTIC_COUNT];
+  VkResult result = vkGetQueryPoolResults(device, queryPool, frame, 1, sizeof(results), results, sizeof(results),
+                                          VK_QUERY_RESULT_64_BIT);
+  if(result != VK_SUCCESS) return;
+
+  // frames in flight may complete out of the order they are collected in
+  if(frames[frame].frameIndex < pipelineStatistics.frameIndex) return;
+
+  pipelineStatistics = {frames[frame].frameIndex, results[0], results[1], results[2], results[3], results[4]};
+}
@@ -0,0 +1,90 @@
+#include "SceneGraph.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+uint32_t SceneGraph::addNode(int32_t parent, const glm::mat4 &local, const std::string &name)
+{
+  uint32_t node = static_cast<uint32_t>(parents.size());
+  if(parent != NO_PARENT && (parent < 0 || static_cast<uint32_t>(parent) >= node || subtreeEnds[parent] != node))
+  {
+    throw std::runtime_error("Failed to add Scene Node, parent is not on the current path!");
+  }
+
+  // the new node extends the subtree of every ancestor
+  for(int32_t ancestor = parent; ancestor != NO_PARENT; ancestor = parents[ancestor])
+  {
+    subtreeEnds[ancestor] = node + 1;
+  }
+
+  parents.push_back(parent);
+  subtreeEnds.push_back(node + 1);
+  locals.push_back(local);
+  worlds.push_back(local);
+  dirty.push_back(1);
+  names.push_back(name);
+  firstDirty = std::min(firstDirty, node);
+  return node;
+}
+
+int32_t SceneGraph::findNode(const std::string &name)
+{
+  auto found = std::find(names.begin(), names.end(), name);
+  return found == names.end() ? -1 : static_cast<int32_t>(found - names.begin());
+}
+
+void SceneGraph::setRoot(const glm::mat4 &transform)
+{
+  root = transform;
+  // top level nodes are the ones whose subtree starts a new range
+  for(uint32_t node = 0; node < parents.size(); node = subtreeEnds[node])
+  {
+    dirty[node] = 1;
+  }
+  firstDirty = 0;
+}
+
+void SceneGraph::setFlatRoot(const glm::mat4 &transform)
+{
+  root = transform;
+  worlds[0] = transform*locals[0];
+  dirty[0] = 0;
+  firstDirty = static_cast<uint32_t>(parents.size());
+}
+
+void SceneGraph::setLocal(uint32_t node, const glm::mat4 &local)
+{
+  locals[node] = local;
+  dirty[node] = 1;
+  firstDirty = std::min(firstDirty, node);
+}
+
+bool SceneGraph::update(std::vector<uint32_t> *changedNodes)
+{
+  uint32_t nodeCount = static_cast<uint32_t>(parents.size());
+  if(firstDirty >= nodeCount) return false;
+
+  uint32_t node = firstDirty;
+  while(node < nodeCount)
+  {
+    if(!dirty[node])
+    {
+      node++;
+      continue;
+    }
+
+    // parents come first, so the whole subtree can be recomputed front to back
+    uint32_t end = subtreeEnds[node];
+    for(uint32_t i = node; i < end; i++)
+    {
+      const glm::mat4 &parentWorld = parents[i] == NO_PARENT ? root : worlds[parents[i]];
+      worlds[i] = parentWorld*locals[i];
+      dirty[i] = 0;
+      changedNodes->push_back(i);
+    }
+    node = end;
+  }
+
+  firstDirty = nodeCount;
+  return true;
+}
@@ -0,0 +1,279 @@
+#include "ShaderLibrary.h"
+#include "Utilities.h"
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef VKDEMO_SHADERC
+#include <shaderc/shaderc.h>
+#endif
+
+namespace {
+
+#ifdef VKDEMO_SHADERC
+const bool RUNTIME_COMPILER = true;
+#else
+const bool RUNTIME_COMPILER = false;
+#endif
+
+// bump when the compile options change so stale modules are not picked up from the cache
+const uint32_t SHADER_CACHE_VERSION = 1;
+
+bool readSpirv(const std::string &fileName, std::vector<uint32_t> *code)
+{
+  std::vector<char> bytes;
+  try {
+    bytes = readFile(fileName);
+  }
+  catch (const std::runtime_error &) {
+    return false;
+  }
+
+  if(bytes.size() < 20 || bytes.size() % sizeof(uint32_t) != 0) return false;
+
+  code->resize(bytes.size()/sizeof(uint32_t));
+  memcpy(code->data(), bytes.data(), bytes.size());
+  return (*code)[0] == 0x07230203;
+}
+
+std::filesystem::file_time_type modifiedTime(const std::string &fileName)
+{
+  std::error_code error;
+  std::filesystem::file_time_type time = std::filesystem::last_write_time(fileName, error);
+  return error ? std::filesystem::file_time_type::min() : time;
+}
+
+}
+
+void ShaderLibrary::create(const std::string &newCacheDirectory)
+{
+  cacheDirectory = newCacheDirectory;
+  stopping = false;
+
+  if(RUNTIME_COMPILER)
+  {
+    std::error_code error;
+    std::filesystem::create_directories(cacheDirectory, error);
+  }
+}
+
+void ShaderLibrary::destroy()
+{
+  {
+    std::lock_guard<std::mutex> lock(shaderMutex);
+    stopping = true;
+  }
+  stopSignal.notify_all();
+
+  if(watcher.joinable())
+  {
+    watcher.join();
+  }
+
+  shaders.clear();
+  changed.clear();
+}
+
+void ShaderLibrary::add(const std::string &name, const std::string &sourceFile, const std::vector<std::string> &defines)
+{
+  // a source that does not compile at startup falls back to the module from the build
+  Shader shader;
+  shader.sourceFile = sourceFile;
+  shader.defines = defines;
+  if(!compile(sourceFile, defines, &shader.code) && !readSpirv(name, &shader.code))
+  {
+    throw std::runtime_error("Failed to load Shader " + name + "!");
+  }
+  shader.reflection.parse(shader.code);
+  shader.watchedTime = modifiedTime(watchedFile(name, shader));
+
+  std::lock_guard<std::mutex> lock(shaderMutex);
+  shaders[name] = std::move(shader);
+}
+
+std::vector<uint32_t> ShaderLibrary::getCode(const std::string &name)
+{
+  std::lock_guard<std::mutex> lock(shaderMutex);
+  auto found = shaders.find(name);
+  if(found == shaders.end())
+  {
+    throw std::runtime_error("Unknown Shader " + name + "!");
+  }
+  return found->second.code;
+}
+
+SpirvReflection ShaderLibrary::getReflection(const std::string &name)
+{
+  std::lock_guard<std::mutex> lock(shaderMutex);
+  auto found = shaders.find(name);
+  if(found == shaders.end())
+  {
+    throw std::runtime_error("Unknown Shader " + name + "!");
+  }
+  return found->second.reflection;
+}
+
+void ShaderLibrary::startWatching(uint32_t intervalMs)
+{
+  if(watcher.joinable()) return;
+  watcher = std::thread(&ShaderLibrary::watchLoop, this, intervalMs);
+}
+
+std::vector<std::string> ShaderLibrary::takeChanged()
+{
+  std::lock_guard<std::mutex> lock(shaderMutex);
+  std::vector<std::string> result;
+  result.swap(changed);
+  return result;
+}
+
+std::string ShaderLibrary::watchedFile(const std::string &name, const Shader &shader)
+{
+  // without a compiler the modules are rebuilt by compile.sh, follow those instead of the source
+  return RUNTIME_COMPILER ? shader.sourceFile : name;
+}
+
+void ShaderLibrary::watchLoop(uint32_t intervalMs)
+{
+  while(true)
+  {
+    struct Candidate {
+      std::string name;
+      std::string file;
+      std::string sourceFile;
+      std::vector<std::string> defines;
+    };
+    std::vector<Candidate> candidates;
+    {
+      std::unique_lock<std::mutex> lock(shaderMutex);
+      if(stopSignal.wait_for(lock, std::chrono::milliseconds(intervalMs), [this]{ return stopping; })) return;
+
+      for(auto &shader: shaders)
+      {
+        std::string file = watchedFile(shader.first, shader.second);
+        std::filesystem::file_time_type time = modifiedTime(file);
+        if(time == shader.second.watchedTime) continue;
+
+        // a broken edit is reported once, not on every poll
+        shader.second.watchedTime = time;
+        candidates.push_back({shader.first, file, shader.second.sourceFile, shader.second.defines});
+      }
+    }
+
+    for(const auto &candidate: candidates)
+    {
+      std::vector<uint32_t> code;
+      bool loaded = RUNTIME_COMPILER ? compile(candidate.sourceFile, candidate.defines, &code) : readSpirv(candidate.file, &code);
+      if(!loaded) continue;
+
+      SpirvReflection reflection;
+      try {
+        reflection.parse(code);
+      }
+      catch (const std::runtime_error &e) {
+        printf("ERROR: %s\n", e.what());
+        continue;
+      }
+
+      std::lock_guard<std::mutex> lock(shaderMutex);
+      Shader &shader = shaders[candidate.name];
+
+      // set layouts are shared between pipelines and live as long as the renderer
+      if(!reflection.sameInterface(shader.reflection))
+      {
+        printf("ERROR: %s changed its descriptor bindings or push constants, restart to pick it up\n", candidate.name.c_str());
+        continue;
+      }
+
+      shader.code = std::move(code);
+      if(std::find(changed.begin(), changed.end(), candidate.name) == changed.end())
+      {
+        changed.push_back(candidate.name);
+      }
+    }
+  }
+}
+
+bool ShaderLibrary::compile(const std::string &sourceFile, const std::vector<std::string> &defines, std::vector<uint32_t> *code)
+{
+#ifdef VKDEMO_SHADERC
+  std::vector<char> source;
+  try {
+    source = readFile(sourceFile);
+  }
+  catch (const std::runtime_error &) {
+    return false;
+  }
+
+  std::string extension = std::filesystem::path(sourceFile).extension().string();
+  shaderc_shader_kind kind;
+  if(extension == ".vert") kind = shaderc_glsl_vertex_shader;
+  else if(extension == ".frag") kind = shaderc_glsl_fragment_shader;
+  else if(extension == ".comp") kind = shaderc_glsl_compute_shader;
+  else
+  {
+    printf("ERROR: unknown shader stage for %s\n", sourceFile.c_str());
+    return false;
+  }
+
+  // the shaders have no #include, the source text and the defines decide the module
+  uint64_t hash = HASH_SEED;
+  hashBytes(&hash, &SHADER_CACHE_VERSION, sizeof(SHADER_CACHE_VERSION));
+  hashBytes(&hash, &kind, sizeof(kind));
+  hashBytes(&hash, source.data(), source.size());
+  for(const auto &define: defines)
+  {
+    hashBytes(&hash, define.c_str(), define.size() + 1);
+  }
+
+  char hashName[17];
+  snprintf(hashName, sizeof(hashName), "%016llx", static_cast<unsigned long long>(hash));
+  std::string cacheFile = cacheDirectory + "/" + hashName + ".spv";
+  if(readSpirv(cacheFile, code)) return true;
+
+  shaderc_compiler_t compiler = shaderc_compiler_initialize();
+  shaderc_compile_options_t options = shaderc_compile_options_initialize();
+  shaderc_compile_options_set_target_env(options, shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_2);
+  for(const auto &define: defines)
+  {
+    shaderc_compile_options_add_macro_definition(options, define.c_str(), define.size(), nullptr, 0);
+  }
+
+  shaderc_compilation_result_t result = shaderc_compile_into_spv(compiler, source.data(), source.size(), kind,
+                                                                 sourceFile.c_str(), "main", options);
+
+  bool compiled = shaderc_result_get_compilation_status(result) == shaderc_compilation_status_success;
+  if(compiled)
+  {
+    const char *bytes = shaderc_result_get_bytes(result);
+    size_t size = shaderc_result_get_length(result);
+    code->resize(size/sizeof(uint32_t));
+    memcpy(code->data(), bytes, size);
+
+    // written aside and renamed so a concurrent reader never sees half a module
+    std::string tempFile = cacheFile + ".tmp";
+    std::ofstream file(tempFile, std::ios::binary | std::ios::trunc);
+    file.write(bytes, size);
+    file.close();
+    if(file.good())
+    {
+      std::rename(tempFile.c_str(), cacheFile.c_str());
+    }
+  }
+  else
+  {
+    printf("ERROR: %s", shaderc_result_get_error_message(result));
+  }
+
+  shaderc_result_release(result);
+  shaderc_compile_options_release(options);
+  shaderc_compiler_release(compiler);
+  return compiled;
+#else
+  return false;
+#endif
+}
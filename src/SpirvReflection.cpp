@@ -0,0 +1,332 @@
+#include "SpirvReflection.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+const uint32_t SPIRV_MAGIC = 0x07230203;
+
+// opcodes
+const uint32_t OP_ENTRY_POINT = 15;
+const uint32_t OP_TYPE_INT = 21;
+const uint32_t OP_TYPE_FLOAT = 22;
+const uint32_t OP_TYPE_VECTOR = 23;
+const uint32_t OP_TYPE_MATRIX = 24;
+const uint32_t OP_TYPE_IMAGE = 25;
+const uint32_t OP_TYPE_SAMPLER = 26;
+const uint32_t OP_TYPE_SAMPLED_IMAGE = 27;
+const uint32_t OP_TYPE_ARRAY = 28;
+const uint32_t OP_TYPE_RUNTIME_ARRAY = 29;
+const uint32_t OP_TYPE_STRUCT = 30;
+const uint32_t OP_TYPE_POINTER = 32;
+const uint32_t OP_CONSTANT = 43;
+const uint32_t OP_SPEC_CONSTANT = 50;
+const uint32_t OP_VARIABLE = 59;
+const uint32_t OP_DECORATE = 71;
+const uint32_t OP_MEMBER_DECORATE = 72;
+
+// decorations
+const uint32_t DECORATION_BLOCK = 2;
+const uint32_t DECORATION_BUFFER_BLOCK = 3;
+const uint32_t DECORATION_ARRAY_STRIDE = 6;
+const uint32_t DECORATION_MATRIX_STRIDE = 7;
+const uint32_t DECORATION_BINDING = 33;
+const uint32_t DECORATION_DESCRIPTOR_SET = 34;
+const uint32_t DECORATION_OFFSET = 35;
+
+// storage classes
+const uint32_t STORAGE_UNIFORM_CONSTANT = 0;
+const uint32_t STORAGE_UNIFORM = 2;
+const uint32_t STORAGE_PUSH_CONSTANT = 9;
+const uint32_t STORAGE_STORAGE_BUFFER = 12;
+
+// image dimensions
+const uint32_t DIM_BUFFER = 5;
+const uint32_t DIM_SUBPASS_DATA = 6;
+
+VkShaderStageFlagBits executionModelStage(uint32_t executionModel)
+{
+  switch(executionModel)
+  {
+    case 0: return VK_SHADER_STAGE_VERTEX_BIT;
+    case 1: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+    case 2: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+    case 3: return VK_SHADER_STAGE_GEOMETRY_BIT;
+    case 4: return VK_SHADER_STAGE_FRAGMENT_BIT;
+    case 5: return VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+  throw std::runtime_error("Unsupported SPIR-V Execution Model!");
+}
+
+}
+
+void SpirvReflection::parse(const std::vector<uint32_t> &code)
+{
+  if(code.size() < 5 || code[0] != SPIRV_MAGIC)
+  {
+    throw std::runtime_error("Failed to reflect Shader, not a SPIR-V module!");
+  }
+
+  struct Variable {
+    uint32_t id;
+    uint32_t pointerType;
+    uint32_t storageClass;
+  };
+  std::vector<Variable> variables;
+
+  bindings.clear();
+  pushConstantSize = 0;
+  types.clear();
+  constants.clear();
+  decorations.clear();
+  members.clear();
+
+  size_t word = 5;
+  while(word < code.size())
+  {
+    uint32_t opcode = code[word] & 0xffff;
+    uint32_t wordCount = code[word] >> 16;
+    if(wordCount == 0 || word + wordCount > code.size())
+    {
+      throw std::runtime_error("Failed to reflect Shader, truncated SPIR-V instruction!");
+    }
+    const uint32_t *operands = code.data() + word + 1;
+
+    switch(opcode)
+    {
+      case OP_ENTRY_POINT:
+        stage = executionModelStage(operands[0]);
+        break;
+
+      case OP_DECORATE:
+      {
+        Decorations &target = decorations[operands[0]];
+        if(operands[1] == DECORATION_DESCRIPTOR_SET) target.set = operands[2];
+        else if(operands[1] == DECORATION_BINDING) target.binding = operands[2];
+        else if(operands[1] == DECORATION_BLOCK) target.block = true;
+        else if(operands[1] == DECORATION_BUFFER_BLOCK) target.bufferBlock = true;
+        else if(operands[1] == DECORATION_ARRAY_STRIDE) target.arrayStride = operands[2];
+        break;
+      }
+
+      case OP_MEMBER_DECORATE:
+      {
+        std::vector<MemberLayout> &layout = members[operands[0]];
+        if(layout.size() <= operands[1]) layout.resize(operands[1] + 1);
+        if(operands[2] == DECORATION_OFFSET) layout[operands[1]].offset = operands[3];
+        else if(operands[2] == DECORATION_MATRIX_STRIDE) layout[operands[1]].matrixStride = operands[3];
+        break;
+      }
+
+      case OP_TYPE_INT:
+      case OP_TYPE_FLOAT:
+      case OP_TYPE_VECTOR:
+      case OP_TYPE_MATRIX:
+      case OP_TYPE_IMAGE:
+      case OP_TYPE_SAMPLER:
+      case OP_TYPE_SAMPLED_IMAGE:
+      case OP_TYPE_ARRAY:
+      case OP_TYPE_RUNTIME_ARRAY:
+      case OP_TYPE_STRUCT:
+      case OP_TYPE_POINTER:
+      {
+        std::vector<uint32_t> &type = types[operands[0]];
+        type.push_back(opcode);
+        type.insert(type.end(), operands, operands + wordCount - 1);
+        break;
+      }
+
+      // array sizes, a specialization constant counts with its default
+      case OP_CONSTANT:
+      case OP_SPEC_CONSTANT:
+        constants[operands[1]] = operands[2];
+        break;
+
+      case OP_VARIABLE:
+        variables.push_back({operands[1], operands[0], operands[2]});
+        break;
+    }
+
+    word += wordCount;
+  }
+
+  for(const auto &variable: variables)
+  {
+    if(types.count(variable.pointerType) == 0)
+    {
+      throw std::runtime_error("Failed to reflect Shader, variable of unknown type!");
+    }
+    uint32_t pointee = types[variable.pointerType][3];
+
+    if(variable.storageClass == STORAGE_PUSH_CONSTANT)
+    {
+      pushConstantSize = std::max(pushConstantSize, typeSize(pointee, 0));
+      continue;
+    }
+
+    if(variable.storageClass != STORAGE_UNIFORM_CONSTANT && variable.storageClass != STORAGE_UNIFORM &&
+       variable.storageClass != STORAGE_STORAGE_BUFFER)
+    {
+      continue;
+    }
+
+    // arrays of descriptors, runtime sized ones are bound as a single descriptor
+    uint32_t count = 1;
+    while(types[pointee][0] == OP_TYPE_ARRAY || types[pointee][0] == OP_TYPE_RUNTIME_ARRAY)
+    {
+      if(types[pointee][0] == OP_TYPE_ARRAY) count *= constants[types[pointee][3]];
+      pointee = types[pointee][2];
+    }
+
+    Binding binding{};
+    binding.set = decorations[variable.id].set;
+    binding.layoutBinding.binding = decorations[variable.id].binding;
+    binding.layoutBinding.descriptorType = descriptorType(pointee, variable.storageClass);
+    binding.layoutBinding.descriptorCount = count;
+    binding.layoutBinding.stageFlags = stage;
+    binding.layoutBinding.pImmutableSamplers = nullptr;
+    bindings.push_back(binding);
+  }
+
+  std::sort(bindings.begin(), bindings.end(), [](const Binding &a, const Binding &b){
+    return a.set != b.set ? a.set < b.set : a.layoutBinding.binding < b.layoutBinding.binding;
+  });
+
+  // the ids are only meaningful while parsing
+  types.clear();
+  constants.clear();
+  decorations.clear();
+  members.clear();
+}
+
+VkDescriptorType SpirvReflection::descriptorType(uint32_t typeId, uint32_t storageClass)
+{
+  const std::vector<uint32_t> &type = types[typeId];
+  switch(type[0])
+  {
+    case OP_TYPE_SAMPLED_IMAGE:
+      return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+    case OP_TYPE_SAMPLER:
+      return VK_DESCRIPTOR_TYPE_SAMPLER;
+
+    case OP_TYPE_IMAGE:
+    {
+      // {opcode, result, sampled type, dim, depth, arrayed, ms, sampled}
+      uint32_t dim = type[3];
+      uint32_t sampled = type[7];
+      if(dim == DIM_SUBPASS_DATA) return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+      if(dim == DIM_BUFFER) return sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+      return sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    }
+
+    case OP_TYPE_STRUCT:
+      // pre 1.3 SPIR-V marks storage buffers as BufferBlock in the Uniform storage class
+      if(storageClass == STORAGE_STORAGE_BUFFER || decorations[typeId].bufferBlock)
+      {
+        return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      }
+      return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  }
+  throw std::runtime_error("Failed to reflect Shader, unsupported descriptor type!");
+}
+
+uint32_t SpirvReflection::typeSize(uint32_t typeId, uint32_t matrixStride)
+{
+  const std::vector<uint32_t> &type = types[typeId];
+  switch(type[0])
+  {
+    case OP_TYPE_INT:
+    case OP_TYPE_FLOAT:
+      return type[2]/8;
+
+    case OP_TYPE_VECTOR:
+      return type[3]*typeSize(type[2], 0);
+
+    case OP_TYPE_MATRIX:
+      return type[3]*(matrixStride ? matrixStride : typeSize(type[2], 0));
+
+    case OP_TYPE_ARRAY:
+      return constants[type[3]]*decorations[typeId].arrayStride;
+
+    case OP_TYPE_STRUCT:
+    {
+      // members are laid out by their explicit offsets, the block ends after the furthest one
+      const std::vector<MemberLayout> &layout = members[typeId];
+      uint32_t size = 0;
+      for(size_t i=2; i<type.size(); i++)
+      {
+        MemberLayout member = i - 2 < layout.size() ? layout[i - 2] : MemberLayout{};
+        size = std::max(size, member.offset + typeSize(type[i], member.matrixStride));
+      }
+      return size;
+    }
+  }
+  return 0;
+}
+
+bool SpirvReflection::sameInterface(const SpirvReflection &other) const
+{
+  if(stage != other.stage || pushConstantSize != other.pushConstantSize || bindings.size() != other.bindings.size())
+  {
+    return false;
+  }
+
+  for(size_t i=0; i<bindings.size(); i++)
+  {
+    const Binding &a = bindings[i];
+    const Binding &b = other.bindings[i];
+    if(a.set != b.set || a.layoutBinding.binding != b.layoutBinding.binding ||
+       a.layoutBinding.descriptorType != b.layoutBinding.descriptorType ||
+       a.layoutBinding.descriptorCount != b.layoutBinding.descriptorCount)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<VkDescriptorSetLayoutBinding> SpirvReflection::mergeSet(const std::vector<SpirvReflection> &stages, uint32_t set)
+{
+  std::vector<VkDescriptorSetLayoutBinding> merged;
+  for(const auto &reflection: stages)
+  {
+    for(const auto &binding: reflection.bindings)
+    {
+      if(binding.set != set) continue;
+
+      auto existing = std::find_if(merged.begin(), merged.end(), [&](const VkDescriptorSetLayoutBinding &b){
+        return b.binding == binding.layoutBinding.binding;
+      });
+      if(existing == merged.end())
+      {
+        merged.push_back(binding.layoutBinding);
+      }
+      else if(existing->descriptorType != binding.layoutBinding.descriptorType)
+      {
+        throw std::runtime_error("Shader Stages disagree on a Descriptor Binding!");
+      }
+      else
+      {
+        existing->stageFlags |= binding.layoutBinding.stageFlags;
+      }
+    }
+  }
+  return merged;
+}
+
+std::vector<VkPushConstantRange> SpirvReflection::mergePushConstants(const std::vector<SpirvReflection> &stages)
+{
+  // one range visible to every stage that declares the block
+  VkPushConstantRange range{};
+  for(const auto &reflection: stages)
+  {
+    if(reflection.pushConstantSize == 0) continue;
+    range.stageFlags |= reflection.stage;
+    range.size = std::max(range.size, reflection.pushConstantSize);
+  }
+
+  if(range.size == 0) return {};
+  return {range};
+}
@@ -0,0 +1,356 @@
+#include "TransformBuffer.h"
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <immintrin.h>
+#define TRANSFORM_SIMD
+#endif
+
+namespace {
+
+// the columns of a single instance, the same math as the lanes below
+void composeScalar(uint32_t instance, uint32_t capacity, const glm::vec3 &p, const glm::quat &q, const glm::vec3 &s,
+                   glm::vec4 *columns)
+{
+  float xx = q.x*q.x, yy = q.y*q.y, zz = q.z*q.z;
+  float xy = q.x*q.y, xz = q.x*q.z, yz = q.y*q.z;
+  float wx = q.w*q.x, wy = q.w*q.y, wz = q.w*q.z;
+
+  columns[instance] = glm::vec4((1.0f - 2.0f*(yy + zz))*s.x, 2.0f*(xy + wz)*s.x, 2.0f*(xz - wy)*s.x, 0.0f);
+  columns[capacity + instance] = glm::vec4(2.0f*(xy - wz)*s.y, (1.0f - 2.0f*(xx + zz))*s.y, 2.0f*(yz + wx)*s.y, 0.0f);
+  columns[2*capacity + instance] = glm::vec4(2.0f*(xz + wy)*s.z, 2.0f*(yz - wx)*s.z, (1.0f - 2.0f*(xx + yy))*s.z, 0.0f);
+  columns[3*capacity + instance] = glm::vec4(p.x, p.y, p.z, 1.0f);
+}
+
+#ifdef TRANSFORM_SIMD
+
+// four instances at a time, each register holds one component of all four. the transpose turns the
+// x, y, z, w registers of a column into the four instances' vec4s, which lie next to each other
+uint32_t composeSse(uint32_t first, uint32_t count, uint32_t capacity, const glm::vec3 *p, const glm::quat *q,
+                    const glm::vec3 *s, float *columns)
+{
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 two = _mm_set1_ps(2.0f);
+  const __m128 zero = _mm_setzero_ps();
+
+  uint32_t i = 0;
+  for(; i + 4 <= count; i += 4)
+  {
+    __m128 qx = _mm_set_ps(q[i + 3].x, q[i + 2].x, q[i + 1].x, q[i].x);
+    __m128 qy = _mm_set_ps(q[i + 3].y, q[i + 2].y, q[i + 1].y, q[i].y);
+    __m128 qz = _mm_set_ps(q[i + 3].z, q[i + 2].z, q[i + 1].z, q[i].z);
+    __m128 qw = _mm_set_ps(q[i + 3].w, q[i + 2].w, q[i + 1].w, q[i].w);
+    __m128 sx = _mm_set_ps(s[i + 3].x, s[i + 2].x, s[i + 1].x, s[i].x);
+    __m128 sy = _mm_set_ps(s[i + 3].y, s[i + 2].y, s[i + 1].y, s[i].y);
+    __m128 sz = _mm_set_ps(s[i + 3].z, s[i + 2].z, s[i + 1].z, s[i].z);
+
+    __m128 xx = _mm_mul_ps(qx, qx), yy = _mm_mul_ps(qy, qy), zz = _mm_mul_ps(qz, qz);
+    __m128 xy = _mm_mul_ps(qx, qy), xz = _mm_mul_ps(qx, qz), yz = _mm_mul_ps(qy, qz);
+    __m128 wx = _mm_mul_ps(qw, qx), wy = _mm_mul_ps(qw, qy), wz = _mm_mul_ps(qw, qz);
+
+    __m128 rows[4][4] = {
+      {_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx),
+       _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx),
+       _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx), zero},
+      {_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy),
+       _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy),
+       _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy), zero},
+      {_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz),
+       _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz),
+       _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz), zero},
+      {_mm_set_ps(p[i + 3].x, p[i + 2].x, p[i + 1].x, p[i].x),
+       _mm_set_ps(p[i + 3].y, p[i + 2].y, p[i + 1].y, p[i].y),
+       _mm_set_ps(p[i + 3].z, p[i + 2].z, p[i + 1].z, p[i].z), one}
+    };
+
+    for(uint32_t c=0; c<4; c++)
+    {
+      _MM_TRANSPOSE4_PS(rows[c][0], rows[c][1], rows[c][2], rows[c][3]);
+      float *column = columns + 4*(c*capacity + first + i);
+      _mm_storeu_ps(column, rows[c][0]);
+      _mm_storeu_ps(column + 4, rows[c][1]);
+      _mm_storeu_ps(column + 8, rows[c][2]);
+      _mm_storeu_ps(column + 12, rows[c][3]);
+    }
+  }
+  return i;
+}
+
+// eight instances at a time, the transpose works per 128 bit half and the halves are swapped in at the end
+__attribute__((target("avx2")))
+uint32_t composeAvx2(uint32_t first, uint32_t count, uint32_t capacity, const glm::vec3 *p, const glm::quat *q,
+                     const glm::vec3 *s, float *columns)
+{
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 two = _mm256_set1_ps(2.0f);
+  const __m256 zero = _mm256_setzero_ps();
+
+  uint32_t i = 0;
+  for(; i + 8 <= count; i += 8)
+  {
+    const glm::quat *qi = q + i;
+    const glm::vec3 *si = s + i;
+    const glm::vec3 *pi = p + i;
+    __m256 qx = _mm256_set_ps(qi[7].x, qi[6].x, qi[5].x, qi[4].x, qi[3].x, qi[2].x, qi[1].x, qi[0].x);
+    __m256 qy = _mm256_set_ps(qi[7].y, qi[6].y, qi[5].y, qi[4].y, qi[3].y, qi[2].y, qi[1].y, qi[0].y);
+    __m256 qz = _mm256_set_ps(qi[7].z, qi[6].z, qi[5].z, qi[4].z, qi[3].z, qi[2].z, qi[1].z, qi[0].z);
+    __m256 qw = _mm256_set_ps(qi[7].w, qi[6].w, qi[5].w, qi[4].w, qi[3].w, qi[2].w, qi[1].w, qi[0].w);
+    __m256 sx = _mm256_set_ps(si[7].x, si[6].x, si[5].x, si[4].x, si[3].x, si[2].x, si[1].x, si[0].x);
+    __m256 sy = _mm256_set_ps(si[7].y, si[6].y, si[5].y, si[4].y, si[3].y, si[2].y, si[1].y, si[0].y);
+    __m256 sz = _mm256_set_ps(si[7].z, si[6].z, si[5].z, si[4].z, si[3].z, si[2].z, si[1].z, si[0].z);
+
+    __m256 xx = _mm256_mul_ps(qx, qx), yy = _mm256_mul_ps(qy, qy), zz = _mm256_mul_ps(qz, qz);
+    __m256 xy = _mm256_mul_ps(qx, qy), xz = _mm256_mul_ps(qx, qz), yz = _mm256_mul_ps(qy, qz);
+    __m256 wx = _mm256_mul_ps(qw, qx), wy = _mm256_mul_ps(qw, qy), wz = _mm256_mul_ps(qw, qz);
+
+    __m256 rows[4][4] = {
+      {_mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(yy, zz))), sx),
+       _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xy, wz)), sx),
+       _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xz, wy)), sx), zero},
+      {_mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(xy, wz)), sy),
+       _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, zz))), sy),
+       _mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(yz, wx)), sy), zero},
+      {_mm256_mul_ps(_mm256_mul_ps(two, _mm256_add_ps(xz, wy)), sz),
+       _mm256_mul_ps(_mm256_mul_ps(two, _mm256_sub_ps(yz, wx)), sz),
+       _mm256_mul_ps(_mm256_sub_ps(one, _mm256_mul_ps(two, _mm256_add_ps(xx, yy))), sz), zero},
+      {_mm256_set_ps(pi[7].x, pi[6].x, pi[5].x, pi[4].x, pi[3].x, pi[2].x, pi[1].x, pi[0].x),
+       _mm256_set_ps(pi[7].y, pi[6].y, pi[5].y, pi[4].y, pi[3].y, pi[2].y, pi[1].y, pi[0].y),
+       _mm256_set_ps(pi[7].z, pi[6].z, pi[5].z, pi[4].z, pi[3].z, pi[2].z, pi[1].z, pi[0].z), one}
+    };
+
+    for(uint32_t c=0; c<4; c++)
+    {
+      __m256 t0 = _mm256_unpacklo_ps(rows[c][0], rows[c][1]);
+      __m256 t1 = _mm256_unpackhi_ps(rows[c][0], rows[c][1]);
+      __m256 t2 = _mm256_unpacklo_ps(rows[c][2], rows[c][3]);
+      __m256 t3 = _mm256_unpackhi_ps(rows[c][2], rows[c][3]);
+      // instance 0|4, 1|5, 2|6 and 3|7 in the low|high halves
+      __m256 v0 = _mm256_shuffle_ps(t0, t2, 0x44);
+      __m256 v1 = _mm256_shuffle_ps(t0, t2, 0xee);
+      __m256 v2 = _mm256_shuffle_ps(t1, t3, 0x44);
+      __m256 v3 = _mm256_shuffle_ps(t1, t3, 0xee);
+
+      float *column = columns + 4*(c*capacity + first + i);
+      _mm256_storeu_ps(column, _mm256_permute2f128_ps(v0, v1, 0x20));
+      _mm256_storeu_ps(column + 8, _mm256_permute2f128_ps(v2, v3, 0x20));
+      _mm256_storeu_ps(column + 16, _mm256_permute2f128_ps(v0, v1, 0x31));
+      _mm256_storeu_ps(column + 24, _mm256_permute2f128_ps(v2, v3, 0x31));
+    }
+  }
+  return i;
+}
+
+bool hasAvx2()
+{
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+
+#endif
+
+}
+
+void TransformBuffer::create(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, uint32_t newCapacity, uint32_t frameCount)
+{
+  physicalDevice = newPhysicalDevice;
+  device = newDevice;
+  capacity = newCapacity;
+
+  columns.assign(4*capacity, glm::vec4(0.0f));
+  for(uint32_t i=0; i<capacity; i++)
+  {
+    for(uint32_t c=0; c<4; c++)
+    {
+      columns[c*capacity + i][c] = 1.0f;
+    }
+  }
+
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+  nonCoherentAtomSize = deviceProperties.limits.nonCoherentAtomSize;
+
+  frames.resize(frameCount);
+  for(auto &frame: frames)
+  {
+    createBuffer(physicalDevice, device, getBufferSize(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, MemoryCategory::Uniform, &frame.buffer, &frame.memory);
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, frame.buffer, &memRequirements);
+    frame.allocationSize = memRequirements.size;
+
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+    uint32_t typeIndex = findMemoryTypeIndex(physicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    coherent = memoryProperties.memoryTypes[typeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    void *data;
+    if(vkMapMemory(device, frame.memory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS)
+    {
+      throw std::runtime_error("Failed to map Transform Buffer!");
+    }
+    frame.mapped = static_cast<glm::vec4*>(data);
+
+    // every slot starts out needing the full identity upload
+    frame.dirtyBegin = 0;
+    frame.dirtyEnd = capacity;
+  }
+}
+
+uint32_t TransformBuffer::allocate(uint32_t count)
+{
+  for(size_t i=0; i<freeRanges.size(); i++)
+  {
+    if(freeRanges[i].count < count) continue;
+
+    uint32_t first = freeRanges[i].first;
+    freeRanges[i].first += count;
+    freeRanges[i].count -= count;
+    if(freeRanges[i].count == 0)
+    {
+      freeRanges.erase(freeRanges.begin() + i);
+    }
+    return first;
+  }
+
+  if(count > capacity - allocated) return UINT32_MAX;
+  allocated += count;
+  return allocated - count;
+}
+
+void TransformBuffer::release(uint32_t first, uint32_t count)
+{
+  // kept sorted so neighbours merge back into larger ranges
+  auto next = std::lower_bound(freeRanges.begin(), freeRanges.end(), first,
+                               [](const SlotRange &range, uint32_t value){ return range.first < value; });
+  next = freeRanges.insert(next, {first, count});
+
+  if(next + 1 != freeRanges.end() && next->first + next->count == (next + 1)->first)
+  {
+    next->count += (next + 1)->count;
+    freeRanges.erase(next + 1);
+  }
+  if(next != freeRanges.begin() && (next - 1)->first + (next - 1)->count == next->first)
+  {
+    (next - 1)->count += next->count;
+    next = freeRanges.erase(next) - 1;
+  }
+
+  // a range reaching the end goes back to the unallocated tail
+  if(next + 1 == freeRanges.end() && next->first + next->count == allocated)
+  {
+    allocated = next->first;
+    freeRanges.erase(next);
+  }
+}
+
+void TransformBuffer::destroy()
+{
+  for(auto &frame: frames)
+  {
+    vkUnmapMemory(device, frame.memory);
+    vkDestroyBuffer(device, frame.buffer, nullptr);
+    MemoryTracker::free(device, frame.memory);
+  }
+  frames.clear();
+}
+
+void TransformBuffer::setTransform(uint32_t instance, const glm::mat4 &transform)
+{
+  if(instance >= capacity)
+  {
+    throw std::runtime_error("Transform instance out of range!");
+  }
+
+  for(uint32_t c=0; c<4; c++)
+  {
+    columns[c*capacity + instance] = transform[c];
+  }
+
+  for(auto &frame: frames)
+  {
+    frame.dirtyBegin = std::min(frame.dirtyBegin, instance);
+    frame.dirtyEnd = std::max(frame.dirtyEnd, instance + 1);
+  }
+}
+
+void TransformBuffer::setTransforms(uint32_t first, uint32_t count, const glm::vec3 *positions, const glm::quat *rotations,
+                                    const glm::vec3 *scales)
+{
+  if(count == 0) return;
+  if(first >= capacity || count > capacity - first)
+  {
+    throw std::runtime_error("Transform instance out of range!");
+  }
+
+  uint32_t done = 0;
+#ifdef TRANSFORM_SIMD
+  float *data = reinterpret_cast<float*>(columns.data());
+  if(hasAvx2())
+  {
+    done = composeAvx2(first, count, capacity, positions, rotations, scales, data);
+  }
+  done += composeSse(first + done, count - done, capacity, positions + done, rotations + done, scales + done, data);
+#endif
+  for(uint32_t i = done; i < count; i++)
+  {
+    composeScalar(first + i, capacity, positions[i], rotations[i], scales[i], columns.data());
+  }
+
+  for(auto &frame: frames)
+  {
+    frame.dirtyBegin = std::min(frame.dirtyBegin, first);
+    frame.dirtyEnd = std::max(frame.dirtyEnd, first + count);
+  }
+}
+
+glm::mat4 TransformBuffer::getTransform(uint32_t instance)
+{
+  glm::mat4 transform;
+  for(uint32_t c=0; c<4; c++)
+  {
+    transform[c] = columns[c*capacity + instance];
+  }
+  return transform;
+}
+
+void TransformBuffer::flush(uint32_t frame)
+{
+  FrameSlot &slot = frames[frame];
+  if(slot.dirtyBegin >= slot.dirtyEnd) return;
+
+  uint32_t count = slot.dirtyEnd - slot.dirtyBegin;
+
+  std::vector<VkMappedMemoryRange> ranges;
+  for(uint32_t c=0; c<4; c++)
+  {
+    uint32_t first = c*capacity + slot.dirtyBegin;
+    memcpy(slot.mapped + first, columns.data() + first, sizeof(glm::vec4)*count);
+
+    if(!coherent)
+    {
+      VkDeviceSize begin = sizeof(glm::vec4)*first;
+      VkDeviceSize end = begin + sizeof(glm::vec4)*count;
+      begin = begin/nonCoherentAtomSize*nonCoherentAtomSize;
+      end = std::min((end + nonCoherentAtomSize - 1)/nonCoherentAtomSize*nonCoherentAtomSize, slot.allocationSize);
+
+      VkMappedMemoryRange range{};
+      range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+      range.memory = slot.memory;
+      range.offset = begin;
+      range.size = end - begin;
+      ranges.push_back(range);
+    }
+  }
+
+  if(!ranges.empty())
+  {
+    vkFlushMappedMemoryRanges(device, static_cast<uint32_t>(ranges.size()), ranges.data());
+  }
+
+  slot.dirtyBegin = capacity;
+  slot.dirtyEnd = 0;
+}
@@ -1,12 +1,17 @@
+#define STB_IMAGE_IMPLEMENTATION
 #include "VulkanRenderer.h"
 #include "Validation.h"
 #include "Utilities.h"
 #include "Mesh.h"
+#include "CpuProfiler.h"
 
 #include <cstring>
 #include <algorithm>
 #include <set>
 #include <array>
+#include <chrono>
+#include <cmath>
+#include <thread>
 
 #include <stdlib.h>
  
@@ -18,38 +23,110 @@
 int VulkanRenderer::init(GLFWwindow * newWindow)
 {
   window = newWindow;
+  headless = false;
+
+  return initRenderer();
+}
+
+int VulkanRenderer::initHeadless(uint32_t width, uint32_t height)
+{
+  window = nullptr;
+  headless = true;
+  swapChainExtent = {width, height};
+
+  return initRenderer();
+}
+
+int VulkanRenderer::initRenderer()
+{
+  auto initStart = std::chrono::steady_clock::now();
 
   try {
     createInstance();
     setupDebugMessenger();
-    createSurface();
+    if(!headless)
+    {
+      createSurface();
+    }
     getPhysicalDevice();
     createLogicalDevice();
-    createSwapChain();
+    msaaSamples = chooseSampleCount(requestedMsaaSamples);
+    renderGraph.create(mainDevice.physicalDevice, mainDevice.logicalDevice);
+    shaderLibrary.create("shader_cache");
+    shaderLibrary.add("shaders/vert.spv", "shaders/shader.vert");
+    shaderLibrary.add("shaders/frag.spv", "shaders/shader.frag");
+    shaderLibrary.add("shaders/second_vert.spv", "shaders/second.vert");
+    shaderLibrary.add("shaders/second_frag.spv", "shaders/second.frag");
+    shaderLibrary.add("shaders/second_ms_frag.spv", "shaders/second.frag", {"MULTISAMPLED_DEPTH"});
+    if(!postPasses.empty())
+    {
+      shaderLibrary.add("shaders/post_comp.spv", "shaders/post.comp");
+    }
+    pipelineCache.create(mainDevice.physicalDevice, mainDevice.logicalDevice, pipelineCachePath);
+    pipelineLibrary.create(mainDevice.logicalDevice, pipelineCache.getCache(), &shaderLibrary,
+                           std::max(1u, std::min(4u, std::thread::hardware_concurrency()/2)));
+
+    if(headless)
+    {
+      createOffscreenImages();
+    }
+    else
+    {
+      createSwapChain();
+    }
+
+    frames.resize(MAX_FRAME_DRAWS);
+    gpuProfiler.create(mainDevice.physicalDevice, mainDevice.logicalDevice,
+                       getQueueFamilies(mainDevice.physicalDevice).graphicsFamily, static_cast<uint32_t>(frames.size()));
+    renderStats.create(mainDevice.logicalDevice, static_cast<uint32_t>(frames.size()),
+                       pipelineStatisticsRequested && pipelineStatisticsSupported);
     createColorBufferImage();
     createDepthBufferImage();
+    postChain.create(mainDevice.physicalDevice, mainDevice.logicalDevice, pipelineCache.getCache(), &shaderLibrary,
+                     postPasses);
     createRenderPass();
     createDescriptorSetLayout();
-    createPushConstantRange();
+    createPipelineLayouts();
+    // the mesh pipelines specialize the column stride with its capacity
+    transformBuffer.create(mainDevice.physicalDevice, mainDevice.logicalDevice, MAX_INSTANCES, static_cast<uint32_t>(frames.size()));
+
+    auto pipelineStart = std::chrono::steady_clock::now();
     createGraphicsPipeline();
+    startupMetrics.pipelineMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - pipelineStart).count();
+    startupMetrics.pipelineCacheHit = pipelineCache.isLoadedFromDisk();
+    startupMetrics.pipelineCacheSize = pipelineCache.getLoadedSize();
+    buildRenderGraph();
     createFrameBuffers();
     createCommandPool();
 
     createCommandBuffers();
     createTextureSampler();
 
-    createUniformBuffers();
+    frameAllocator.create(mainDevice.physicalDevice, mainDevice.logicalDevice, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                          sizeof(UboViewProjection), FRAME_TRANSIENT_SIZE, static_cast<uint32_t>(frames.size()));
+    vpFrameVersion.assign(frames.size(), 0);
+    if(headless)
+    {
+      frameReadback.create(mainDevice.physicalDevice, mainDevice.logicalDevice, swapChainExtent, READBACK_SLOTS);
+    }
     createDescriptorPool();
     createDescriptorSets();
     createInputDescriptorSets();
+    createTransformDescriptorSets();
     createSynchronization();
 
 
-    uboViewProjection.projection = glm::perspective(glm::radians(45.0f), (float) swapChainExtent.width/(float) swapChainExtent.height, 0.1f, 100.0f);
-    uboViewProjection.projection[1][1] *= -1;
     uboViewProjection.view = glm::lookAt(glm::vec3(0.0f, 17.0f, 18.0f), glm::vec3(0.0f, 0.0f, 0.0f),  glm::vec3(0.0f, 1.0f, 0.0f));
+    updateProjection();
 
     createTexture("plain.png");
+
+    // offline renders never see an edit, only watch interactively
+    if(!headless)
+    {
+      shaderLibrary.startWatching(250);
+    }
+    startupMetrics.initMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - initStart).count();
   }
   catch (const std::runtime_error &e) {
     printf("ERROR: %s\n", e.what());
@@ -59,8 +136,9 @@ int VulkanRenderer::init(GLFWwindow * newWindow)
   return 0;
 }
 
-int VulkanRenderer::createMeshModel(std::string modelFile)
+ObjectHandle VulkanRenderer::createMeshModel(std::string modelFile)
 {
+  PROFILE_ZONE("createMeshModel");
   Assimp::Importer importer; 
   const aiScene *scene = importer.ReadFile(modelFile, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_JoinIdenticalVertices);
   if(!scene)
@@ -84,98 +162,596 @@ int VulkanRenderer::createMeshModel(std::string modelFile)
     }
   }
 
+  SceneGraph sceneGraph;
+  std::vector<uint32_t> meshNodes;
   std::vector<Mesh> modelMeshes = MeshModel::LoadNode(
     mainDevice.physicalDevice, mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, 
-    scene->mRootNode, scene, matToTex
+    scene->mRootNode, scene, matToTex, SceneGraph::NO_PARENT, &sceneGraph, &meshNodes
   );
 
-  MeshModel meshModel = MeshModel(modelMeshes);
-  modelList.push_back(meshModel);
+  return addMeshModel(MeshModel(modelMeshes, sceneGraph, meshNodes));
+}
 
-  return modelList.size() - 1;
+ObjectHandle VulkanRenderer::createMeshModel(std::vector<MeshData> *meshes)
+{
+  PROFILE_ZONE("createMeshModel");
+  std::vector<Mesh> modelMeshes;
+  for(auto &data: *meshes)
+  {
+    if(data.texId < 0 || data.texId >= static_cast<int>(samplerDescriptorSets.size()))
+    {
+      throw std::runtime_error("Failed to create Mesh, unknown Texture!");
+    }
+
+    std::vector<MeshLod> lods = MeshSimplifier::generateLods(data.vertices, &data.indices);
+    modelMeshes.push_back(Mesh(mainDevice.physicalDevice, mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool,
+                               &data.vertices, &data.indices, lods, data.texId));
+  }
+
+  return addMeshModel(MeshModel(modelMeshes));
 }
 
-void VulkanRenderer::updateModel(int modelId, glm::mat4 newModel)
+ObjectHandle VulkanRenderer::addMeshModel(MeshModel meshModel)
 {
-  if(modelId >= modelList.size()) return;
-  modelList[modelId].setModel(newModel);
+  // one transform slot per scene node
+  uint32_t instanceId = transformBuffer.allocate(static_cast<uint32_t>(meshModel.getNodeCount()));
+  if(instanceId == UINT32_MAX)
+  {
+    meshModel.destroyMeshModel();
+    throw std::runtime_error("Maximum number of Model instances reached!");
+  }
+
+  meshModel.setInstanceId(instanceId);
+  meshModel.updateTransforms(&transformBuffer);
+  return models.add(meshModel);
+}
+
+void VulkanRenderer::removeMeshModel(ObjectHandle model)
+{
+  MeshModel *meshModel = models.get(model);
+  if(!meshModel) return;
+
+  // frames up to the last submitted one may still draw it
+  retiredModels.push_back({*meshModel, frameCounter});
+  models.remove(model);
+}
+
+void VulkanRenderer::destroyRetiredModels(uint64_t completedFrame)
+{
+  size_t i = 0;
+  while(i < retiredModels.size())
+  {
+    if(retiredModels[i].frame > completedFrame)
+    {
+      i++;
+      continue;
+    }
+
+    MeshModel &meshModel = retiredModels[i].model;
+    meshModel.destroyMeshModel();
+    transformBuffer.release(meshModel.getInstanceId(), static_cast<uint32_t>(meshModel.getNodeCount()));
+    retiredModels[i] = retiredModels.back();
+    retiredModels.pop_back();
+  }
+}
+
+void VulkanRenderer::updateModel(ObjectHandle model, glm::mat4 newModel)
+{
+  MeshModel *meshModel = models.get(model);
+  if(!meshModel) return;
+  meshModel->setModel(newModel);
+}
+
+void VulkanRenderer::updateModels(const ObjectHandle *handles, uint32_t count, const glm::vec3 *positions,
+                                  const glm::quat *rotations, const glm::vec3 *scales)
+{
+  PROFILE_ZONE("updateModels");
+  uint32_t i = 0;
+  while(i < count)
+  {
+    MeshModel *first = models.get(handles[i]);
+    if(!first)
+    {
+      i++;
+      continue;
+    }
+
+    // flat models take one slot each, models created one after another usually sit in consecutive slots
+    // and a run of them is composed in place
+    uint32_t end = i;
+    if(first->isFlat())
+    {
+      end = i + 1;
+      while(end < count)
+      {
+        MeshModel *next = models.get(handles[end]);
+        if(!next || !next->isFlat() || next->getInstanceId() != first->getInstanceId() + (end - i)) break;
+        end++;
+      }
+    }
+    if(end > i)
+    {
+      transformBuffer.setTransforms(first->getInstanceId(), end - i, positions + i, rotations + i, scales + i);
+      // mark the root clean so a pending updateModel cannot overwrite the batch
+      for(uint32_t j = i; j < end; j++)
+      {
+        uint32_t instance = first->getInstanceId() + (j - i);
+        models.get(handles[j])->getSceneGraph()->setFlatRoot(transformBuffer.getTransform(instance));
+      }
+      i = end;
+      continue;
+    }
+
+    // the others go through their scene graph
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), positions[i])*glm::mat4_cast(rotations[i]);
+    first->setModel(glm::scale(model, scales[i]));
+    i++;
+  }
+}
+
+int VulkanRenderer::findModelNode(ObjectHandle model, const std::string &name)
+{
+  MeshModel *meshModel = models.get(model);
+  if(!meshModel) return -1;
+  return meshModel->getSceneGraph()->findNode(name);
+}
+
+glm::mat4 VulkanRenderer::getModelNodeTransform(ObjectHandle model, uint32_t node)
+{
+  MeshModel *meshModel = models.get(model);
+  if(!meshModel || node >= meshModel->getNodeCount()) return glm::mat4(1.0f);
+  return meshModel->getSceneGraph()->getLocal(node);
+}
+
+void VulkanRenderer::updateModelNode(ObjectHandle model, uint32_t node, glm::mat4 newLocal)
+{
+  MeshModel *meshModel = models.get(model);
+  if(!meshModel || node >= meshModel->getNodeCount()) return;
+  meshModel->getSceneGraph()->setLocal(node, newLocal);
+}
+
+void VulkanRenderer::setViewProjection(glm::mat4 newView, glm::mat4 newProjection)
+{
+  if(newView == uboViewProjection.view && newProjection == uboViewProjection.projection) return;
+
+  uboViewProjection.view = newView;
+  uboViewProjection.projection = newProjection;
+  vpVersion++;
+}
+
+void VulkanRenderer::setView(glm::mat4 newView)
+{
+  setViewProjection(newView, uboViewProjection.projection);
+}
+
+void VulkanRenderer::setLodPixelError(float maxPixelError, float hysteresis)
+{
+  lodPixelError = maxPixelError;
+  lodHysteresis = hysteresis;
+}
+
+void VulkanRenderer::setProjection(float newFieldOfView, float newNearPlane, float newFarPlane)
+{
+  fieldOfView = newFieldOfView;
+  nearPlane = newNearPlane;
+  farPlane = newFarPlane;
+
+  // before init the extent is not known yet, init picks the values up
+  if(!frames.empty())
+  {
+    updateProjection();
+  }
+}
+
+void VulkanRenderer::updateProjection()
+{
+  // vulkan clip space, depth from 0 to 1 and y pointing down
+  glm::mat4 projection = glm::perspectiveRH_ZO(glm::radians(fieldOfView), (float) swapChainExtent.width/(float) swapChainExtent.height,
+                                               nearPlane, farPlane);
+  projection[1][1] *= -1;
+  setViewProjection(uboViewProjection.view, projection);
+
+  postConstants.extent = glm::vec2(swapChainExtent.width, swapChainExtent.height);
+  postConstants.nearPlane = nearPlane;
+  postConstants.farPlane = farPlane;
+}
+
+void VulkanRenderer::setPostEffects(uint32_t effects, float splitPosition)
+{
+  postConstants.effects = effects & POST_EFFECT_ALL;
+  postConstants.splitPosition = splitPosition;
+
+  // build the variant for this combination ahead of time, the generic pass covers the switch
+  if(!frames.empty())
+  {
+    PipelineKey variantKey = secondPipelineKey;
+    variantKey.fragmentConstants[0] = postConstants.effects;
+    pipelineLibrary.request(variantKey);
+  }
+}
+
+void VulkanRenderer::setLatencyMode(uint32_t framesInFlight)
+{
+  // takes effect with the next frame, lowering it simply makes the next wait stricter
+  latencyFrames = std::clamp<uint32_t>(framesInFlight, 1, static_cast<uint32_t>(frames.size()));
+}
+
+void VulkanRenderer::waitTimeline(uint64_t value)
+{
+  VkSemaphoreWaitInfo waitInfo{};
+  waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &frameTimeline;
+  waitInfo.pValues = &value;
+
+  if(vkWaitSemaphores(mainDevice.logicalDevice, &waitInfo, std::numeric_limits<uint64_t>::max()) != VK_SUCCESS)
+  {
+    throw std::runtime_error("Failed to wait for Frame Timeline!");
+  }
+}
+
+void VulkanRenderer::reloadShaders()
+{
+  PROFILE_ZONE("reloadShaders");
+  std::vector<std::string> changedShaders = shaderLibrary.takeChanged();
+  if(changedShaders.empty()) return;
+
+  // the old permutations may still be referenced by submitted frames
+  waitTimeline(frameCounter);
+  for(const auto &name: changedShaders)
+  {
+    printf("Reloading %s\n", name.c_str());
+    pipelineLibrary.invalidate(name);
+    if(name == "shaders/post_comp.spv")
+    {
+      postChain.createPipelines();
+    }
+  }
+
+  // untouched permutations are still in the library and come straight back
+  createGraphicsPipeline();
 }
 
 void VulkanRenderer::draw()
 {
-  vkWaitForFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
-  vkResetFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame]);
+  PROFILE_ZONE("draw");
+  reloadShaders();
+
+  uint64_t frameValue = frameCounter + 1;
+  currentFrame = static_cast<uint32_t>(frameValue % frames.size());
+  FrameContext &frame = frames[currentFrame];
+
+  // at most latencyFrames submissions may be pending. as there are never fewer contexts than that,
+  // this also covers the last use of this frame context
+  auto waitStart = std::chrono::steady_clock::now();
+  uint64_t retireValue = frameValue > latencyFrames ? frameValue - latencyFrames : 0;
+  {
+    PROFILE_ZONE("waitTimeline");
+    waitTimeline(std::max(retireValue, frame.timelineValue));
+  }
+  auto waitEnd = std::chrono::steady_clock::now();
+  gpuProfiler.collect(currentFrame);
+  renderStats.collect(currentFrame);
+
+  // hand out every readback that has landed in the meantime, and free the models and swapchains
+  // no frame uses any more
+  if(headless || !retiredModels.empty() || !retiredSwapchains.empty())
+  {
+    uint64_t completedFrame;
+    vkGetSemaphoreCounterValue(mainDevice.logicalDevice, frameTimeline, &completedFrame);
+    if(headless)
+    {
+      deliverReadbacks(completedFrame);
+    }
+    destroyRetiredModels(completedFrame);
+    destroyRetiredSwapchains(completedFrame);
+  }
+
+  // taken before recording, so recording never waits on the consumer
+  if(headless)
+  {
+    readbackSlot = acquireReadbackSlot();
+  }
+
+  uint32_t imageIndex = currentFrame;
+  if(!headless)
+  {
+    VkResult acquireResult;
+    {
+      PROFILE_ZONE("vkAcquireNextImageKHR");
+      acquireResult = vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain, std::numeric_limits<uint64_t>::max(),
+                                            frame.imageAvailable, VK_NULL_HANDLE, &imageIndex);
+    }
+    if(acquireResult == VK_ERROR_OUT_OF_DATE_KHR)
+    {
+      recreateSwapChain();
+      return;
+    }
+    if(acquireResult != VK_SUCCESS && acquireResult != VK_SUBOPTIMAL_KHR)
+    {
+      throw std::runtime_error("Failed to acquire Swapchain Image!");
+    }
+  }
+
+  // the image may still be rendered to by another frame context when there are more images than frames
+  if(imagesInFlight[imageIndex] > retireValue)
+  {
+    waitTimeline(imagesInFlight[imageIndex]);
+  }
+  imagesInFlight[imageIndex] = frameValue;
+  frame.timelineValue = frameValue;
+  auto acquireEnd = std::chrono::steady_clock::now();
+
+  frameMetrics.frameIndex = frameValue;
+  frameMetrics.latencyFrames = latencyFrames;
+  frameMetrics.cpuWaitMs = std::chrono::duration<float, std::milli>(waitEnd - waitStart).count();
+  frameMetrics.acquireWaitMs = std::chrono::duration<float, std::milli>(acquireEnd - waitEnd).count();
+  frameMetrics.averageCpuWaitMs = frameCounter == 0 ? frameMetrics.cpuWaitMs
+                                                    : 0.95f*frameMetrics.averageCpuWaitMs + 0.05f*frameMetrics.cpuWaitMs;
+
+  // the gpu is done with this frame's transforms and uniforms, bring them up to date
+  for(auto &model: models)
+  {
+    model.updateTransforms(&transformBuffer);
+  }
+  transformBuffer.flush(currentFrame);
+  frameAllocator.beginFrame(currentFrame);
+  updateUniformBuffers(currentFrame);
 
-  uint32_t imageIndex;
-  vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain, std::numeric_limits<uint64_t>::max(), imageAvailable[currentFrame], VK_NULL_HANDLE, &imageIndex);
   recordCommands(imageIndex);
-  updateUniformBuffers(imageIndex);
+
+  // acquire and present only take binary semaphores, the timeline is signalled alongside.
+  // headless has neither and only signals the timeline
+  std::vector<VkSemaphore> signalSemaphores = {frameTimeline};
+  std::vector<uint64_t> signalValues = {frameValue};
+  if(!headless)
+  {
+    signalSemaphores.push_back(renderFinished[imageIndex]);
+    signalValues.push_back(0);
+  }
+  uint64_t waitValue = 0;
+
+  VkTimelineSemaphoreSubmitInfo timelineInfo{};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.waitSemaphoreValueCount = headless ? 0 : 1;
+  timelineInfo.pWaitSemaphoreValues = &waitValue;
+  timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+  timelineInfo.pSignalSemaphoreValues = signalValues.data();
 
   VkSubmitInfo submitInfo{};
   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submitInfo.waitSemaphoreCount = 1;
-  submitInfo.pWaitSemaphores = &imageAvailable[currentFrame];
+  submitInfo.pNext = &timelineInfo;
+  submitInfo.waitSemaphoreCount = headless ? 0 : 1;
+  submitInfo.pWaitSemaphores = &frame.imageAvailable;
 
   VkPipelineStageFlags waitStages[] ={
-    VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+    renderGraph.getFirstStage(targetResource)
   };
   submitInfo.pWaitDstStageMask = waitStages;
   submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
-  submitInfo.signalSemaphoreCount = 1;
-  submitInfo.pSignalSemaphores = &renderFinished[currentFrame];
+  submitInfo.pCommandBuffers = &frame.commandBuffer;
+  submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+  submitInfo.pSignalSemaphores = signalSemaphores.data();
 
-  VkResult result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, drawFences[currentFrame]);
+  VkResult result;
+  {
+    PROFILE_ZONE("vkQueueSubmit");
+    result = vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+  }
   if(result != VK_SUCCESS)
   {
     throw std::runtime_error("Failed to submit draw operation to Graphics Queue");
   }
+  frameCounter = frameValue;
+
+  if(headless) return;
 
   VkPresentInfoKHR presentInfo{};
   presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
   presentInfo.waitSemaphoreCount = 1;
-  presentInfo.pWaitSemaphores = &renderFinished[currentFrame];
+  presentInfo.pWaitSemaphores = &renderFinished[imageIndex];
   presentInfo.swapchainCount = 1;
   presentInfo.pSwapchains = &swapchain;
   presentInfo.pImageIndices = &imageIndex;
 
-  result = vkQueuePresentKHR(graphicsQueue, &presentInfo);
-  if(result != VK_SUCCESS)
+  {
+    PROFILE_ZONE("vkQueuePresentKHR");
+    result = vkQueuePresentKHR(graphicsQueue, &presentInfo);
+  }
+  if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized)
+  {
+    framebufferResized = false;
+    recreateSwapChain();
+  }
+  else if(result != VK_SUCCESS)
   {
     throw std::runtime_error("Failed to present Image!");
   }
+}
 
-  currentFrame = (currentFrame + 1) % MAX_FRAME_DRAWS;; 
+void VulkanRenderer::recreateSwapChain()
+{
+  PROFILE_ZONE("recreateSwapChain");
+  // a minimised window has no extent, there is nothing to render into until it comes back
+  int width = 0, height = 0;
+  glfwGetFramebufferSize(window, &width, &height);
+  while(width == 0 || height == 0)
+  {
+    glfwWaitEvents();
+    glfwGetFramebufferSize(window, &width, &height);
+  }
+
+  // only our own frames touch the extent dependent resources, the old swapchain is retired below
+  waitTimeline(frameCounter);
+
+  destroyAttachments();
+
+  for(auto image: swapChainImages)
+  {
+    vkDestroyImageView(mainDevice.logicalDevice, image.imageView, nullptr);
+  }
+  swapChainImages.clear();
+
+  VkFormat oldFormat = swapChainImageFormat;
+  VkSwapchainKHR oldSwapchain = swapchain;
+  createSwapChain(oldSwapchain);
+
+  // the timeline does not cover presentation, presents of the old swapchain may still wait on its
+  // semaphores. presents run in queue order, so once frames of the new swapchain have completed
+  // as many times as there are frames in flight the old ones are long past
+  retiredSwapchains.push_back({oldSwapchain, renderFinished, frameCounter + frames.size()});
+  renderFinished.clear();
+
+  // pipelines only depend on the render pass, which only changes with the surface format
+  if(swapChainImageFormat != oldFormat)
+  {
+    pipelineLibrary.clear();
+    vkDestroyRenderPass(mainDevice.logicalDevice, renderPass, nullptr);
+
+    createRenderPass();
+    createGraphicsPipeline();
+  }
+
+  createColorBufferImage();
+  createDepthBufferImage();
+  buildRenderGraph();
+  createFrameBuffers();
+  updateInputDescriptorSets();
+  createRenderFinishedSemaphores();
+  imagesInFlight.assign(swapChainImages.size(), 0);
+
+  updateProjection();
+}
+
+void VulkanRenderer::deliverReadbacks(uint64_t completedFrame)
+{
+  for(const auto &readbackFrame: frameReadback.collect(completedFrame))
+  {
+    if(frameCallback)
+    {
+      frameCallback(readbackFrame);
+    }
+    else
+    {
+      frameReadback.release(readbackFrame.slot);
+    }
+  }
 }
-void VulkanRenderer::updateUniformBuffers(uint32_t imageIndex)
+
+uint32_t VulkanRenderer::acquireReadbackSlot()
 {
-  void *data; 
-  vkMapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[imageIndex], 0, sizeof(UboViewProjection), 0, &data);
-  memcpy(data, &uboViewProjection, sizeof(UboViewProjection));
-  vkUnmapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[imageIndex]);
+  uint64_t oldestInFlight;
+  uint32_t slot = frameReadback.acquireSlot(&oldestInFlight);
+  while(slot == FrameReadback::NO_SLOT && oldestInFlight != 0)
+  {
+    // a pending copy is handed out once its frame completes, a consumer releasing right away frees it
+    waitTimeline(oldestInFlight);
+    deliverReadbacks(oldestInFlight);
+    slot = frameReadback.acquireSlot(&oldestInFlight);
+  }
+
+  // the consumer holds every slot and may only release them after draw returns, this frame is not read back
+  return slot;
+}
+
+void VulkanRenderer::finishFrames()
+{
+  if(frameCounter == 0) return;
+  waitTimeline(frameCounter);
+
+  for(uint32_t i=0; i<frames.size(); i++)
+  {
+    gpuProfiler.collect(i);
+    renderStats.collect(i);
+  }
+  destroyRetiredModels(frameCounter);
+
+  if(headless)
+  {
+    deliverReadbacks(frameCounter);
+  }
+}
+
+void VulkanRenderer::updateUniformBuffers(uint32_t frame)
+{
+  PROFILE_ZONE("updateUniformBuffers");
+  // only rewritten when the camera changed since this frame slot was last used
+  if(vpFrameVersion[frame] == vpVersion) return;
+
+  FrameAllocator::Allocation vpAllocation = frameAllocator.persistent(frame);
+  memcpy(vpAllocation.data, &uboViewProjection, sizeof(UboViewProjection));
+  frameAllocator.flush(vpAllocation, sizeof(UboViewProjection));
+
+  vpFrameVersion[frame] = vpVersion;
 }
 
 void VulkanRenderer::createSynchronization()
 {
-  imageAvailable.resize(MAX_FRAME_DRAWS);
-  renderFinished.resize(MAX_FRAME_DRAWS);
-  drawFences.resize(MAX_FRAME_DRAWS);
+  VkSemaphoreCreateInfo semaphoreCreateInfo{};
+  semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+  VkSemaphoreTypeCreateInfo timelineTypeInfo{};
+  timelineTypeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  timelineTypeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  timelineTypeInfo.initialValue = 0;
+
+  VkSemaphoreCreateInfo timelineCreateInfo{};
+  timelineCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  timelineCreateInfo.pNext = &timelineTypeInfo;
+
+  if(vkCreateSemaphore(mainDevice.logicalDevice, &timelineCreateInfo, nullptr, &frameTimeline) != VK_SUCCESS)
+  {
+    throw std::runtime_error("Failed to create Timeline Semaphore!");
+  }
+
+  for(auto &frame: frames){
+    if(vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &frame.imageAvailable) != VK_SUCCESS)
+    {
+      throw std::runtime_error("Failed to create Semaphore!");
+    }
+  }
+
+  imagesInFlight.assign(swapChainImages.size(), 0);
+  if(headless) return;
 
+  createRenderFinishedSemaphores();
+}
+
+void VulkanRenderer::createRenderFinishedSemaphores()
+{
   VkSemaphoreCreateInfo semaphoreCreateInfo{};
   semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-  VkFenceCreateInfo fenceCreateInfo{};
-  fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-  fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-  
+  // presentation waits on these, so they belong to the swapchain image and not the frame.
+  // a new swapchain gets its own, the old ones retire with the old swapchain
+  for(size_t i=renderFinished.size(); i<swapChainImages.size(); i++){
+    VkSemaphore semaphore;
+    if(vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &semaphore) != VK_SUCCESS)
+    {
+      throw std::runtime_error("Failed to create Semaphore!");
+    }
+    renderFinished.push_back(semaphore);
+  }
+}
 
-  for(size_t i=0; i<MAX_FRAME_DRAWS; i++){
-    if(vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &imageAvailable[i]) != VK_SUCCESS||
-       vkCreateSemaphore(mainDevice.logicalDevice, &semaphoreCreateInfo, nullptr, &renderFinished[i]) != VK_SUCCESS||
-       vkCreateFence(mainDevice.logicalDevice, &fenceCreateInfo, nullptr, &drawFences[i]) != VK_SUCCESS)
+void VulkanRenderer::destroyRetiredSwapchains(uint64_t completedFrame)
+{
+  size_t i = 0;
+  while(i < retiredSwapchains.size())
+  {
+    if(retiredSwapchains[i].frame > completedFrame)
+    {
+      i++;
+      continue;
+    }
+
+    for(auto semaphore: retiredSwapchains[i].semaphores)
     {
-      throw std::runtime_error("Failed to create Semaphore and/or Fence!");
+      vkDestroySemaphore(mainDevice.logicalDevice, semaphore, nullptr);
     }
+    vkDestroySwapchainKHR(mainDevice.logicalDevice, retiredSwapchains[i].swapchain, nullptr);
+    retiredSwapchains[i] = retiredSwapchains.back();
+    retiredSwapchains.pop_back();
   }
 }
 
@@ -195,16 +771,24 @@ void VulkanRenderer::cleanup()
 {
   vkDeviceWaitIdle(mainDevice.logicalDevice);
 
-  for(size_t i=0; i<modelList.size(); i++)
+  for(auto &model: models)
   {
-    modelList[i].destroyMeshModel();
+    model.destroyMeshModel();
   }
+  models.clear();
+  destroyRetiredModels(frameCounter);
 
   vkDestroyDescriptorPool(mainDevice.logicalDevice, samplerDescriptorPool, nullptr);
-  vkDestroyDescriptorPool(mainDevice.logicalDevice, inputDescriptorPool, nullptr);
 
   vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, samplerSetLayout, nullptr);
   vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, inputSetLayout, nullptr);
+  vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, transformSetLayout, nullptr);
+
+  transformBuffer.destroy();
+  if(headless)
+  {
+    frameReadback.destroy();
+  }
 
   vkDestroySampler(mainDevice.logicalDevice, textureSampler, nullptr);
   
@@ -212,46 +796,44 @@ void VulkanRenderer::cleanup()
   {
     vkDestroyImageView(mainDevice.logicalDevice, textureImageViews[i], nullptr);
     vkDestroyImage(mainDevice.logicalDevice, textureImages[i], nullptr);
-    vkFreeMemory(mainDevice.logicalDevice, textureImageMemory[i], nullptr);
+    MemoryTracker::free(mainDevice.logicalDevice, textureImageMemory[i]);
   }
 
-  for(size_t i=0; i<colorBufferImage.size(); i++)
-  {
-    vkDestroyImageView(mainDevice.logicalDevice, colorBufferImageView[i], nullptr);
-    vkDestroyImage(mainDevice.logicalDevice, colorBufferImage[i], nullptr);
-    vkFreeMemory(mainDevice.logicalDevice, colorBufferImageMemory[i], nullptr);
-  }
+  destroyAttachments();
+  renderGraph.destroy();
+  postChain.destroy();
+  gpuProfiler.destroy();
+  renderStats.destroy();
 
-  for(size_t i=0; i<depthBufferImage.size(); i++)
+  for(auto &frame: frames)
   {
-    vkDestroyImageView(mainDevice.logicalDevice, depthBufferImageView[i], nullptr);
-    vkDestroyImage(mainDevice.logicalDevice, depthBufferImage[i], nullptr);
-    vkFreeMemory(mainDevice.logicalDevice, depthBufferImageMemory[i], nullptr);
+    vkDestroyDescriptorPool(mainDevice.logicalDevice, frame.descriptorPool, nullptr);
   }
 
   vkDestroyDescriptorPool(mainDevice.logicalDevice, descriptorPool, nullptr);
   vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, descriptorSetLayout, nullptr);
 
-  for(size_t i=0; i<swapChainImages.size(); i++)
+  frameAllocator.destroy();
+ 
+  for(auto semaphore: renderFinished)
   {
-    vkDestroyBuffer(mainDevice.logicalDevice, vpUniformBuffer[i], nullptr);
-    vkFreeMemory(mainDevice.logicalDevice, vpUniformBufferMemory[i], nullptr);
+    vkDestroySemaphore(mainDevice.logicalDevice, semaphore, nullptr);
   }
- 
-  for(size_t i=0; i<MAX_FRAME_DRAWS; i++){
-    vkDestroySemaphore(mainDevice.logicalDevice, renderFinished[i], nullptr);
-    vkDestroySemaphore(mainDevice.logicalDevice, imageAvailable[i], nullptr);
-    vkDestroyFence(mainDevice.logicalDevice, drawFences[i], nullptr);
+  // the device is idle, nothing waits on them any more
+  destroyRetiredSwapchains(UINT64_MAX);
+  vkDestroySemaphore(mainDevice.logicalDevice, frameTimeline, nullptr);
+
+  for(auto &frame: frames){
+    vkDestroySemaphore(mainDevice.logicalDevice, frame.imageAvailable, nullptr);
+    vkDestroyCommandPool(mainDevice.logicalDevice, frame.commandPool, nullptr);
   }
   vkDestroyCommandPool(mainDevice.logicalDevice, graphicsCommandPool, nullptr);
 
-  for(auto framebuffer: swapChainFrameBuffers)
-  {
-    vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
-  }
+  pipelineLibrary.destroy();
+  shaderLibrary.destroy();
 
-  vkDestroyPipeline(mainDevice.logicalDevice, secondPipeline, nullptr);
-  vkDestroyPipeline(mainDevice.logicalDevice, graphicsPipeline, nullptr);
+  pipelineCache.save();
+  pipelineCache.destroy();
 
   vkDestroyPipelineLayout(mainDevice.logicalDevice, secondPipelineLayout, nullptr);
   vkDestroyPipelineLayout(mainDevice.logicalDevice, pipelineLayout, nullptr);
@@ -263,8 +845,19 @@ void VulkanRenderer::cleanup()
     vkDestroyImageView(mainDevice.logicalDevice, image.imageView, nullptr);
   }
 
-  vkDestroySwapchainKHR(mainDevice.logicalDevice, swapchain, nullptr);
-  vkDestroySurfaceKHR(instance, surface, nullptr);
+  if(headless)
+  {
+    for(size_t i=0; i<swapChainImages.size(); i++)
+    {
+      vkDestroyImage(mainDevice.logicalDevice, swapChainImages[i].image, nullptr);
+      MemoryTracker::free(mainDevice.logicalDevice, offscreenImageMemory[i]);
+    }
+  }
+  else
+  {
+    vkDestroySwapchainKHR(mainDevice.logicalDevice, swapchain, nullptr);
+    vkDestroySurfaceKHR(instance, surface, nullptr);
+  }
   if (enableValidationLayers) {
         DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
   }
@@ -296,14 +889,17 @@ void VulkanRenderer::createInstance()
   appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
   appInfo.pEngineName = "No Engine";
   appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-  appInfo.apiVersion = VK_API_VERSION_1_0;
+  appInfo.apiVersion = VK_API_VERSION_1_2;
 
   VkInstanceCreateInfo createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
   createInfo.pApplicationInfo = &appInfo;
 
   std::vector<const char*> instanceExtensions = std::vector<const char*>();
-  appendGLFWExtensions(&instanceExtensions);
+  if(!headless)
+  {
+    appendGLFWExtensions(&instanceExtensions);
+  }
   appendValidationExtensions(&instanceExtensions);
 
   if (!checkInstanceExtensionSupport(&instanceExtensions))
@@ -406,8 +1002,34 @@ void VulkanRenderer::getPhysicalDevice()
       break;
     }
   }
-  VkPhysicalDeviceProperties deviceProperties;
-  vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &deviceProperties);
+
+  if(preferCpuDevice)
+  {
+    for (const auto &device : deviceList)
+    {
+      VkPhysicalDeviceProperties deviceProperties;
+      vkGetPhysicalDeviceProperties(device, &deviceProperties);
+      if (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU && checkDeviceSuitable(device))
+      {
+        mainDevice.physicalDevice = device;
+        break;
+      }
+    }
+  }
+  if(mainDevice.physicalDevice == VK_NULL_HANDLE)
+  {
+    throw std::runtime_error("Can't find a suitable GPU!");
+  }
+
+  // software rasterizers may lack anisotropic filtering, textures then fall back to plain linear
+  VkPhysicalDeviceFeatures deviceFeatures;
+  vkGetPhysicalDeviceFeatures(mainDevice.physicalDevice, &deviceFeatures);
+  anisotropySupported = deviceFeatures.samplerAnisotropy;
+  pipelineStatisticsSupported = deviceFeatures.pipelineStatisticsQuery;
+  if(pipelineStatisticsRequested && !pipelineStatisticsSupported)
+  {
+    printf("Pipeline statistics queries are not supported, only the recorded counters are available\n");
+  }
 }
 
 bool VulkanRenderer::checkDeviceSuitable(VkPhysicalDevice device)
@@ -418,16 +1040,29 @@ bool VulkanRenderer::checkDeviceSuitable(VkPhysicalDevice device)
   // might be necessary to upgrade this check for more features
   QueueFamilyIndices indices = getQueueFamilies(device);
 
-  bool extensionsSupported = checkDeviceExtensionSupport(device);
+  bool extensionsSupported = headless || checkDeviceExtensionSupport(device);
 
-  bool swapChainValid = false;
-  if(extensionsSupported)
+  bool swapChainValid = headless;
+  if(extensionsSupported && !headless)
   {
     SwapChainDetails swapChainDetails = getSwapChainDetails(device);
     swapChainValid = !swapChainDetails.presentationModes.empty() && !swapChainDetails.formats.empty();
   }
 
-  return indices.isValid() && extensionsSupported && swapChainValid && deviceFeatures.samplerAnisotropy;
+  // frame pacing is built on timeline semaphores
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(device, &deviceProperties);
+  if(deviceProperties.apiVersion < VK_API_VERSION_1_2) return false;
+
+  VkPhysicalDeviceVulkan12Features vulkan12Features{};
+  vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+  VkPhysicalDeviceFeatures2 deviceFeatures2{};
+  deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  deviceFeatures2.pNext = &vulkan12Features;
+  vkGetPhysicalDeviceFeatures2(device, &deviceFeatures2);
+
+  return indices.isValid() && extensionsSupported && swapChainValid && vulkan12Features.timelineSemaphore;
 }
 
 
@@ -477,8 +1112,12 @@ QueueFamilyIndices VulkanRenderer::getQueueFamilies(VkPhysicalDevice device)
       indices.graphicsFamily = i;
     }
 
-    VkBool32 presentationSupport = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentationSupport);
+    // without a surface nothing is presented, the graphics queue stands in
+    VkBool32 presentationSupport = headless && indices.graphicsFamily == i;
+    if(!headless)
+    {
+      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentationSupport);
+    }
     if(queueFamily.queueCount > 0  && presentationSupport)
     {
       indices.presentationFamily = i;
@@ -545,15 +1184,46 @@ void VulkanRenderer::createLogicalDevice()
   deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
   deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
   deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
-  deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-  deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+  // the memory budget extension is optional, without it only our own allocations are known
+  std::vector<const char*> enabledExtensions;
+  if(!headless)
+  {
+    enabledExtensions = deviceExtensions;
+  }
+  uint32_t extensionCount = 0;
+  vkEnumerateDeviceExtensionProperties(mainDevice.physicalDevice, nullptr, &extensionCount, nullptr);
+  std::vector<VkExtensionProperties> extensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(mainDevice.physicalDevice, nullptr, &extensionCount, extensions.data());
+
+  bool memoryBudgetSupported = false;
+  for(const auto &extension: extensions)
+  {
+    if(strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+    {
+      memoryBudgetSupported = true;
+      break;
+    }
+  }
+  if(memoryBudgetSupported)
+  {
+    enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+  }
+  deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+  deviceCreateInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
 
   VkPhysicalDeviceFeatures deviceFeatures = {};
-  deviceFeatures.samplerAnisotropy = VK_TRUE;
+  deviceFeatures.samplerAnisotropy = anisotropySupported ? VK_TRUE : VK_FALSE;
+  deviceFeatures.pipelineStatisticsQuery = pipelineStatisticsRequested && pipelineStatisticsSupported ? VK_TRUE : VK_FALSE;
 
   deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 
+  VkPhysicalDeviceVulkan12Features vulkan12Features{};
+  vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  vulkan12Features.timelineSemaphore = VK_TRUE;
+
+  deviceCreateInfo.pNext = &vulkan12Features;
+
   VkResult result = vkCreateDevice(mainDevice.physicalDevice, &deviceCreateInfo, nullptr, &mainDevice.logicalDevice);
   if (result != VK_SUCCESS)
   {
@@ -562,6 +1232,9 @@ void VulkanRenderer::createLogicalDevice()
 
   vkGetDeviceQueue(mainDevice.logicalDevice, indices.graphicsFamily, 0, &graphicsQueue);
   vkGetDeviceQueue(mainDevice.logicalDevice, indices.presentationFamily, 0, &presentationQueue);
+
+  MemoryTracker::create(mainDevice.physicalDevice, memoryBudgetSupported);
+  MemoryTracker::setBudget(memoryBudget, strictMemoryBudget);
 }
 
 //##############################( CREATE SURFACE )##############################
@@ -578,7 +1251,24 @@ void VulkanRenderer::createSurface()
 
 //##############################( CREATE SWAPCHAIN )##############################
 
-void VulkanRenderer::createSwapChain()
+void VulkanRenderer::createOffscreenImages()
+{
+  swapChainImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+
+  offscreenImageMemory.resize(MAX_FRAME_DRAWS);
+  for(size_t i=0; i<MAX_FRAME_DRAWS; i++)
+  {
+    SwapChainImage offscreenImage{};
+    offscreenImage.image = createImage(swapChainExtent.width, swapChainExtent.height, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Attachment, &offscreenImageMemory[i]);
+    offscreenImage.imageView = createImageView(offscreenImage.image, swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    swapChainImages.push_back(offscreenImage);
+  }
+}
+
+void VulkanRenderer::createSwapChain(VkSwapchainKHR oldSwapchain)
 {
   SwapChainDetails swapChainDetails = getSwapChainDetails(mainDevice.physicalDevice);
 
@@ -601,6 +1291,18 @@ void VulkanRenderer::createSwapChain()
   swapChainCreateInfo.minImageCount = imageCount; 
   swapChainCreateInfo.imageArrayLayers = 1;
   swapChainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  // the post chain blits its result into the swapchain image instead of rendering to it
+  if(!postPasses.empty())
+  {
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(mainDevice.physicalDevice, surfaceFormat.format, &formatProperties);
+    if(!(swapChainDetails.surfaceCapabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) ||
+       !(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT))
+    {
+      throw std::runtime_error("Failed to find a Swapchain that can be blitted to for post processing!");
+    }
+    swapChainCreateInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  }
   swapChainCreateInfo.preTransform = swapChainDetails.surfaceCapabilities.currentTransform;
   swapChainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
   swapChainCreateInfo.clipped = VK_TRUE;
@@ -624,7 +1326,7 @@ void VulkanRenderer::createSwapChain()
     swapChainCreateInfo.pQueueFamilyIndices = nullptr;
   }
 
-  swapChainCreateInfo.oldSwapchain = VK_NULL_HANDLE;
+  swapChainCreateInfo.oldSwapchain = oldSwapchain;
   VkResult result = vkCreateSwapchainKHR(mainDevice.logicalDevice, &swapChainCreateInfo, nullptr, &swapchain);
 
   if(result != VK_SUCCESS)
@@ -652,7 +1354,8 @@ void VulkanRenderer::createSwapChain()
 }
 VkImage VulkanRenderer::createImage(
     uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling,
-    VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, VkDeviceMemory *imageMemory
+    VkImageUsageFlags useFlags, VkMemoryPropertyFlags propFlags, MemoryCategory category, VkDeviceMemory *imageMemory,
+    VkSampleCountFlagBits samples
 ) 
 {
   VkImageCreateInfo imageCreateInfo{};
@@ -667,7 +1370,7 @@ VkImage VulkanRenderer::createImage(
   imageCreateInfo.tiling = tiling;
   imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
   imageCreateInfo.usage = useFlags;
-  imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageCreateInfo.samples = samples;
   imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
   VkImage image;
@@ -683,9 +1386,17 @@ VkImage VulkanRenderer::createImage(
   VkMemoryAllocateInfo memoryAllocInfo{};
   memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
   memoryAllocInfo.allocationSize = memoryRequirements.size;
-  memoryAllocInfo.memoryTypeIndex = findMemoryTypeIndex(mainDevice.physicalDevice, memoryRequirements.memoryTypeBits, propFlags);
+  try {
+    memoryAllocInfo.memoryTypeIndex = findMemoryTypeIndex(mainDevice.physicalDevice, memoryRequirements.memoryTypeBits, propFlags);
+  }
+  catch (const std::runtime_error &) {
+    // lazily allocated memory only exists on tiled gpus, elsewhere transient attachments get ordinary memory
+    if(!(propFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)) throw;
+    memoryAllocInfo.memoryTypeIndex = findMemoryTypeIndex(mainDevice.physicalDevice, memoryRequirements.memoryTypeBits,
+                                                          propFlags & ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT);
+  }
 
-  result = vkAllocateMemory(mainDevice.logicalDevice, &memoryAllocInfo, nullptr, imageMemory);
+  result = MemoryTracker::allocate(mainDevice.logicalDevice, &memoryAllocInfo, category, imageMemory);
   if(result != VK_SUCCESS)
   {
     throw std::runtime_error("Failed to allocate memory for Image!");
@@ -780,98 +1491,43 @@ VkExtent2D VulkanRenderer::chooseSwapExtent(const VkSurfaceCapabilitiesKHR &surf
 
 void VulkanRenderer::createDescriptorSetLayout()
 {
-  // uniforms
-  VkDescriptorSetLayoutBinding vpLayoutBinding{};
-  vpLayoutBinding.binding = 0;
-  vpLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  vpLayoutBinding.descriptorCount = 1;
-  vpLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-  vpLayoutBinding.pImmutableSamplers = nullptr;
+  // set numbers are fixed by the renderer, what is in them comes from the shaders
+  std::vector<SpirvReflection> meshStages = {shaderLibrary.getReflection("shaders/vert.spv"),
+                                             shaderLibrary.getReflection("shaders/frag.spv")};
+  std::vector<SpirvReflection> secondStages = {shaderLibrary.getReflection("shaders/second_vert.spv"),
+                                               shaderLibrary.getReflection(postFragmentShader())};
+
+  descriptorSetLayout = createReflectedSetLayout(meshStages, 0);
+  samplerSetLayout = createReflectedSetLayout(meshStages, 1);
+  transformSetLayout = createReflectedSetLayout(meshStages, 2);
+  inputSetLayout = createReflectedSetLayout(secondStages, 0);
+}
+
+VkDescriptorSetLayout VulkanRenderer::createReflectedSetLayout(const std::vector<SpirvReflection> &stages, uint32_t set)
+{
+  std::vector<VkDescriptorSetLayoutBinding> layoutBindings = SpirvReflection::mergeSet(stages, set);
 
-  std::vector<VkDescriptorSetLayoutBinding> layoutBindings = {vpLayoutBinding};//, modelLayoutBinding};
+  // uniforms all come out of the frame allocator and are bound with a dynamic offset
+  for(auto &binding: layoutBindings)
+  {
+    if(binding.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+    {
+      binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    }
+  }
 
   VkDescriptorSetLayoutCreateInfo layoutCreateInfo{};
   layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
   layoutCreateInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
   layoutCreateInfo.pBindings = layoutBindings.data();
 
-  VkResult result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &layoutCreateInfo, nullptr, &descriptorSetLayout);
-  if(result != VK_SUCCESS)
-  {
-    throw std::runtime_error("Failed to create DescriptorSet Uniform Layout!");
-  }
-
-  // sampler
-  //
-  VkDescriptorSetLayoutBinding samplerLayoutBinding{};
-  samplerLayoutBinding.binding = 0;
-  samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-  samplerLayoutBinding.descriptorCount = 1;
-  samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-  samplerLayoutBinding.pImmutableSamplers = nullptr;
-  
-  VkDescriptorSetLayoutCreateInfo textureLayoutCreateInfo{};
-  textureLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-  textureLayoutCreateInfo.bindingCount = 1;
-  textureLayoutCreateInfo.pBindings = &samplerLayoutBinding;
-
-
-  result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &textureLayoutCreateInfo, nullptr, &samplerSetLayout);
+  VkDescriptorSetLayout setLayout;
+  VkResult result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &layoutCreateInfo, nullptr, &setLayout);
   if(result != VK_SUCCESS)
   {
-    throw std::runtime_error("Failed to create DescriptorSet Sampler Layout!");
-  }
-
-  // input descriptor
-
-
-  VkDescriptorSetLayoutBinding colorInputLayoutBinding{};
-  colorInputLayoutBinding.binding = 0;
-  colorInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-  colorInputLayoutBinding.descriptorCount = 1;
-  colorInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-  VkDescriptorSetLayoutBinding depthInputLayoutBinding{};
-  depthInputLayoutBinding.binding = 1;
-  depthInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-  depthInputLayoutBinding.descriptorCount = 1;
-  depthInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-  std::vector<VkDescriptorSetLayoutBinding> inputBindings = {colorInputLayoutBinding, depthInputLayoutBinding};
-
-  VkDescriptorSetLayoutCreateInfo inputLayoutCreateInfo{};
-  inputLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-  inputLayoutCreateInfo.bindingCount = static_cast<uint32_t>(inputBindings.size());
-  inputLayoutCreateInfo.pBindings = inputBindings.data();
-
-
-  result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &inputLayoutCreateInfo, nullptr, &inputSetLayout);
-  if(result != VK_SUCCESS)
-  {
-    throw std::runtime_error("Failed to create DescriptorSet Input Layout!");
-  }
-
-}
-
-void VulkanRenderer::createPushConstantRange()
-{
-  pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-  pushConstantRange.offset = 0;
-  pushConstantRange.size = sizeof(Model);
-}
-
-void VulkanRenderer::createUniformBuffers()
-{
-  VkDeviceSize vpBufferSize = sizeof(UboViewProjection);
-
-  vpUniformBuffer.resize(swapChainImages.size());
-  vpUniformBufferMemory.resize(swapChainImages.size());
-
-  for(size_t i=0; i<swapChainImages.size(); i++)
-  {
-    createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, vpBufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,  &vpUniformBuffer[i], &vpUniformBufferMemory[i]);
+    throw std::runtime_error("Failed to create reflected DescriptorSet Layout!");
   }
+  return setLayout;
 }
 
 void VulkanRenderer::createDescriptorPool()
@@ -879,15 +1535,15 @@ void VulkanRenderer::createDescriptorPool()
   // create uniform descriptorPool 
   //
   VkDescriptorPoolSize vpPoolSize{};
-  vpPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  vpPoolSize.descriptorCount = static_cast<uint32_t>(vpUniformBuffer.size());
+  vpPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  vpPoolSize.descriptorCount = 1;
 
   std::vector<VkDescriptorPoolSize> poolSizes = {vpPoolSize};
 
   
   VkDescriptorPoolCreateInfo poolCreateInfo{};
   poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-  poolCreateInfo.maxSets = static_cast<uint32_t>(vpUniformBuffer.size());
+  poolCreateInfo.maxSets = 1;
   poolCreateInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
   poolCreateInfo.pPoolSizes = poolSizes.data();
 
@@ -916,103 +1572,102 @@ void VulkanRenderer::createDescriptorPool()
   }
 
 
-  // create input Pool 
+  // create the per frame Pools for input attachments and transforms
   //
-  VkDescriptorPoolSize colorInputPoolSize{};
-  colorInputPoolSize.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-  colorInputPoolSize.descriptorCount = static_cast<uint32_t>(colorBufferImageView.size());
+  VkDescriptorPoolSize inputPoolSize{};
+  inputPoolSize.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+  inputPoolSize.descriptorCount = 2;
 
-  VkDescriptorPoolSize depthInputPoolSize{};
-  depthInputPoolSize.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-  depthInputPoolSize.descriptorCount = static_cast<uint32_t>(depthBufferImageView.size());
+  VkDescriptorPoolSize transformPoolSize{};
+  transformPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  transformPoolSize.descriptorCount = 1;
 
-  std::vector<VkDescriptorPoolSize> inputPoolSizes ={colorInputPoolSize, depthInputPoolSize};
+  std::vector<VkDescriptorPoolSize> framePoolSizes = {inputPoolSize, transformPoolSize};
 
-  VkDescriptorPoolCreateInfo inputPoolCreateInfo{};
-  inputPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-  inputPoolCreateInfo.maxSets = swapChainImages.size();
-  inputPoolCreateInfo.poolSizeCount = static_cast<uint32_t>(inputPoolSizes.size());
-  inputPoolCreateInfo.pPoolSizes = inputPoolSizes.data();
+  VkDescriptorPoolCreateInfo framePoolCreateInfo{};
+  framePoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  framePoolCreateInfo.maxSets = 2;
+  framePoolCreateInfo.poolSizeCount = static_cast<uint32_t>(framePoolSizes.size());
+  framePoolCreateInfo.pPoolSizes = framePoolSizes.data();
 
-  result = vkCreateDescriptorPool(mainDevice.logicalDevice, &inputPoolCreateInfo, nullptr, &inputDescriptorPool);
-  if(result != VK_SUCCESS)
+  for(auto &frame: frames)
   {
-    throw std::runtime_error("Failed to create Descriptor Pool!");
+    result = vkCreateDescriptorPool(mainDevice.logicalDevice, &framePoolCreateInfo, nullptr, &frame.descriptorPool);
+    if(result != VK_SUCCESS)
+    {
+      throw std::runtime_error("Failed to create Frame Descriptor Pool!");
+    }
   }
-
-
 }
 
 void VulkanRenderer::createDescriptorSets()
 {
-  descriptorSets.resize(swapChainImages.size());
-  std::vector<VkDescriptorSetLayout> setLayouts(swapChainImages.size(), descriptorSetLayout);
-
+  // a single set for all frames, each frame selects its region of the frame allocator by dynamic offset
   VkDescriptorSetAllocateInfo setAllocInfo{};
   setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
   setAllocInfo.descriptorPool = descriptorPool;
-  setAllocInfo.descriptorSetCount = static_cast<uint32_t>(swapChainImages.size());
-  setAllocInfo.pSetLayouts = setLayouts.data();
+  setAllocInfo.descriptorSetCount = 1;
+  setAllocInfo.pSetLayouts = &descriptorSetLayout;
 
-  VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo, descriptorSets.data());
+  VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo, &descriptorSet);
   if(result != VK_SUCCESS)
   {
     throw std::runtime_error("Failed to create DescriptorSets!");
   }
-  
-  for(size_t i=0; i<swapChainImages.size(); i++)
-  {
 
-    /// VIEW PROJECTION
-    VkDescriptorBufferInfo vpBufferInfo{};
-    vpBufferInfo.buffer = vpUniformBuffer[i];
-    vpBufferInfo.offset = 0;
-    vpBufferInfo.range = sizeof(UboViewProjection);
+  /// VIEW PROJECTION
+  VkDescriptorBufferInfo vpBufferInfo{};
+  vpBufferInfo.buffer = frameAllocator.getBuffer();
+  vpBufferInfo.offset = 0;
+  vpBufferInfo.range = sizeof(UboViewProjection);
 
-    VkWriteDescriptorSet vpSetWrite{};
-    vpSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    vpSetWrite.dstSet = descriptorSets[i];
-    vpSetWrite.dstBinding = 0;
-    vpSetWrite.dstArrayElement = 0;
-    vpSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    vpSetWrite.descriptorCount = 1;
-    vpSetWrite.pBufferInfo = &vpBufferInfo;
+  VkWriteDescriptorSet vpSetWrite{};
+  vpSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  vpSetWrite.dstSet = descriptorSet;
+  vpSetWrite.dstBinding = 0;
+  vpSetWrite.dstArrayElement = 0;
+  vpSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  vpSetWrite.descriptorCount = 1;
+  vpSetWrite.pBufferInfo = &vpBufferInfo;
 
-    std::vector<VkWriteDescriptorSet> setWrites = {vpSetWrite};
+  std::vector<VkWriteDescriptorSet> setWrites = {vpSetWrite};
 
-    vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
-  }
+  vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
 }
 
 void VulkanRenderer::createInputDescriptorSets()
 {
-  inputDescriptorSets.resize(swapChainImages.size());
-
-  std::vector<VkDescriptorSetLayout> setLayouts(swapChainImages.size(), inputSetLayout);
-
-  VkDescriptorSetAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-  allocInfo.descriptorPool = inputDescriptorPool;
-  allocInfo.descriptorSetCount = static_cast<uint32_t>(swapChainImages.size());
-  allocInfo.pSetLayouts = setLayouts.data();
-
-  VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &allocInfo, inputDescriptorSets.data());
-  if(result != VK_SUCCESS)
+  for(auto &frame: frames)
   {
-    throw std::runtime_error("Failed to create inputDescriptorSets!");
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = frame.descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &inputSetLayout;
+
+    VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &allocInfo, &frame.inputDescriptorSet);
+    if(result != VK_SUCCESS)
+    {
+      throw std::runtime_error("Failed to create inputDescriptorSets!");
+    }
   }
 
-  for(size_t i=0; i<swapChainImages.size(); i++)
+  updateInputDescriptorSets();
+}
+
+void VulkanRenderer::updateInputDescriptorSets()
+{
+  for(auto &frame: frames)
   {
     // color attachment
     VkDescriptorImageInfo colorAttachmentDescriptorInfo{};
     colorAttachmentDescriptorInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    colorAttachmentDescriptorInfo.imageView = colorBufferImageView[i];
+    colorAttachmentDescriptorInfo.imageView = msaaSamples != VK_SAMPLE_COUNT_1_BIT ? colorResolveImageView : colorBufferImageView;
     colorAttachmentDescriptorInfo.sampler = VK_NULL_HANDLE;
 
     VkWriteDescriptorSet colorWrite{};
     colorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    colorWrite.dstSet = inputDescriptorSets[i];
+    colorWrite.dstSet = frame.inputDescriptorSet;
     colorWrite.dstBinding = 0;
     colorWrite.dstArrayElement = 0;
     colorWrite.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
@@ -1022,12 +1677,12 @@ void VulkanRenderer::createInputDescriptorSets()
     // depth attachment
     VkDescriptorImageInfo depthAttachmentDescriptorInfo{};
     depthAttachmentDescriptorInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    depthAttachmentDescriptorInfo.imageView = depthBufferImageView[i];
+    depthAttachmentDescriptorInfo.imageView = depthBufferImageView;
     depthAttachmentDescriptorInfo.sampler = VK_NULL_HANDLE;
 
     VkWriteDescriptorSet depthWrite{};
     depthWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    depthWrite.dstSet = inputDescriptorSets[i];
+    depthWrite.dstSet = frame.inputDescriptorSet;
     depthWrite.dstBinding = 1;
     depthWrite.dstArrayElement = 0;
     depthWrite.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
@@ -1040,134 +1695,54 @@ void VulkanRenderer::createInputDescriptorSets()
   }
 }
 
-//##############################( CREATE GRAPHICS PIPELINE )##############################
-
-void VulkanRenderer::createGraphicsPipeline()
+void VulkanRenderer::createTransformDescriptorSets()
 {
-  auto vertexShaderCode = readFile("shaders/vert.spv");
-  auto fragmentShaderCode = readFile("shaders/frag.spv");
+  for(size_t i=0; i<frames.size(); i++)
+  {
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = frames[i].descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &transformSetLayout;
 
-  // create shaders
-  VkShaderModule vertexShaderModule = createShaderModule(vertexShaderCode);
-  VkShaderModule fragmentShaderModule = createShaderModule(fragmentShaderCode);
+    VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &allocInfo, &frames[i].transformDescriptorSet);
+    if(result != VK_SUCCESS)
+    {
+      throw std::runtime_error("Failed to create transformDescriptorSets!");
+    }
 
-  VkPipelineShaderStageCreateInfo vertexShaderStageCreateInfo{};
-  vertexShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  vertexShaderStageCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-  vertexShaderStageCreateInfo.module = vertexShaderModule;
-  vertexShaderStageCreateInfo.pName = "main";
+    VkDescriptorBufferInfo transformBufferInfo{};
+    transformBufferInfo.buffer = transformBuffer.getBuffer(i);
+    transformBufferInfo.offset = 0;
+    transformBufferInfo.range = transformBuffer.getBufferSize();
 
-  VkPipelineShaderStageCreateInfo fragmentShaderStageCreateInfo{};
-  fragmentShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  fragmentShaderStageCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-  fragmentShaderStageCreateInfo.module = fragmentShaderModule;
-  fragmentShaderStageCreateInfo.pName = "main";
+    VkWriteDescriptorSet transformWrite{};
+    transformWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    transformWrite.dstSet = frames[i].transformDescriptorSet;
+    transformWrite.dstBinding = 0;
+    transformWrite.dstArrayElement = 0;
+    transformWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    transformWrite.descriptorCount = 1;
+    transformWrite.pBufferInfo = &transformBufferInfo;
 
-  VkPipelineShaderStageCreateInfo shaderStages[] = {vertexShaderStageCreateInfo, fragmentShaderStageCreateInfo};
-  
-  // vertex data
-  VkVertexInputBindingDescription bindingDescription{};
-  bindingDescription.binding = 0;
-  bindingDescription.stride = sizeof(Vertex);
-  bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-  //position and color
-  std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions;
-
-  attributeDescriptions[0].binding = 0;
-  attributeDescriptions[0].location = 0;
-  attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-  attributeDescriptions[0].offset = offsetof(Vertex, pos);
-
-  attributeDescriptions[1].binding = 0;
-  attributeDescriptions[1].location = 1;
-  attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-  attributeDescriptions[1].offset = offsetof(Vertex, col);
-
-  attributeDescriptions[2].binding = 0;
-  attributeDescriptions[2].location = 2;
-  attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-  attributeDescriptions[2].offset = offsetof(Vertex, tex);
+    vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &transformWrite, 0, nullptr);
+  }
+}
 
-  
-  //VERTEX INPUT
-  VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo{};
-  vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-  vertexInputCreateInfo.vertexBindingDescriptionCount = 1;
-  vertexInputCreateInfo.pVertexBindingDescriptions = &bindingDescription;
-  vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-  vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
-
-  //INPUT ASSEMBLY
-  VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-  inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-  inputAssembly.primitiveRestartEnable = VK_FALSE;
-
-  //VIEWPORT + SCISSOR
-  VkViewport viewport{};
-  viewport.x = 0.0f;
-  viewport.y = 0.0f;
-  viewport.width = (float) swapChainExtent.width;
-  viewport.height = (float) swapChainExtent.height;
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
-  
-  VkRect2D scissor{};
-  scissor.offset = {0, 0};
-  scissor.extent = swapChainExtent;
-
-  VkPipelineViewportStateCreateInfo viewPortStateCreateInfo{};
-  viewPortStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-  viewPortStateCreateInfo.viewportCount = 1;
-  viewPortStateCreateInfo.pViewports = &viewport;
-  viewPortStateCreateInfo.scissorCount = 1;
-  viewPortStateCreateInfo.pScissors = & scissor;
-
-  // RASTERIZER
-  VkPipelineRasterizationStateCreateInfo rasterizerCreateInfo{};
-  rasterizerCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-  rasterizerCreateInfo.depthClampEnable = VK_FALSE;
-  rasterizerCreateInfo.rasterizerDiscardEnable = VK_FALSE;
-  rasterizerCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
-  rasterizerCreateInfo.lineWidth = 1.0f;
-  rasterizerCreateInfo.cullMode = VK_CULL_MODE_BACK_BIT;
-  rasterizerCreateInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-  rasterizerCreateInfo.depthBiasEnable = VK_FALSE;
-
-  // MULTISAMPLING
-  VkPipelineMultisampleStateCreateInfo multiSamplingCreateInfo{};
-  multiSamplingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-  multiSamplingCreateInfo.sampleShadingEnable = VK_FALSE;
-  multiSamplingCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-
-  // BLENDING
-  VkPipelineColorBlendAttachmentState colourState{};
-  colourState.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-                               VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-  colourState.blendEnable = VK_TRUE; 
-  colourState.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-  colourState.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-  colourState.colorBlendOp = VK_BLEND_OP_ADD;
-  colourState.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-  colourState.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-  colourState.alphaBlendOp = VK_BLEND_OP_ADD;
-  
-  VkPipelineColorBlendStateCreateInfo colorBlendingCreateInfo{};
-  colorBlendingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-  colorBlendingCreateInfo.logicOpEnable = VK_FALSE;
-  colorBlendingCreateInfo.attachmentCount = 1;
-  colorBlendingCreateInfo.pAttachments = &colourState;
-  
-  std::array<VkDescriptorSetLayout, 2> descriptorSetLayouts = {descriptorSetLayout, samplerSetLayout};
+//##############################( CREATE GRAPHICS PIPELINE )##############################
 
+void VulkanRenderer::createPipelineLayouts()
+{
+  std::array<VkDescriptorSetLayout, 3> descriptorSetLayouts = {descriptorSetLayout, samplerSetLayout, transformSetLayout};
+  std::vector<VkPushConstantRange> pushConstantRanges = SpirvReflection::mergePushConstants(
+    {shaderLibrary.getReflection("shaders/vert.spv"), shaderLibrary.getReflection("shaders/frag.spv")});
 
   VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{};
   pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
   pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
   pipelineLayoutCreateInfo.pSetLayouts = descriptorSetLayouts.data();
-  pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
-  pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+  pipelineLayoutCreateInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstantRanges.size());
+  pipelineLayoutCreateInfo.pPushConstantRanges = pushConstantRanges.data();
 
   VkResult result = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
   if(result != VK_SUCCESS)
@@ -1175,91 +1750,67 @@ void VulkanRenderer::createGraphicsPipeline()
     throw std::runtime_error("Failed to create Pipeline Layout!");
   }
 
-  // DEPTH STENCIL TESTING
-  VkPipelineDepthStencilStateCreateInfo depthStencilCreateInfo{};
-  depthStencilCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-  depthStencilCreateInfo.depthTestEnable = VK_TRUE;
-  depthStencilCreateInfo.depthWriteEnable = VK_TRUE;
-  depthStencilCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS;
-  depthStencilCreateInfo.depthBoundsTestEnable = VK_FALSE;
-  depthStencilCreateInfo.stencilTestEnable = VK_FALSE;
-
-  
-  VkGraphicsPipelineCreateInfo pipelineCreateInfo{};
-  pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-  pipelineCreateInfo.stageCount = 2;
-  pipelineCreateInfo.pStages = shaderStages;
-  pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
-  pipelineCreateInfo.pInputAssemblyState = &inputAssembly;
-  pipelineCreateInfo.pViewportState = &viewPortStateCreateInfo;
-  pipelineCreateInfo.pDynamicState = nullptr;
-  pipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
-  pipelineCreateInfo.pMultisampleState = &multiSamplingCreateInfo;
-  pipelineCreateInfo.pColorBlendState = &colorBlendingCreateInfo;
-  pipelineCreateInfo.pDepthStencilState = &depthStencilCreateInfo;
-  pipelineCreateInfo.layout = pipelineLayout;
-  pipelineCreateInfo.renderPass = renderPass;
-  pipelineCreateInfo.subpass = 0;
-
-  // no pipeline derivatives
-  pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
-  pipelineCreateInfo.basePipelineIndex = -1;
-
-  result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &graphicsPipeline);
-  if(result != VK_SUCCESS)
-  {
-    throw std::runtime_error("Failed to create Rendering Pipeline!"); 
-  }
-
-  // create second pass Pipeline
-  auto secondVertexShaderCode = readFile("shaders/second_vert.spv");
-  auto secondFragmentShaderCode = readFile("shaders/second_frag.spv");
-
-  VkShaderModule secondVertexShaderModule = createShaderModule(secondVertexShaderCode);
-  VkShaderModule secondFragmentShaderModule = createShaderModule(secondFragmentShaderCode);
-
-  vertexShaderStageCreateInfo.module = secondVertexShaderModule;
-  fragmentShaderStageCreateInfo.module = secondFragmentShaderModule;
-
-  VkPipelineShaderStageCreateInfo secondShaderStages[] = {vertexShaderStageCreateInfo, fragmentShaderStageCreateInfo};
-
-  vertexInputCreateInfo.vertexBindingDescriptionCount = 0;
-  vertexInputCreateInfo.pVertexBindingDescriptions = nullptr;
-  vertexInputCreateInfo.vertexAttributeDescriptionCount = 0;
-  vertexInputCreateInfo.pVertexAttributeDescriptions;
-
-  depthStencilCreateInfo.depthWriteEnable = VK_FALSE;
+  std::vector<VkPushConstantRange> secondPushConstantRanges = SpirvReflection::mergePushConstants(
+    {shaderLibrary.getReflection("shaders/second_vert.spv"), shaderLibrary.getReflection(postFragmentShader())});
 
   VkPipelineLayoutCreateInfo secondPipelineLayoutCreateInfo{};
   secondPipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
   secondPipelineLayoutCreateInfo.setLayoutCount = 1;
   secondPipelineLayoutCreateInfo.pSetLayouts = &inputSetLayout;
-  secondPipelineLayoutCreateInfo.pushConstantRangeCount = 0;
-  secondPipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
-
+  secondPipelineLayoutCreateInfo.pushConstantRangeCount = static_cast<uint32_t>(secondPushConstantRanges.size());
+  secondPipelineLayoutCreateInfo.pPushConstantRanges = secondPushConstantRanges.data();
 
   result = vkCreatePipelineLayout(mainDevice.logicalDevice, &secondPipelineLayoutCreateInfo, nullptr, &secondPipelineLayout);
   if(result != VK_SUCCESS)
   {
     throw std::runtime_error("Failed to create second Pipeline Layout!");
   }
+}
 
-  pipelineCreateInfo.pStages = secondShaderStages;
-  pipelineCreateInfo.layout = secondPipelineLayout;
-  pipelineCreateInfo.subpass = 1;
-
-  result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &secondPipeline);
-  if(result != VK_SUCCESS)
+void VulkanRenderer::createGraphicsPipeline()
+{
+  // one mesh permutation per blend mode, the column stride of the transform buffer is specialized in
+  PipelineKey meshKey{};
+  meshKey.vertexShader = "shaders/vert.spv";
+  meshKey.fragmentShader = "shaders/frag.spv";
+  meshKey.vertexLayout = VertexLayout::Mesh;
+  meshKey.renderPass = renderPass;
+  meshKey.subpass = 0;
+  meshKey.layout = pipelineLayout;
+  meshKey.samples = msaaSamples;
+  meshKey.vertexConstants[0] = transformBuffer.getCapacity();
+  meshKey.vertexConstantCount = 1;
+
+  meshPipelineKeys[static_cast<size_t>(BlendMode::Opaque)] = meshKey;
+
+  meshKey.blendMode = BlendMode::Alpha;
+  meshKey.depthWrite = false;
+  meshPipelineKeys[static_cast<size_t>(BlendMode::Alpha)] = meshKey;
+
+  PipelineKey secondKey{};
+  secondKey.vertexShader = "shaders/second_vert.spv";
+  secondKey.fragmentShader = postFragmentShader();
+  secondKey.vertexLayout = VertexLayout::None;
+  secondKey.blendMode = BlendMode::Alpha;
+  secondKey.depthWrite = false;
+  secondKey.renderPass = renderPass;
+  secondKey.subpass = 1;
+  secondKey.layout = secondPipelineLayout;
+  secondKey.fragmentConstants[0] = POST_EFFECT_ALL;
+  secondKey.fragmentConstantCount = 1;
+  secondPipelineKey = secondKey;
+
+  // the opaque mesh pipeline doubles as the fallback for permutations still compiling
+  graphicsPipeline = pipelineLibrary.compile(meshPipelineKeys[static_cast<size_t>(BlendMode::Opaque)]);
+  secondPipeline = pipelineLibrary.compile(secondKey);
+
+  secondKey.fragmentConstants[0] = postConstants.effects;
+  pipelineLibrary.request(secondKey);
+
+  for(const auto &key: meshPipelineKeys)
   {
-    throw std::runtime_error("Failed to create second Render Pipeline!"); 
+    pipelineLibrary.request(key);
   }
-
-  // cleanup shaders after pipeline creation
-  vkDestroyShaderModule(mainDevice.logicalDevice, fragmentShaderModule, nullptr);
-  vkDestroyShaderModule(mainDevice.logicalDevice, vertexShaderModule, nullptr);
-
-  vkDestroyShaderModule(mainDevice.logicalDevice, secondFragmentShaderModule, nullptr);
-  vkDestroyShaderModule(mainDevice.logicalDevice, secondVertexShaderModule, nullptr);
 }
 
 void VulkanRenderer::createRenderPass()
@@ -1274,7 +1825,7 @@ void VulkanRenderer::createRenderPass()
       {VK_FORMAT_R8G8B8A8_UNORM},
        VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
   );
-  colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  colorAttachment.samples = msaaSamples;
   colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
   colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
   colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
@@ -1284,11 +1835,11 @@ void VulkanRenderer::createRenderPass()
 
   VkAttachmentDescription depthAttachment{};
   depthAttachment.format = depthFormat;
-  depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT; 
+  depthAttachment.samples = msaaSamples;
   depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
   depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
   depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
   depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
   depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
@@ -1306,27 +1857,42 @@ void VulkanRenderer::createRenderPass()
   subpasses[0].pColorAttachments = &colorAttachmentReference;
   subpasses[0].pDepthStencilAttachment = &depthAttachmentReference; 
 
+  // resolved on tile at the end of the subpass, only the resolved colour is read afterwards
+  bool multisampled = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+
+  VkAttachmentDescription resolveAttachment = colorAttachment;
+  resolveAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  resolveAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+
+  VkAttachmentReference resolveAttachmentReference{};
+  resolveAttachmentReference.attachment = 3;
+  resolveAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  subpasses[0].pResolveAttachments = multisampled ? &resolveAttachmentReference : nullptr;
+
 
   ///////////////////////////////////////////////////////////////////////////////////////////
   // subpass2 attachments
   //
 
+  // the render graph moves the scene image in and out of the attachment layout. with a post chain
+  // it is the chain's source, otherwise the swapchain image
   VkAttachmentDescription swapChainColorAttachment{};
-  swapChainColorAttachment.format = swapChainImageFormat;
+  swapChainColorAttachment.format = postChain.isEmpty() ? swapChainImageFormat : postChain.getFormat();
   swapChainColorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
   swapChainColorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
   swapChainColorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
   swapChainColorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
   swapChainColorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  swapChainColorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED; //before rendering
-  swapChainColorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; //after rendering
+  swapChainColorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL; //before rendering
+  swapChainColorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL; //after rendering
 
   VkAttachmentReference swapChainColorAttachmentReference{};
   swapChainColorAttachmentReference.attachment = 0;
   swapChainColorAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
   std::array<VkAttachmentReference, 2> inputReferences{};
-  inputReferences[0].attachment = 1;
+  inputReferences[0].attachment = multisampled ? 3 : 1;
   inputReferences[0].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
   inputReferences[1].attachment = 2;
   inputReferences[1].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
@@ -1341,38 +1907,39 @@ void VulkanRenderer::createRenderPass()
   ///////////////////////////////////////////////////////////////////////////////////////////
   // subpass dependencies
   //
-  std::array<VkSubpassDependency, 3> subpassDependencies;
+  std::array<VkSubpassDependency, 2> subpassDependencies;
 
-  //from image layout undefined to image layout color attachment optimal
+  // colour and depth are shared between frames in flight, the previous frame has to be done
+  // writing and reading them as input attachments before they are cleared again
   subpassDependencies[0].srcSubpass    = VK_SUBPASS_EXTERNAL;
-  subpassDependencies[0].srcStageMask  = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-  subpassDependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+  subpassDependencies[0].srcStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+                                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  subpassDependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
   subpassDependencies[0].dstSubpass    = 0;
-  subpassDependencies[0].dstStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  subpassDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  subpassDependencies[0].dstStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                         VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  subpassDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                                         VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
   subpassDependencies[0].dependencyFlags = 0;
   
   // from subpass1 to subpass2
   subpassDependencies[1].srcSubpass = 0;
-  subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  subpassDependencies[1].srcAccessMask= VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  subpassDependencies[1].srcAccessMask= VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
   subpassDependencies[1].dstSubpass = 1;
   subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
   subpassDependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
   subpassDependencies[1].dependencyFlags = 0;
 
-  // subpass 2 to output
-  subpassDependencies[2].srcSubpass    = 1;
-  subpassDependencies[2].srcStageMask  = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  subpassDependencies[2].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-  subpassDependencies[2].dstSubpass    = VK_SUBPASS_EXTERNAL;
-  subpassDependencies[2].dstStageMask  = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-  subpassDependencies[2].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-  subpassDependencies[2].dependencyFlags = 0;
+  // what happens to the scene image before and after is ordered by the render graph's barriers
 
   // create render pass
 
-  std::array<VkAttachmentDescription, 3> renderPassAttachements = {swapChainColorAttachment, colorAttachment, depthAttachment};
+  std::vector<VkAttachmentDescription> renderPassAttachements = {swapChainColorAttachment, colorAttachment, depthAttachment};
+  if(multisampled)
+  {
+    renderPassAttachements.push_back(resolveAttachment);
+  }
 
   VkRenderPassCreateInfo renderPassCreateInfo{};
   renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -1391,36 +1958,23 @@ void VulkanRenderer::createRenderPass()
 }
 
 
-VkShaderModule VulkanRenderer::createShaderModule(const std::vector<char> &code)
-{
-  VkShaderModuleCreateInfo shaderModuleCreateInfo{};
-  shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-  shaderModuleCreateInfo.codeSize = code.size();
-  shaderModuleCreateInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
-
-  VkShaderModule shaderModule;
-  VkResult result = vkCreateShaderModule(mainDevice.logicalDevice, &shaderModuleCreateInfo, nullptr, &shaderModule);
-  if(result != VK_SUCCESS)
-  {
-    throw std::runtime_error("Failed to create a Shader Module!");
-  }
-
-  return shaderModule;
-}
-
 //##############################( CREATE FRAMEBUFFERS )##############################
   
 void VulkanRenderer::createFrameBuffers()
 {
-  swapChainFrameBuffers.resize(swapChainImages.size());
+  frameBuffers.resize(swapChainImages.size());
 
-  for(size_t i=0; i<swapChainFrameBuffers.size(); i++)
+  for(size_t i=0; i<swapChainImages.size(); i++)
   {
-    std::array<VkImageView, 3> attachments = {
-      swapChainImages[i].imageView,
-      colorBufferImageView[i],
-      depthBufferImageView[i]
+    std::vector<VkImageView> attachments = {
+      postChain.isEmpty() ? swapChainImages[i].imageView : renderGraph.getImageView(sceneResource),
+      colorBufferImageView,
+      depthBufferImageView
     };
+    if(msaaSamples != VK_SAMPLE_COUNT_1_BIT)
+    {
+      attachments.push_back(colorResolveImageView);
+    }
 
     VkFramebufferCreateInfo frameBufferCreateInfo{};
     frameBufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
@@ -1431,7 +1985,7 @@ void VulkanRenderer::createFrameBuffers()
     frameBufferCreateInfo.height = swapChainExtent.height;
     frameBufferCreateInfo.layers = 1;
 
-    VkResult result = vkCreateFramebuffer(mainDevice.logicalDevice, &frameBufferCreateInfo, nullptr,&swapChainFrameBuffers[i]);
+    VkResult result = vkCreateFramebuffer(mainDevice.logicalDevice, &frameBufferCreateInfo, nullptr, &frameBuffers[i]);
 
     if(result != VK_SUCCESS)
     {
@@ -1440,25 +1994,106 @@ void VulkanRenderer::createFrameBuffers()
   }
 }
 
-void VulkanRenderer::createDepthBufferImage()
+void VulkanRenderer::buildRenderGraph()
+{
+  renderGraph.reset();
+
+  targetResource = renderGraph.importImage("target", swapChainImageFormat);
+  sceneResource = targetResource;
+  if(!postChain.isEmpty())
+  {
+    sceneResource = renderGraph.createImage("scene", postChain.getFormat(), swapChainExtent);
+  }
+
+  // colour and depth stay inside the render pass, only its output is known to the graph
+  RenderGraph::Pass scene = renderGraph.addPass("scene", [this](VkCommandBuffer commandBuffer){
+    recordScene(commandBuffer);
+  });
+  renderGraph.write(scene, sceneResource, ImageUsage::ColorAttachment);
+
+  if(!postChain.isEmpty())
+  {
+    postChain.addPasses(&renderGraph, sceneResource, targetResource, swapChainExtent);
+  }
+
+  if(headless)
+  {
+    RenderGraph::Pass readback = renderGraph.addPass("readback", [this](VkCommandBuffer commandBuffer){
+      // draw took the slot before recording, there is none when the consumer holds all of them
+      if(readbackSlot == FrameReadback::NO_SLOT) return;
+      frameReadback.recordCopy(commandBuffer, swapChainImages[recordingImage].image, readbackSlot, frameCounter + 1);
+    });
+    renderGraph.read(readback, targetResource, ImageUsage::Transfer);
+  }
+  else
+  {
+    RenderGraph::Pass present = renderGraph.addPass("present", nullptr);
+    renderGraph.read(present, targetResource, ImageUsage::Present);
+  }
+
+  renderGraph.compile();
+  postChain.updateDescriptorSets(&renderGraph);
+
+  startupMetrics.graphMemory = renderGraph.getMemoryStats().allocated;
+  startupMetrics.graphMemoryUnaliased = renderGraph.getMemoryStats().requested;
+}
+
+void VulkanRenderer::destroyAttachments()
 {
-  depthBufferImage.resize(swapChainImages.size());
-  depthBufferImageMemory.resize(swapChainImages.size());
-  depthBufferImageView.resize(swapChainImages.size());
+  for(auto framebuffer: frameBuffers)
+  {
+    vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
+  }
+  frameBuffers.clear();
+
+  vkDestroyImageView(mainDevice.logicalDevice, colorBufferImageView, nullptr);
+  vkDestroyImage(mainDevice.logicalDevice, colorBufferImage, nullptr);
+  MemoryTracker::free(mainDevice.logicalDevice, colorBufferImageMemory);
+
+  vkDestroyImageView(mainDevice.logicalDevice, depthBufferImageView, nullptr);
+  vkDestroyImage(mainDevice.logicalDevice, depthBufferImage, nullptr);
+  MemoryTracker::free(mainDevice.logicalDevice, depthBufferImageMemory);
+
+  if(msaaSamples != VK_SAMPLE_COUNT_1_BIT)
+  {
+    vkDestroyImageView(mainDevice.logicalDevice, colorResolveImageView, nullptr);
+    vkDestroyImage(mainDevice.logicalDevice, colorResolveImage, nullptr);
+    MemoryTracker::free(mainDevice.logicalDevice, colorResolveImageMemory);
+  }
+}
 
+void VulkanRenderer::createDepthBufferImage()
+{
   depthFormat = chooseSupportedFormat(
       {VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT },
        VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
   );
 
-  for(size_t i=0; i<swapChainImages.size(); i++)
-  {
-    depthBufferImage[i] = createImage(swapChainExtent.width, swapChainExtent.height, depthFormat,  VK_IMAGE_TILING_OPTIMAL, 
-                                  VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT
-                                  , VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depthBufferImageMemory[i]);
+  depthBufferImage = createImage(swapChainExtent.width, swapChainExtent.height, depthFormat,  VK_IMAGE_TILING_OPTIMAL, 
+                                 VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+                                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, MemoryCategory::Attachment,
+                                 &depthBufferImageMemory,
+                                 msaaSamples);
+
+  depthBufferImageView = createImageView(depthBufferImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+}
+
+VkSampleCountFlagBits VulkanRenderer::chooseSampleCount(uint32_t requested)
+{
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &deviceProperties);
+  VkSampleCountFlags supported = deviceProperties.limits.framebufferColorSampleCounts &
+                                 deviceProperties.limits.framebufferDepthSampleCounts;
 
-    depthBufferImageView[i] = createImageView(depthBufferImage[i], depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+  // highest supported count that does not exceed the request, 1 is always supported
+  for(uint32_t samples = 8; samples > 1; samples /= 2)
+  {
+    if(samples <= requested && (supported & samples))
+    {
+      return static_cast<VkSampleCountFlagBits>(samples);
+    }
   }
+  return VK_SAMPLE_COUNT_1_BIT;
 }
 
 VkFormat VulkanRenderer::chooseSupportedFormat(const std::vector<VkFormat> &formats, VkImageTiling tiling, VkFormatFeatureFlags featureFlags)
@@ -1497,31 +2132,85 @@ void VulkanRenderer::createCommandPool()
   {
     throw std::runtime_error("Failed to create Command Pool!");
   }
+
+  // frame pools are reset as a whole once their frame has retired
+  VkCommandPoolCreateInfo framePoolInfo{};
+  framePoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  framePoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  framePoolInfo.queueFamilyIndex = indices.graphicsFamily;
+
+  for(auto &frame: frames)
+  {
+    result = vkCreateCommandPool(mainDevice.logicalDevice, &framePoolInfo, nullptr, &frame.commandPool);
+    if(result != VK_SUCCESS)
+    {
+      throw std::runtime_error("Failed to create Frame Command Pool!");
+    }
+  }
 }
 
 void VulkanRenderer::createCommandBuffers()
 {
-  commandBuffers.resize(swapChainFrameBuffers.size());
-  VkCommandBufferAllocateInfo cbAllocInfo{};
-  cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  cbAllocInfo.commandPool = graphicsCommandPool;
-  cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-
-  cbAllocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
-
-  VkResult result = vkAllocateCommandBuffers(mainDevice.logicalDevice, &cbAllocInfo, commandBuffers.data());
-  if(result != VK_SUCCESS)
+  for(auto &frame: frames)
   {
-    throw std::runtime_error("Failed to allocate Command Buffers!");
+    VkCommandBufferAllocateInfo cbAllocInfo{};
+    cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    cbAllocInfo.commandPool = frame.commandPool;
+    cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cbAllocInfo.commandBufferCount = 1;
+
+    VkResult result = vkAllocateCommandBuffers(mainDevice.logicalDevice, &cbAllocInfo, &frame.commandBuffer);
+    if(result != VK_SUCCESS)
+    {
+      throw std::runtime_error("Failed to allocate Command Buffers!");
+    }
   }
 }
 
 void VulkanRenderer::recordCommands(uint32_t imageIndex)
 {
+  PROFILE_ZONE("recordCommands");
+  FrameContext &frame = frames[currentFrame];
+
+  // the timeline has passed this frame's last use, so everything allocated from its pool is free again
+  vkResetCommandPool(mainDevice.logicalDevice, frame.commandPool, 0);
+
   //how to start a command buffer
   VkCommandBufferBeginInfo bufferBeginInfo{};
   bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
+  //start record
+  VkResult result = vkBeginCommandBuffer(frame.commandBuffer, &bufferBeginInfo);
+  if(result != VK_SUCCESS)
+  {
+    throw std::runtime_error("Failed to record Command Buffer!");
+  }
+
+  recordingImage = imageIndex;
+  renderGraph.bindImage(targetResource, swapChainImages[imageIndex].image);
+  postChain.beginFrame(postParameters, &renderStats);
+  gpuProfiler.beginFrame(frame.commandBuffer, currentFrame, frameCounter + 1);
+  renderStats.beginFrame(frame.commandBuffer, currentFrame, frameCounter + 1);
+  renderGraph.execute(frame.commandBuffer, &gpuProfiler);
+  renderStats.endFrame(frame.commandBuffer);
+  gpuProfiler.endFrame(frame.commandBuffer);
+
+  const RenderStats::Counters &counters = renderStats.getCounters();
+  frameMetrics.drawCalls = counters.drawCalls;
+  frameMetrics.triangles = counters.triangles;
+
+  //stop record
+  result = vkEndCommandBuffer(frame.commandBuffer);
+  if(result != VK_SUCCESS)
+  {
+    throw std::runtime_error("Failed to record Command Buffer!");
+  }
+}
+
+void VulkanRenderer::recordScene(VkCommandBuffer commandBuffer)
+{
+  FrameContext &frame = frames[currentFrame];
+
   //how to start a render pass
   VkRenderPassBeginInfo renderPassBeginInfo{};
   renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -1537,74 +2226,126 @@ void VulkanRenderer::recordCommands(uint32_t imageIndex)
   renderPassBeginInfo.pClearValues = clearValues.data();
   renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
 
-    //start record
-    VkResult result = vkBeginCommandBuffer(commandBuffers[imageIndex], &bufferBeginInfo);
-    if(result != VK_SUCCESS)
-    {
-      throw std::runtime_error("Failed to record Command Buffer!");
-    }
-
     //begin render pass
-    renderPassBeginInfo.framebuffer = swapChainFrameBuffers[imageIndex];
-    vkCmdBeginRenderPass(commandBuffers[imageIndex], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    renderPassBeginInfo.framebuffer = frameBuffers[recordingImage];
+    vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    gpuProfiler.beginZone(commandBuffer, "scene.geometry");
+
+      // shared by both subpasses
+      VkViewport viewport{};
+      viewport.x = 0.0f;
+      viewport.y = 0.0f;
+      viewport.width = (float) swapChainExtent.width;
+      viewport.height = (float) swapChainExtent.height;
+      viewport.minDepth = 0.0f;
+      viewport.maxDepth = 1.0f;
+      vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+      VkRect2D scissor{};
+      scissor.offset = {0, 0};
+      scissor.extent = swapChainExtent;
+      vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
       //bind and execute pipeline
-      vkCmdBindPipeline(commandBuffers[imageIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-      
-      for(size_t j=0; j<modelList.size(); j++){
+      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+      renderStats.countPipelineBind();
+      VkPipeline boundPipeline = graphicsPipeline;
 
-        MeshModel thisModel = modelList[j];
+      uint32_t vpOffset = static_cast<uint32_t>(frameAllocator.persistent(currentFrame).offset);
 
-        glm::mat4 modelMatrix = thisModel.getModel();
+      // all model matrices of this frame, indexed by gl_InstanceIndex
+      vkCmdBindDescriptorSets(
+          commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 2,
+          1, &frame.transformDescriptorSet, 0, nullptr
+      );
+      renderStats.countDescriptorBind();
 
-        vkCmdPushConstants(
-            commandBuffers[imageIndex],
-            pipelineLayout,
-            VK_SHADER_STAGE_VERTEX_BIT,
-            0, sizeof(Model), &modelMatrix
-        );
+      for(size_t j=0; j<models.size(); j++){
 
+        MeshModel &thisModel = models[j];
 
         for(size_t k=0; k<thisModel.getMeshCount(); k++)
         {
 
           VkBuffer vertexBuffers[] = {thisModel.getMesh(k)->getVertexBuffer()};
           VkDeviceSize offsets[] = {0};
-          vkCmdBindVertexBuffers(commandBuffers[imageIndex], 0, 1, vertexBuffers, offsets);
-          vkCmdBindIndexBuffer(commandBuffers[imageIndex], thisModel.getMesh(k)->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+          vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+          vkCmdBindIndexBuffer(commandBuffer, thisModel.getMesh(k)->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
 
 
-          std::array<VkDescriptorSet, 2> descriptorSetGroup =  {descriptorSets[imageIndex], samplerDescriptorSets[thisModel.getMesh(k)->getTexId()]};
+          std::array<VkDescriptorSet, 2> descriptorSetGroup =  {descriptorSet, samplerDescriptorSets[thisModel.getMesh(k)->getTexId()]};
 
           vkCmdBindDescriptorSets(
-              commandBuffers[imageIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 
-              static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data(), 0, nullptr
+              commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 
+              static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data(), 1, &vpOffset
           );
-
-          vkCmdDrawIndexed(commandBuffers[imageIndex], thisModel.getMesh(k)->getIndexCount(), 1, 0, 0, 0);
+          renderStats.countDescriptorBind();
+
+          Mesh *mesh = thisModel.getMesh(k);
+
+          // permutations still compiling on a worker draw with the opaque pipeline meanwhile
+          VkPipeline meshPipeline = graphicsPipeline;
+          if(mesh->getBlendMode() != BlendMode::Opaque)
+          {
+            VkPipeline permutation = pipelineLibrary.find(meshPipelineKeys[static_cast<size_t>(mesh->getBlendMode())]);
+            if(permutation != VK_NULL_HANDLE) meshPipeline = permutation;
+          }
+          if(meshPipeline != boundPipeline)
+          {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, meshPipeline);
+            renderStats.countPipelineBind();
+            boundPipeline = meshPipeline;
+          }
+
+          uint32_t lodIndex = mesh->selectLod(lodPixelsPerUnit(mesh, transformBuffer.getTransform(thisModel.getInstanceId() + thisModel.getMeshNode(k))), lodPixelError, lodHysteresis);
+          const MeshLod &lod = mesh->getLod(lodIndex);
+
+          vkCmdDrawIndexed(commandBuffer, lod.indexCount, 1, lod.firstIndex, 0,
+                           thisModel.getInstanceId() + thisModel.getMeshNode(k));
+          renderStats.countDraw(1, lod.indexCount/3);
 
         }
         
       }
       // start second subpass
       //
-      vkCmdNextSubpass(commandBuffers[imageIndex], VK_SUBPASS_CONTENTS_INLINE);
-      vkCmdBindPipeline(commandBuffers[imageIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipeline);
-      vkCmdBindDescriptorSets(commandBuffers[imageIndex], VK_PIPELINE_BIND_POINT_GRAPHICS,
-                              secondPipelineLayout,0,1,&inputDescriptorSets[imageIndex], 0, nullptr);
-      vkCmdDraw(commandBuffers[imageIndex], 3, 1, 0, 0);
+      gpuProfiler.endZone(commandBuffer);
+      vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_INLINE);
+      gpuProfiler.beginZone(commandBuffer, "scene.composite");
+      // the variant without the disabled branches once it is built, the generic pass until then
+      PipelineKey variantKey = secondPipelineKey;
+      variantKey.fragmentConstants[0] = postConstants.effects;
+      VkPipeline postPipeline = pipelineLibrary.find(variantKey);
+
+      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, postPipeline ? postPipeline : secondPipeline);
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              secondPipelineLayout,0,1,&frame.inputDescriptorSet, 0, nullptr);
+      vkCmdPushConstants(commandBuffer, secondPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT,
+                         0, sizeof(PostConstants), &postConstants);
+      vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+      renderStats.countPipelineBind();
+      renderStats.countDescriptorBind();
+      renderStats.countPushConstants();
+      renderStats.countDraw(1, 1);
+      gpuProfiler.endZone(commandBuffer);
 
 
     //end render pass
-    vkCmdEndRenderPass(commandBuffers[imageIndex]);
+    vkCmdEndRenderPass(commandBuffer);
+}
 
-  //stop record
-  result = vkEndCommandBuffer(commandBuffers[imageIndex]);
-  if(result != VK_SUCCESS)
-  {
-    throw std::runtime_error("Failed to record Command Buffer!");
-  }
+float VulkanRenderer::lodPixelsPerUnit(Mesh *mesh, const glm::mat4 &modelMatrix)
+{
+  // object space error is scaled by the largest axis scale of the model matrix
+  float scale = std::max({glm::length(glm::vec3(modelMatrix[0])), glm::length(glm::vec3(modelMatrix[1])),
+                          glm::length(glm::vec3(modelMatrix[2]))});
 
+  glm::vec4 viewCenter = uboViewProjection.view*modelMatrix*glm::vec4(mesh->getBoundsCenter(), 1.0f);
+  float distance = std::max(-viewCenter.z - mesh->getBoundsRadius()*scale, 0.1f);
+
+  // projection[1][1] is cot(fov/2), negated for the flipped y axis
+  float pixelsPerUnitAtOne = std::abs(uboViewProjection.projection[1][1])*0.5f*swapChainExtent.height;
+  return scale*pixelsPerUnitAtOne/distance;
 }
 
 //##############################( CREATE LOADER FUNCTIONS )##############################
@@ -1615,13 +2356,23 @@ int VulkanRenderer::createTextureImage(std::string fileName)
   VkDeviceSize imageSize;
 
   stbi_uc *imageData = loadTextureFile(fileName, &width, &height, &imageSize);
+  int textureImageLoc = createTextureImage(imageData, static_cast<uint32_t>(width), static_cast<uint32_t>(height));
+  stbi_image_free(imageData);
+
+  return textureImageLoc;
+}
+
+int VulkanRenderer::createTextureImage(const stbi_uc *imageData, uint32_t width, uint32_t height)
+{
+  PROFILE_ZONE("createTextureImage");
+  VkDeviceSize imageSize = VkDeviceSize(width)*height*4;
 
   VkBuffer imageStagingBuffer;
   VkDeviceMemory imageStagingBufferMemory;
   createBuffer(
     mainDevice.physicalDevice, mainDevice.logicalDevice, imageSize,
     VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Staging,
     &imageStagingBuffer, &imageStagingBufferMemory
   );
 
@@ -1630,14 +2381,13 @@ int VulkanRenderer::createTextureImage(std::string fileName)
   memcpy(data, imageData, static_cast<uint32_t>(imageSize));
   vkUnmapMemory(mainDevice.logicalDevice, imageStagingBufferMemory);
 
-  stbi_image_free(imageData);
-
   VkImage texImage;
   VkDeviceMemory texImageMemory;
 
-  texImage = createImage(static_cast<uint32_t>(width), static_cast<uint32_t>(height),
+  texImage = createImage(width, height,
       VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, 
-      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texImageMemory
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      MemoryCategory::Texture, &texImageMemory
   );
 
   transitionImageLayout(mainDevice.logicalDevice, graphicsQueue,  graphicsCommandPool, 
@@ -1652,7 +2402,7 @@ int VulkanRenderer::createTextureImage(std::string fileName)
   textureImageMemory.push_back(texImageMemory);
 
   vkDestroyBuffer(mainDevice.logicalDevice, imageStagingBuffer, nullptr);
-  vkFreeMemory(mainDevice.logicalDevice, imageStagingBufferMemory, nullptr);
+  MemoryTracker::free(mainDevice.logicalDevice, imageStagingBufferMemory);
 
 
   return textureImages.size() - 1;
@@ -1713,8 +2463,24 @@ stbi_uc* VulkanRenderer::loadTextureFile(std::string fileName, int *width, int *
 
 int VulkanRenderer::createTexture(std::string fileName)
 {
-  int textureImageLoc = createTextureImage(fileName);
+  return createTextureView(createTextureImage(fileName));
+}
+
+int VulkanRenderer::createTexture(const std::vector<uint8_t> &pixels, uint32_t width, uint32_t height)
+{
+  if(pixels.size() < size_t(width)*height*4)
+  {
+    throw std::runtime_error("Failed to create Texture, not enough pixels!");
+  }
+  if(samplerDescriptorSets.size() >= MAX_OBJECTS)
+  {
+    throw std::runtime_error("Maximum number of Textures reached!");
+  }
+  return createTextureView(createTextureImage(pixels.data(), width, height));
+}
 
+int VulkanRenderer::createTextureView(int textureImageLoc)
+{
   VkImageView imageView = createImageView(textureImages[textureImageLoc], VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT);
   textureImageViews.push_back(imageView);
 
@@ -1737,8 +2503,8 @@ void VulkanRenderer::createTextureSampler()
   samplerCreateInfo.mipLodBias = 0.0f;
   samplerCreateInfo.minLod = 0.0f;
   samplerCreateInfo.maxLod = 0.0f;
-  samplerCreateInfo.anisotropyEnable = VK_TRUE;
-  samplerCreateInfo.maxAnisotropy = 16;
+  samplerCreateInfo.anisotropyEnable = anisotropySupported ? VK_TRUE : VK_FALSE;
+  samplerCreateInfo.maxAnisotropy = anisotropySupported ? 16.0f : 1.0f;
 
   VkResult result = vkCreateSampler(mainDevice.logicalDevice, &samplerCreateInfo, nullptr, &textureSampler);
   if(result != VK_SUCCESS)
@@ -1752,21 +2518,25 @@ void VulkanRenderer::createTextureSampler()
 
 void VulkanRenderer::createColorBufferImage()
 {
-
-  colorBufferImage.resize(swapChainImages.size());
-  colorBufferImageMemory.resize(swapChainImages.size());
-  colorBufferImageView.resize(swapChainImages.size());
-
   VkFormat colorFormat = chooseSupportedFormat(
       {VK_FORMAT_R8G8B8A8_UNORM},
        VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
   );
 
-  for(size_t i=0; i<swapChainImages.size(); i++)
+  colorBufferImage = createImage(swapChainExtent.width, swapChainExtent.height, colorFormat,  VK_IMAGE_TILING_OPTIMAL, 
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, MemoryCategory::Attachment,
+      &colorBufferImageMemory, msaaSamples);
+
+  colorBufferImageView = createImageView(colorBufferImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+
+  if(msaaSamples != VK_SAMPLE_COUNT_1_BIT)
   {
-    colorBufferImage[i] = createImage(swapChainExtent.width, swapChainExtent.height, colorFormat,  VK_IMAGE_TILING_OPTIMAL, 
-        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &colorBufferImageMemory[i]);
+    colorResolveImage = createImage(swapChainExtent.width, swapChainExtent.height, colorFormat,  VK_IMAGE_TILING_OPTIMAL, 
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, MemoryCategory::Attachment,
+        &colorResolveImageMemory);
 
-    colorBufferImageView[i] = createImageView(colorBufferImage[i], colorFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+    colorResolveImageView = createImageView(colorResolveImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT);
   }
 }
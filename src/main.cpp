@@ -1,4 +1,3 @@
-#define STB_IMAGE_IMPLEMENTATION
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -6,11 +5,17 @@
 #include <stdexcept>
 #include <vector>
 #include <iostream>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "VulkanRenderer.h"
+#include "FrameWriter.h"
+#include "CpuProfiler.h"
+#include "MemoryTracker.h"
 
 GLFWwindow * window;
 VulkanRenderer vulkanRenderer;
@@ -22,27 +27,292 @@ void initWindow(std::string wName = "Test Window", const int width = 800, const
 
   // Set GLFW to NOT work with OpenGL
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+  glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
   window = glfwCreateWindow(width, height, wName.c_str(), nullptr, nullptr);
+  glfwSetFramebufferSizeCallback(window, [](GLFWwindow *, int, int){ vulkanRenderer.notifyFramebufferResized(); });
 }
 
-int main()
+void printStartupMetrics()
 {
+  const VulkanRenderer::StartupMetrics &metrics = vulkanRenderer.getStartupMetrics();
+  printf("init %.1fms, pipelines %.1fms (%s, %zu bytes)\n", metrics.initMs, metrics.pipelineMs,
+         metrics.pipelineCacheHit ? "pipeline cache hit" : "no pipeline cache", metrics.pipelineCacheSize);
+  if(metrics.graphMemoryUnaliased > 0)
+  {
+    printf("render graph images %.1fMB, %.1fMB without aliasing\n", metrics.graphMemory/1048576.0,
+           metrics.graphMemoryUnaliased/1048576.0);
+  }
+}
+
+std::string formatStats()
+{
+  const RenderStats::Counters &counters = vulkanRenderer.getRenderStats();
+  char text[256];
+  snprintf(text, sizeof(text), "%u draws, %u instances, %llu triangles, %u dispatches, %u pipeline binds, "
+           "%u descriptor binds, %u push constants", counters.drawCalls, counters.instances,
+           static_cast<unsigned long long>(counters.triangles), counters.dispatches, counters.pipelineBinds,
+           counters.descriptorBinds, counters.pushConstants);
+  return text;
+}
+
+void printStats()
+{
+  printf("frame %s\n", formatStats().c_str());
+  const RenderStats::PipelineStatistics &statistics = vulkanRenderer.getPipelineStatistics();
+  if(statistics.frameIndex > 0)
+  {
+    printf("gpu frame %llu: %llu primitives, %llu vertex invocations, %llu clipped primitives, "
+           "%llu fragment invocations, %llu compute invocations\n", static_cast<unsigned long long>(statistics.frameIndex),
+           static_cast<unsigned long long>(statistics.inputPrimitives),
+           static_cast<unsigned long long>(statistics.vertexInvocations),
+           static_cast<unsigned long long>(statistics.clippedPrimitives),
+           static_cast<unsigned long long>(statistics.fragmentInvocations),
+           static_cast<unsigned long long>(statistics.computeInvocations));
+  }
+}
+
+void printMemory()
+{
+  for(size_t i=0; i<static_cast<size_t>(MemoryCategory::Count); i++)
+  {
+    MemoryCategory category = static_cast<MemoryCategory>(i);
+    MemoryTracker::CategoryStats stats = MemoryTracker::getStats(category);
+    printf("memory %-10s %.1fMB, peak %.1fMB (%u allocations)\n", MemoryTracker::getCategoryName(category),
+           stats.current/1048576.0, stats.peak/1048576.0, stats.allocations);
+  }
+  printf("memory total %.1fMB, peak %.1fMB\n", MemoryTracker::getCurrent()/1048576.0, MemoryTracker::getPeak()/1048576.0);
+
+  std::vector<MemoryTracker::HeapStats> heaps = MemoryTracker::getHeapStats();
+  for(size_t i=0; i<heaps.size(); i++)
+  {
+    printf("heap %zu%s %.1fMB, ours %.1fMB", i, heaps[i].deviceLocal ? " (device local)" : "", heaps[i].size/1048576.0,
+           heaps[i].tracked/1048576.0);
+    if(heaps[i].budget > 0)
+    {
+      printf(", usage %.1fMB of %.1fMB budget", heaps[i].usage/1048576.0, heaps[i].budget/1048576.0);
+    }
+    printf("\n");
+  }
+}
+
+// comma separated, e.g. "tonemap,fxaa,sharpen,grade"
+std::vector<PostPass> parsePostPasses(const std::string &list)
+{
+  std::vector<PostPass> passes;
+  size_t start = 0;
+  while(start <= list.size())
+  {
+    size_t end = std::min(list.find(',', start), list.size());
+    std::string name = list.substr(start, end - start);
+    if(name == "tonemap") passes.push_back(PostPass::Tonemap);
+    else if(name == "fxaa") passes.push_back(PostPass::Fxaa);
+    else if(name == "sharpen") passes.push_back(PostPass::Sharpen);
+    else if(name == "grade") passes.push_back(PostPass::ColorGrade);
+    else if(!name.empty()) printf("unknown post pass %s\n", name.c_str());
+    start = end + 1;
+  }
+  return passes;
+}
+
+void printProfile(const std::string &traceFile, const std::string &cpuTraceFile)
+{
+  for(const auto &zone: vulkanRenderer.getGpuTimings())
+  {
+    printf("gpu %-16s min %.3fms avg %.3fms p99 %.3fms (%u frames)\n", zone.name.c_str(), zone.minMs, zone.averageMs,
+           zone.p99Ms, zone.samples);
+  }
+  if(!traceFile.empty() && vulkanRenderer.writeGpuTrace(traceFile))
+  {
+    printf("gpu trace written to %s\n", traceFile.c_str());
+  }
+  if(!cpuTraceFile.empty() && CpuProfiler::writeChromeTrace(cpuTraceFile))
+  {
+    printf("cpu trace written to %s\n", cpuTraceFile.c_str());
+  }
+}
+
+void updateScene(ObjectHandle model, float deltaTime, float *angle)
+{
+  *angle += 10.0f*deltaTime;
+  if(*angle > 360.0f) *angle -= 360.0f;
+
+  glm::mat4 testMat = glm::rotate(glm::mat4(1.0f), glm::radians(*angle), glm::vec3(0.0f, 1.0f, 0.0f));
+
+  vulkanRenderer.updateModel(model, testMat);
+}
+
+int runHeadless(uint32_t width, uint32_t height, uint32_t frameCount, uint32_t latencyFrames,
+                const std::string &output, const std::string &target, const std::string &traceFile,
+                const std::string &cpuTraceFile)
+{
+  if (vulkanRenderer.initHeadless(width, height) == EXIT_FAILURE)
+  {
+    return EXIT_FAILURE;
+  }
+  vulkanRenderer.setLatencyMode(latencyFrames);
+  printStartupMetrics();
+
+  // frames go straight from the readback buffers to the writer thread and come back once written
+  FrameWriter frameWriter;
+  bool writeFrames = !output.empty();
+  if(writeFrames)
+  {
+    FrameWriter::Sink sink = output == "png" ? FrameWriter::Sink::Png
+                           : output == "pipe" ? FrameWriter::Sink::Pipe : FrameWriter::Sink::Raw;
+    frameWriter.start(sink, target, [](const FrameReadback::Frame &frame){ vulkanRenderer.releaseFrame(frame); });
+  }
+
+  uint64_t framesRead = 0;
+  vulkanRenderer.setFrameCallback([&](const FrameReadback::Frame &frame){
+    framesRead++;
+    if(writeFrames)
+    {
+      frameWriter.push(frame);
+    }
+    else
+    {
+      vulkanRenderer.releaseFrame(frame);
+    }
+  });
+
+  ObjectHandle car = vulkanRenderer.createMeshModel("models/Su-25.obj");
+
+  // fixed timestep so every run renders the same frames
+  float angle = 0.0f;
+  auto start = std::chrono::steady_clock::now();
+
+  for(uint32_t i=0; i<frameCount; i++)
+  {
+    updateScene(car, 1.0f/60.0f, &angle);
+    vulkanRenderer.draw();
+  }
+  vulkanRenderer.finishFrames();
+  if(writeFrames)
+  {
+    frameWriter.stop();
+  }
+
+  float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+  printf("rendered %u frames, read back %lu in %.3fs (%.1f fps)\n", frameCount, (unsigned long) framesRead, seconds, frameCount/seconds);
+  printProfile(traceFile, cpuTraceFile);
+  printStats();
+  printMemory();
+
+  vulkanRenderer.cleanup();
+
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  PROFILE_THREAD("main");
+
+  // frames in flight, 1 for lowest input latency, 3 for throughput
+  uint32_t latencyFrames = DEFAULT_LATENCY_FRAMES;
+  uint32_t width = 1680;
+  uint32_t height = 1050;
+  bool headless = false;
+  uint32_t frameCount = 100;
+  std::string output;
+  std::string target = "frames.rgba";
+  // chrome://tracing json of the gpu zones, written on exit
+  std::string traceFile;
+  // the same for the cpu zones, needs VKDEMO_PROFILE
+  std::string cpuTraceFile;
+  VkDeviceSize memoryBudget = 0;
+  bool strictBudget = false;
+  bool showStats = false;
+  for(int i=1; i<argc; i++)
+  {
+    if(strcmp(argv[i], "--latency") == 0 && i + 1 < argc)
+    {
+      latencyFrames = static_cast<uint32_t>(atoi(argv[++i]));
+    }
+    else if(strcmp(argv[i], "--width") == 0 && i + 1 < argc)
+    {
+      width = static_cast<uint32_t>(atoi(argv[++i]));
+    }
+    else if(strcmp(argv[i], "--height") == 0 && i + 1 < argc)
+    {
+      height = static_cast<uint32_t>(atoi(argv[++i]));
+    }
+    else if(strcmp(argv[i], "--msaa") == 0 && i + 1 < argc)
+    {
+      // 1, 2, 4 or 8, clamped to the device
+      vulkanRenderer.setMsaaSamples(static_cast<uint32_t>(atoi(argv[++i])));
+    }
+    else if(strcmp(argv[i], "--post") == 0 && i + 1 < argc)
+    {
+      vulkanRenderer.setPostChain(parsePostPasses(argv[++i]));
+    }
+    else if(strcmp(argv[i], "--headless") == 0)
+    {
+      headless = true;
+    }
+    else if(strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+    {
+      frameCount = static_cast<uint32_t>(atoi(argv[++i]));
+    }
+    else if(strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+    {
+      // raw, png or pipe
+      output = argv[++i];
+    }
+    else if(strcmp(argv[i], "--target") == 0 && i + 1 < argc)
+    {
+      target = argv[++i];
+    }
+    else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+    {
+      traceFile = argv[++i];
+    }
+    else if(strcmp(argv[i], "--cpu-trace") == 0 && i + 1 < argc)
+    {
+      cpuTraceFile = argv[++i];
+    }
+    else if(strcmp(argv[i], "--stats") == 0)
+    {
+      // counters in the window title, pipeline statistics queries when the device has them
+      showStats = true;
+    }
+    else if(strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc)
+    {
+      // in MB, warns when crossed
+      memoryBudget = static_cast<VkDeviceSize>(atoi(argv[++i]))*1048576;
+    }
+    else if(strcmp(argv[i], "--strict-budget") == 0)
+    {
+      // allocations over the budget fail instead
+      strictBudget = true;
+    }
+  }
+
+  vulkanRenderer.setMemoryBudget(memoryBudget, strictBudget);
+  vulkanRenderer.setPipelineStatistics(showStats);
+
+  if(headless)
+  {
+    return runHeadless(width, height, frameCount, latencyFrames, output, target, traceFile, cpuTraceFile);
+  }
+
   // Create Window
-  initWindow("Test Window", 1680, 1050);
+  initWindow("Test Window", width, height);
 
   // Create Vulkan Renderer instance
   if (vulkanRenderer.init(window) == EXIT_FAILURE)
   {
     return EXIT_FAILURE;
   }
+  vulkanRenderer.setLatencyMode(latencyFrames);
+  printStartupMetrics();
 
   float angle=0.0f;
   float deltaTime=0.0f;
   float lastTime=0.0f;
+  float lastStatsTime=0.0f;
 
-  int car = vulkanRenderer.createMeshModel("models/Su-25.obj");
+  ObjectHandle car = vulkanRenderer.createMeshModel("models/Su-25.obj");
 
 
   // Loop until closed
@@ -54,17 +324,21 @@ int main()
     deltaTime = now - lastTime;
     lastTime = now;
     
-    angle += 10.0f*deltaTime;
-    if(angle > 360.0f) angle -= 360.0f;
-    
-    glm::mat4 testMat = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
-
-    vulkanRenderer.updateModel(car, testMat);
-
-
+    updateScene(car, deltaTime, &angle);
 
     vulkanRenderer.draw();
+
+    // there is no text rendering, the window title is the overlay
+    if(showStats && now - lastStatsTime > 0.5f)
+    {
+      glfwSetWindowTitle(window, ("Test Window - " + formatStats()).c_str());
+      lastStatsTime = now;
+    }
   }
+  vulkanRenderer.finishFrames();
+  printProfile(traceFile, cpuTraceFile);
+  printStats();
+  printMemory();
 
   vulkanRenderer.cleanup();
 